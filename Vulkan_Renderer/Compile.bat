@@ -1,3 +1,10 @@
+rem The renderer compiles (and caches) these itself at runtime, the .spv files this makes are the fallback without the sources
+rem Run this before building: the .spv files are build output (not checked in) and have to match the shader sources
 ..\..\VulkanSDK\Bin\glslc.exe Vertex_Shader.vert -o Vertex_Shader.spv
 ..\..\VulkanSDK\Bin\glslc.exe Frag_Shader.frag -o Frag_Shader.spv
+..\..\VulkanSDK\Bin\glslc.exe -DBINDLESS Frag_Shader.frag -o Frag_Shader_Bindless.spv
+..\..\VulkanSDK\Bin\glslc.exe Instanced_Shader.vert -o Instanced_Shader.spv
+..\..\VulkanSDK\Bin\glslc.exe -DCOMPACT_VERTEX Vertex_Shader.vert -o Vertex_Shader_Compact.spv
+..\..\VulkanSDK\Bin\glslc.exe -DCOMPACT_VERTEX Instanced_Shader.vert -o Instanced_Shader_Compact.spv
+..\..\VulkanSDK\Bin\glslc.exe Cull_Shader.comp -o Cull_Shader.spv
 pause
\ No newline at end of file
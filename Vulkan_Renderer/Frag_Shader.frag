@@ -1,14 +1,36 @@
 #version 450
 
-layout(binding = 1) uniform sampler2D texSampler;
+// Built with BINDLESS defined when the device has descriptor indexing: every texture is in the one array and the
+// vertex shader passes on which slot the object (or instance) uses. Without it there's only the one texture
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+#else
+layout(set = 1, binding = 0) uniform sampler2D texSampler;
+#endif
 
 // Matching input sent from the vertex shader
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in uint fragTexture;
 
 layout(location = 0) out vec4 outColor;
 
+// Feature toggles set when the pipeline's made, the compiler drops whatever is turned off
+// T and C flip them at runtime and the pipelines are rebuilt in the background
+layout(constant_id = 0) const bool USE_TEXTURE = true;
+layout(constant_id = 1) const bool USE_VERTEX_COLOUR = true;
+
 void main() {
-    // Just set the output to this colour 
-    outColor = texture(texSampler, fragTexCoord);
+    // The texture, tinted by the vertex colour (white unless it's an instance with a tint)
+    vec4 texel = vec4(1.0);
+    if (USE_TEXTURE) {
+#ifdef BINDLESS
+        // Instances in one draw can each use a different slot, so the index has to be marked as not uniform
+        texel = texture(textures[nonuniformEXT(fragTexture)], fragTexCoord);
+#else
+        texel = texture(texSampler, fragTexCoord);
+#endif
+    }
+    outColor = USE_VERTEX_COLOUR ? texel * vec4(fragColor, 1.0) : texel;
 }
\ No newline at end of file
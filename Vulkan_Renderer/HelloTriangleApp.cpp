@@ -1,10 +1,19 @@
 ﻿#include <set>
 #include <map>
+#include <unordered_map>
 #include <algorithm>
 #include <fstream>      // For loading shaders
 #include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <iomanip>
 
 #include "HelloTriangleApp.h"
+#include "MeshCache.h"
+#include "MeshOptimiser.h"
+#include "PipelineCache.h"
 
 //---- stb image loader ----
 #define STB_IMAGE_IMPLEMENTATION
@@ -13,8 +22,78 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 
-const int MAX_FRAMES_IN_FLIGHT = 2;
+// =================================================
+// Name: SetLatencyMode
+// Desc: Picks the latency mode, which sets the frames in flight and how the swap chain is made. Only before Run
+// Params: mode
+// Return: NONE
+void HelloTriangleApplication::SetLatencyMode(LatencyMode mode)
+{
+    m_latencyMode = mode;
+
+    switch (mode) {
+    case LatencyMode::LowLatency:   m_framesInFlight = 1; break;   // The CPU waits for each frame, so input can't get ahead
+    case LatencyMode::Throughput:   m_framesInFlight = 3; break;   // The CPU can run further ahead, hiding the odd slow frame
+    default:                        m_framesInFlight = 2; break;
+    }
+}
+// =================================================
+// Name: SetBenchmark
+// Desc: Runs headless instead: frameCount frames into offscreen images, then the report is written to reportPath
+//       Only before Run
+// Params: frameCount, reportPath
+// Return: NONE
+void HelloTriangleApplication::SetBenchmark(uint32_t frameCount, const std::string& reportPath)
+{
+    m_headless = true;
+    m_benchmarkFrames = frameCount;
+    m_benchmarkReportPath = reportPath;
 
+    // Every frame of the run goes into the report, not just the last few hundred
+    m_profiler.SetHistorySize(frameCount);
+}
+// =================================================
+// Name: SetTargetFrameRate
+// Desc: The frame rate the adaptive quality trades MSAA and resolution to hold, 0 turns it off (full quality always)
+//       Only before Run
+// Params: framesPerSecond
+// Return: NONE
+void HelloTriangleApplication::SetTargetFrameRate(float framesPerSecond)
+{
+    m_adaptiveQuality = framesPerSecond > 0.0f;
+    if (m_adaptiveQuality)
+        m_targetFrameTime = 1000.0f / framesPerSecond;
+}
+// =================================================
+// Name: SetStaticScene
+// Desc: Records the draws once and replays them every frame, the objects stop animating so they stay valid
+//       Only before Run
+// Params: staticScene
+// Return: NONE
+void HelloTriangleApplication::SetStaticScene(bool staticScene)
+{
+    m_staticScene = staticScene;
+}
+// =================================================
+// Name: SetRecordThreads
+// Desc: How many workers record the draws, 0 records them inline. Capped at the hardware threads when they're started
+//       Only before Run
+// Params: threadCount
+// Return: NONE
+void HelloTriangleApplication::SetRecordThreads(uint32_t threadCount)
+{
+    m_recordThreadCount = threadCount;
+}
+// =================================================
+// Name: SetPropGridSize
+// Desc: Adds a grid of gridSize squared props to the scene, all drawn as one instanced batch. 0 for none
+//       Only before Run
+// Params: gridSize
+// Return: NONE
+void HelloTriangleApplication::SetPropGridSize(uint32_t gridSize)
+{
+    m_propGridSize = gridSize;
+}
 //==================================================================================================
 //  InitWindow
 //==================================================================================================
@@ -24,6 +103,10 @@ const int MAX_FRAMES_IN_FLIGHT = 2;
 // Return: NONE
 void HelloTriangleApplication::InitWindow()
 {
+    // Nothing to show a benchmark in, and GLFW might not even have a display to open on a CI machine
+    if (m_headless)
+        return;
+
     // Initializes the GLFW library
     glfwInit();
 
@@ -47,6 +130,9 @@ void HelloTriangleApplication::CreateSurface()
 	// This has to be called before devices get picked as this can interfere
     // ------------------
 
+    if (m_headless)
+        return;
+
     // Creates our surface, changing to suit what OS we are using
     assert(glfwCreateWindowSurface(m_instance, m_window, nullptr, &m_surface) == VK_SUCCESS);
 }
@@ -55,39 +141,128 @@ void HelloTriangleApplication::CreateSurface()
 //==================================================================================================
 // Name: InitVulkan
 // Desc: Called once at the beginning, calling other init functions
+//       The file reads, decodes and model parsing are started first on their own threads and only waited on when
+//       their results are needed, so they overlap everything up to then
 // Params: NONE
 // Return: NONE
 void HelloTriangleApplication::InitVulkan()
 {
+    auto startTime = std::chrono::high_resolution_clock::now();
+    // Each phase is timed from the end of the last one
+    auto phaseStart = startTime;
+    auto endPhase = [&](const char* name) {
+        auto now = std::chrono::high_resolution_clock::now();
+        m_startupPhases.push_back({ name, std::chrono::duration<double, std::milli>(now - phaseStart).count() });
+        phaseStart = now;
+    };
+
+    //---- CPU work ----
+    StartStartupLoads();
     //---- Instance ----
     CreateInstance();
     SetupDebugMessenger();
     CreateSurface();
+    endPhase("instance");
     PickPhysicalDevice();
     CreateLogicalDevice();
+    m_allocator.Init(m_physicalDevice, m_device);
+    if (m_memoryBudget) {
+        m_allocator.SetBudgetQuery((PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(m_instance,
+            "vkGetPhysicalDeviceMemoryProperties2KHR"));
+    }
+    printf("Memory budgets %s\n", m_memoryBudget ? "from VK_EXT_memory_budget" : "estimated, no VK_EXT_memory_budget");
+    endPhase("device");
     //---- Rendering ----
     CreateSwapChain();
-    CreateRenderPass();
+    endPhase("swap chain");
+    m_pipelineCache = LoadPipelineCache(m_device, m_physicalDevice, PIPELINE_CACHE_PATH, m_pipelineCacheWarm);
     CreateDescriptorSetLayouts();
-    CreateGraphicsPipeline();
+    CreatePipelineLayouts();
+    m_graphicsShaders = LoadGraphicsShaders(true, m_useTexture, m_useVertexColour);
+    UsePassVariant();                       // The render pass and graphics pipelines
+    CreateCullPipeline(GetShaderCode("Cull_Shader.spv"), m_cullPipeline);
+    // Whichever vertex variants weren't picked
+    m_shaderCode.clear();
+    endPhase("pipelines");
     CreateCommandPool();
+    const QueueFamilyIndices queueFamilies = FindQueueFamilies(m_physicalDevice);
+    m_uploads.Init(m_device, queueFamilies.transfer_family.value_or(queueFamilies.graphics_family.value()), m_transferQueue,
+        queueFamilies.graphics_family.value(), m_graphicsQueue, m_allocator);
     //---- Images ----
     CreateRenderTargets();
     CreateDepthResources();
     CreateFrameBuffers();
-    CreateTextureImage();
-    m_textImgView = CreateImageViews(m_textImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, m_mipLevels);
+    endPhase("render targets");
+    // How long the main thread is left waiting, 0 if the reads kept up
+    m_textureRead.wait();
+    endPhase("texture wait");
+    CreateTextureImages();
     CreateImageSampler();
+    endPhase("textures");
     //---- Buffers ----
-    LoadModel();
-    CreateVertexIndexBuffer(verts, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, m_vertexBuffer, m_vertexBufferMemory);
+    for (std::future<LoadedMesh>& load : m_meshLoads)
+        load.wait();
+    endPhase("mesh wait");
+    LoadMeshes();
+    if (m_compactVertices) {
+        // The full verts stay around on the CPU (the mesh cache is written from them), only the GPU gets the compact ones
+        std::vector<CompactVertex> compactVerts;
+        BuildCompactVertices(compactVerts);
+        CreateVertexIndexBuffer(compactVerts, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, m_vertexBuffer, m_vertexBufferMemory);
+    }
+    else {
+        CreateVertexIndexBuffer(verts, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, m_vertexBuffer, m_vertexBufferMemory);
+    }
     CreateVertexIndexBuffer(indices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, m_indexBuffer, m_indexBufferMemory);
+    CreateMeshBuffer();
+    // Every upload so far goes to the GPU in one go, the rest of startup carries on while it's copying
+    m_uploads.Submit();
+    endPhase("mesh buffers");
     CreateUniformBuffers();
+    CreateObjectBuffers();
     CreateDescriptorPool();
     CreateDescriptorSets();
     CreateCommandBuffers();
+    CreateRecordThreads();
+    BuildScene();
+    CreateInstanceBuffer();
+    m_uploads.Submit();
     //---- Sync Objects ----
     CreateSyncObjects();
+    m_profiler.Init(m_device, m_physicalDevice, queueFamilies.graphics_family.value(), m_framesInFlight);
+    endPhase("scene");
+
+    m_allocator.DumpStats();
+
+    // Run twice to compare, the first run (or after a driver update) is cold
+    auto endTime = std::chrono::high_resolution_clock::now();
+    m_startupTime = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+    printf("Startup took %.2f ms with a %s pipeline cache\n", m_startupTime, m_pipelineCacheWarm ? "warm" : "cold");
+    for (const StartupPhase& phase : m_startupPhases)
+        printf("  %-16s %8.2f ms\n", phase.name, phase.time);
+    // Alongside the ones above rather than part of the total
+    for (const StartupPhase& phase : m_asyncPhases)
+        printf("  %-16s %8.2f ms (worker threads)\n", phase.name, phase.time);
+}
+// =================================================
+// Name: StartStartupLoads
+// Desc: Starts the startup work that doesn't need a device: the texture files, the models and the SPIR-V
+//       Each runs on its own thread, its results are picked up by whatever needs them first
+// Params: NONE
+// Return: NONE
+void HelloTriangleApplication::StartStartupLoads()
+{
+    // Sized before the thread starts so it never sees the vector move
+    m_textureFiles.assign(TEXTURE_PATHS.size(), TextureFiles{});
+    m_textureRead = std::async(std::launch::async, [this] { return ReadTextureFiles(); });
+
+    // A thread per model, they're parsed and optimised independently
+    for (const std::string& path : MODEL_PATHS)
+        m_meshLoads.push_back(std::async(std::launch::async, [this, path] { return LoadMeshFile(path); }));
+
+    // Only the write times are taken here, the compiling (or cache reads) happen on the thread
+    m_shaderCompiler.Init(SHADER_CACHE_DIRECTORY, SHADER_VARIANTS);
+    m_shaderRead = std::async(std::launch::async, [this] { return ReadShaderFiles(); });
 }
 // =================================================
 // Name: CreateInstance
@@ -209,7 +384,9 @@ void HelloTriangleApplication::PickPhysicalDevice()
     if (candidates.rbegin()->first > 0)
     {
         m_physicalDevice = candidates.rbegin()->second;
-        m_msaaSamples = GetMaxUsableSampleCount();
+        // Start at the best it can do, the adaptive quality brings it down if that's too slow
+        m_maxMsaaSamples = GetMaxUsableSampleCount();
+        m_msaaSamples = m_maxMsaaSamples;
     }
 
     // Check again if we found a device
@@ -238,8 +415,9 @@ int HelloTriangleApplication::RateSuitableDevices(VkPhysicalDevice device)
 
     bool extensionsSupported = CheckDeviceExtensionSupport(device);
 
-    bool swapChainAdequate = false;
-    if (extensionsSupported) {
+    // Headless never makes a swap chain, so it doesn't care what the surface supports
+    bool swapChainAdequate = m_headless;
+    if (extensionsSupported && !m_headless) {
         SwapChainSupportDetails swapChainSupport = QuerySwapChainSupport(device);
         swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.present_modes.empty();
     }
@@ -286,20 +464,29 @@ QueueFamilyIndices HelloTriangleApplication::FindQueueFamilies(VkPhysicalDevice
     int i = 0;
     for (const auto& queueFamily : queueFamilies) {
 
-		VkBool32 presentSupport = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_surface, &presentSupport);
-        if (presentSupport) {
-            indices.present_family = i;
-        }
+        // Keep the first graphics and present families that complete the set
+        if (!indices.IsComplete()) {
+		    VkBool32 presentSupport = false;
+            // Nothing's presented headless, the graphics family stands in so everything keyed on it still works
+            if (m_headless)
+                presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+            else
+                vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_surface, &presentSupport);
+            if (presentSupport) {
+                indices.present_family = i;
+            }
 
-        //TODO: Maybe look into the Transfer queue implementation
-        //https://vulkan-tutorial.com/Vertex_buffers/Staging_buffer
-        if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {   // Also gives VK_QUEUE_TRANSFER_BIT for staging buffer
-            indices.graphics_family = i;
+            if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {   // Also gives VK_QUEUE_TRANSFER_BIT for staging buffer
+                indices.graphics_family = i;
+            }
         }
 
-        if (indices.IsComplete()) {
-            break;
+        // But carry on looking for a family that can transfer and not draw, that's the GPU's copy engine
+        // Prefer one with no compute either as that's the most dedicated one
+        if ((queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+            if (!indices.transfer_family.has_value() || !(queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
+                indices.transfer_family = i;
+            }
         }
 
         i++;
@@ -320,6 +507,8 @@ bool HelloTriangleApplication::CheckDeviceExtensionSupport(VkPhysicalDevice devi
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
     std::set<std::string> requiredExtensions(m_deviceExtensions.begin(), m_deviceExtensions.end());
+    if (m_headless)
+        requiredExtensions.erase(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 
     for (const auto& extension : availableExtensions) {
         requiredExtensions.erase(extension.extensionName);
@@ -328,18 +517,131 @@ bool HelloTriangleApplication::CheckDeviceExtensionSupport(VkPhysicalDevice devi
     return requiredExtensions.empty();
 }
 // =================================================
+// Name: IsDeviceExtensionAvailable
+// Desc: Check for a single optional extension, one we can do without
+// Params: device, extensionName
+// Return: bool
+bool HelloTriangleApplication::IsDeviceExtensionAvailable(VkPhysicalDevice device, const char* extensionName)
+{
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+    for (const auto& extension : availableExtensions) {
+        if (strcmp(extension.extensionName, extensionName) == 0)
+            return true;
+    }
+
+    return false;
+}
+// =================================================
+// Name: IsInstanceExtensionAvailable
+// Desc: The same for an optional instance extension
+// Params: extensionName
+// Return: bool
+bool HelloTriangleApplication::IsInstanceExtensionAvailable(const char* extensionName)
+{
+    uint32_t extensionCount;
+    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+
+    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, availableExtensions.data());
+
+    for (const auto& extension : availableExtensions) {
+        if (strcmp(extension.extensionName, extensionName) == 0)
+            return true;
+    }
+
+    return false;
+}
+// =================================================
+// Name: CheckDescriptorIndexing
+// Desc: Works out if the texture table can be bindless and how big it can be. If so the extensions it needs are added
+//       and features is filled in with the ones to turn on, ready to be chained onto the device's create info
+// Params: extensions, features
+// Return: NONE
+void HelloTriangleApplication::CheckDescriptorIndexing(std::vector<const char*>& extensions, VkPhysicalDeviceDescriptorIndexingFeaturesEXT& features)
+{
+    features = {};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+    // Both come from extensions we might not have, so they're looked up rather than linked
+    auto getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(m_instance, "vkGetPhysicalDeviceFeatures2KHR");
+    auto getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(m_instance, "vkGetPhysicalDeviceProperties2KHR");
+    m_bindlessTextures = m_bindlessTextures && getFeatures2 != nullptr && getProperties2 != nullptr &&
+        IsInstanceExtensionAvailable(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) &&
+        IsDeviceExtensionAvailable(m_physicalDevice, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) &&
+        IsDeviceExtensionAvailable(m_physicalDevice, VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+
+    if (m_bindlessTextures) {
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT supported{};
+        supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+        VkPhysicalDeviceFeatures2KHR features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+        features2.pNext = &supported;
+        getFeatures2(m_physicalDevice, &features2);
+
+        // An instance can pick any slot, so the index isn't uniform across a draw
+        m_bindlessTextures = supported.shaderSampledImageArrayNonUniformIndexing && supported.runtimeDescriptorArray &&
+            supported.descriptorBindingPartiallyBound && supported.descriptorBindingSampledImageUpdateAfterBind;
+    }
+
+    if (m_bindlessTextures) {
+        VkPhysicalDeviceDescriptorIndexingPropertiesEXT limits{};
+        limits.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+        VkPhysicalDeviceProperties2KHR properties2{};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+        properties2.pNext = &limits;
+        getProperties2(m_physicalDevice, &properties2);
+
+        // A combined image sampler counts as both an image and a sampler
+        m_textureSlots = std::min({ MAX_BINDLESS_TEXTURES, limits.maxDescriptorSetUpdateAfterBindSampledImages,
+            limits.maxDescriptorSetUpdateAfterBindSamplers, limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+            limits.maxPerStageDescriptorUpdateAfterBindSamplers });
+
+        features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+        features.runtimeDescriptorArray = VK_TRUE;
+        features.descriptorBindingPartiallyBound = VK_TRUE;
+        features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+
+        extensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);     // Descriptor indexing depends on it
+        extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+    }
+    else {
+        m_textureSlots = 1;
+    }
+
+    printf("Textures: %s, %u slots\n", m_bindlessTextures ? "bindless table" : "single sampler", m_textureSlots);
+}
+// =================================================
 // Name: CreateSwapChain
 // Desc: Makes the swap chain calling the other methods to format it
 // Params: NONE
 // Return: NONE
 void HelloTriangleApplication::CreateSwapChain() {
+    if (m_headless) {
+        CreateOffscreenTargets();
+        return;
+    }
+
     SwapChainSupportDetails swapChainSupport = QuerySwapChainSupport(m_physicalDevice);
 
     VkSurfaceFormatKHR surfaceFormat = ChooseSwapSurfaceFormat(swapChainSupport.formats);
     VkPresentModeKHR presentMode = ChooseSwapPresentMode(swapChainSupport.present_modes);
     VkExtent2D extent = ChooseSwapExtent(swapChainSupport.capabilities);
 
+    // One more than the minimum so we're not left waiting on the driver, or the bare minimum for low latency so nothing queues up
+    // Throughput wants one for every frame in flight plus the one on screen
     uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+    if (m_latencyMode == LatencyMode::LowLatency)
+        imageCount = std::max(swapChainSupport.capabilities.minImageCount, 2u);
+    else if (m_latencyMode == LatencyMode::Throughput)
+        imageCount = std::max(imageCount, m_framesInFlight + 1);
+    // 0 means there's no maximum
+    if (swapChainSupport.capabilities.maxImageCount > 0)
+        imageCount = std::min(imageCount, swapChainSupport.capabilities.maxImageCount);
 
     // As is tradition with Vulkan objects, creating the swap chain object requires filling in a large structure
     VkSwapchainCreateInfoKHR createInfo{};
@@ -350,7 +652,12 @@ void HelloTriangleApplication::CreateSwapChain() {
     createInfo.imageColorSpace = surfaceFormat.colorSpace;
     createInfo.imageExtent = extent;
     createInfo.imageArrayLayers = 1;
-    createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    // A blit destination too when the scene can be drawn smaller and scaled up into it
+    m_resolutionScaling = m_resolutionScaling && (swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT) &&
+        SupportsUpscale(surfaceFormat.format);
+    if (!m_resolutionScaling)
+        m_renderScale = 1.0f;
+    createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | (m_resolutionScaling ? VK_IMAGE_USAGE_TRANSFER_DST_BIT : 0);
     createInfo.oldSwapchain = m_oldSwapChain;                       // The last swapchain (if there is one)
 
     // Next, we need to specify how to handle swap chain images that will be used across multiple queue families
@@ -372,7 +679,6 @@ void HelloTriangleApplication::CreateSwapChain() {
     createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     createInfo.presentMode = presentMode;
     createInfo.clipped = VK_TRUE;
-    createInfo.oldSwapchain = VK_NULL_HANDLE;
 
     assert(vkCreateSwapchainKHR(m_device, &createInfo, nullptr, &m_swapChain) == VK_SUCCESS);
 
@@ -380,6 +686,9 @@ void HelloTriangleApplication::CreateSwapChain() {
     vkGetSwapchainImagesKHR(m_device, m_swapChain, &imageCount, nullptr);
     m_swapChainImages.resize(imageCount);
     vkGetSwapchainImagesKHR(m_device, m_swapChain, &imageCount, m_swapChainImages.data());
+
+    // IMMEDIATE 0, MAILBOX 1, FIFO 2
+    printf("Swap chain: %u images, present mode %d, %u frames in flight\n", imageCount, static_cast<int>(presentMode), m_framesInFlight);
     m_swapChainImageFormat = surfaceFormat.format;
 	m_swapChainExtent = extent;
 
@@ -391,6 +700,35 @@ void HelloTriangleApplication::CreateSwapChain() {
         m_swapChainImageViews[i] = CreateImageViews(m_swapChainImages[i], m_swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
 }
 // =================================================
+// Name: CreateOffscreenTargets
+// Desc: The headless stand in for the swap chain, an image per frame in flight the render pass resolves into
+//       Each frame's fence covers its image so there's nothing to acquire
+// Params: NONE
+// Return: NONE
+void HelloTriangleApplication::CreateOffscreenTargets()
+{
+    // What ChooseSwapSurfaceFormat picks on most desktops, so the passes and pipelines match a windowed run
+    m_swapChainImageFormat = VK_FORMAT_B8G8R8A8_SRGB;
+    m_swapChainExtent = { WIDTH, HIGHT };
+    m_resolutionScaling = m_resolutionScaling && SupportsUpscale(m_swapChainImageFormat);
+    if (!m_resolutionScaling)
+        m_renderScale = 1.0f;
+
+    m_swapChainImages.resize(m_framesInFlight);
+    m_offscreenMemory.resize(m_framesInFlight);
+    m_swapChainImageViews.resize(m_framesInFlight);
+    for (uint32_t i = 0; i < m_framesInFlight; i++) {
+        // Transfer source too, so a frame could be read back to check the output, and a blit destination like the swap chain's
+        CreateImageBuffer(WIDTH, HIGHT, m_swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            m_swapChainImages[i], m_offscreenMemory[i], 1, VK_SAMPLE_COUNT_1_BIT, MemoryCategory::RenderTarget);
+        m_swapChainImageViews[i] = CreateImageViews(m_swapChainImages[i], m_swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+    }
+
+    printf("Headless: %u offscreen %ux%u images, %u frames in flight\n", m_framesInFlight, WIDTH, HIGHT, m_framesInFlight);
+}
+// =================================================
 
 void HelloTriangleApplication::RecreateSwapChain()
 {
@@ -402,19 +740,40 @@ void HelloTriangleApplication::RecreateSwapChain()
 
     vkDeviceWaitIdle(m_device);     // Wait until the resources are free to use
 
-    m_oldSwapChain = m_swapChain;   // Set the current chain to the old one so we can keep rendering using it
+    // Everything size dependent is destroyed and made again, so there should be as many render targets after as before
+    const MemoryUsage targetsBefore = m_allocator.GetCategoryUsage(MemoryCategory::RenderTarget);
+
+    m_oldSwapChain = m_swapChain;   // Kept alive and handed to the new one as its oldSwapchain, so the driver can reuse its resources
+    const VkFormat oldFormat = m_swapChainImageFormat;
 
-    CleanUpSwapChain();             // Cleanup the current one
+    CleanUpSwapChain();             // Cleanup everything that depends on the size
 
     // Call associated swap chain functions to remake it
     CreateSwapChain();                      // Swap chain itself and image views based on swap chain images
-    CreateRenderPass();                     // Depends of the format of the swap chain (rare to change)
-    CreateGraphicsPipeline();               // Viewport and scissors need to be remade (could be avoided with dynamic states)
+
+    // The old chain is retired now, nothing can be acquired from it any more
+    vkDestroySwapchainKHR(m_device, m_oldSwapChain, nullptr);
+    m_oldSwapChain = VK_NULL_HANDLE;
+
+    // The viewport and scissor are dynamic so the pipeline survives a resize
+    // Only a new surface format (rare) means every render pass and pipeline made so far has to go too
+    if (m_swapChainImageFormat != oldFormat)
+        DestroyPassVariants();
+    UsePassVariant();                       // Resolution scaling might have been turned off by the new chain
+
     CreateRenderTargets();
     CreateDepthResources();
     CreateFrameBuffers();                   // Directly depend on the swap chain
 
-    m_oldSwapChain = nullptr;
+    // More means something in CleanUpSwapChain was missed (turning resolution scaling off can only mean fewer)
+    const MemoryUsage targetsAfter = m_allocator.GetCategoryUsage(MemoryCategory::RenderTarget);
+    if (targetsAfter.allocations > targetsBefore.allocations) {
+        printf("Memory: %u render target allocations (%.2f MB) before recreating the swap chain and %u (%.2f MB) after, one's leaking\n",
+            targetsBefore.allocations, targetsBefore.used / (1024.0 * 1024.0), targetsAfter.allocations, targetsAfter.used / (1024.0 * 1024.0));
+    }
+
+    // The static mode secondaries have the old size (and maybe render pass) baked in
+    MarkSceneDirty();
 }
 // =================================================
 // Name: CreateFrameBuffers
@@ -428,19 +787,21 @@ void HelloTriangleApplication::CreateFrameBuffers()
 
     // Iterate through the image views and create framebuffers from them
     for (size_t i = 0; i < m_swapChainImageViews.size(); i++) {
-        std::vector<VkImageView>  attachments = {
-            m_renderTargetView,
-            m_depthView,
-            m_swapChainImageViews[i]
-        };
+        // Where the frame ends up, the scene image is blitted into the swap chain image afterwards
+        const VkImageView target = IsUpscaling() ? m_sceneView : m_swapChainImageViews[i];
+
+        // Matching CreateRenderPass, at 1x there's no resolve and the target is drawn into directly
+        std::vector<VkImageView> attachments = { target, m_depthView };
+        if (m_msaaSamples != VK_SAMPLE_COUNT_1_BIT)
+            attachments = { m_renderTargetView, m_depthView, target };
 
         VkFramebufferCreateInfo frameBufferInfo{};
         frameBufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
         frameBufferInfo.renderPass = m_renderPass;
         frameBufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
         frameBufferInfo.pAttachments = attachments.data();
-        frameBufferInfo.width = m_swapChainExtent.width;
-        frameBufferInfo.height = m_swapChainExtent.height;
+        frameBufferInfo.width = m_renderExtent.width;
+        frameBufferInfo.height = m_renderExtent.height;
         frameBufferInfo.layers = 1;
 
         assert(vkCreateFramebuffer(m_device, &frameBufferInfo, nullptr, &m_swapChainFramebuffers[i]) == VK_SUCCESS);
@@ -504,8 +865,12 @@ void HelloTriangleApplication::CreateDepthResources()
     VkFormat depthFormat = FindSupportedFormat({ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT },
         VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
 
-    CreateImageBuffer(m_swapChainExtent.width, m_swapChainExtent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_depthImage, m_depthMemory, 1, m_msaaSamples);
+    // Only ever used inside the render pass (cleared on load, discarded on store), so it's transient like the colour target
+    CreateImageBuffer(m_renderExtent.width, m_renderExtent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_depthImage, m_depthMemory, 1, m_msaaSamples, MemoryCategory::RenderTarget);
+    printf("Depth target: %ux, %.2f MB %s\n", static_cast<uint32_t>(m_msaaSamples), m_depthMemory.size / (1024.0 * 1024.0),
+        (m_allocator.GetMemoryTypeFlags(m_depthMemory.memoryType) & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) ? "lazily allocated" : "device local");
 
     m_depthView = CreateImageViews(m_depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1); // Doesn't need a specific format, just enough accuracy
 
@@ -519,7 +884,9 @@ void HelloTriangleApplication::CreateDepthResources()
 // Return: NONE
 void HelloTriangleApplication::GenerateMipmaps(VkImage image, int32_t texWidth, int32_t texHeight, uint8_t mipLevels)
 {
-    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+    // Recorded into the upload batch after the copy, so it runs once that's done without a wait in between
+    // Blits need a graphics capable queue, so this goes on the graphics side of the batch
+    VkCommandBuffer commandBuffer = m_uploads.GetGraphicsCommandBuffer();
 
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -558,7 +925,6 @@ void HelloTriangleApplication::GenerateMipmaps(VkImage image, int32_t texWidth,
         blit.dstSubresource.baseArrayLayer = 0;
         blit.dstSubresource.layerCount = 1;
 
-        // TODO: If using dedicated transfer queue, blit requires a queue with graphics capability
         vkCmdBlitImage(commandBuffer,
             image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, // Image is the source
             image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, // and the dst
@@ -593,60 +959,505 @@ void HelloTriangleApplication::GenerateMipmaps(VkImage image, int32_t texWidth,
     vkCmdPipelineBarrier(commandBuffer,
         VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
         0, nullptr, 0, nullptr, 1, &barrier);
+}
+// =================================================
+// Name: DecodeTexture
+// Desc: Decodes a PNG (or anything else stb reads) to RGBA, building the rest of its mip chain on the CPU if asked
+// Params: path, buildMips, file
+// Return: bool - false if stb couldn't read it
+static bool DecodeTexture(const std::string& path, bool buildMips, TextureFile& file)
+{
+    // stb is always asked for RGBA whatever the file holds, 4 bytes per pixel
+    int texWidth, texHeight, texChannels;
+    stbi_uc* pixels = stbi_load(path.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+    if (!pixels)
+        return false;
 
-    EndSingleTimeCommands(commandBuffer);
+    const size_t size = static_cast<size_t>(texWidth) * texHeight * 4;
+    file.format = VK_FORMAT_R8G8B8A8_SRGB;
+    file.width = texWidth;
+    file.height = texHeight;
+    file.data.assign(reinterpret_cast<const char*>(pixels), reinterpret_cast<const char*>(pixels) + size);
+
+    // Free the pixel array made by stb
+    stbi_image_free(pixels);
+
+    if (buildMips)
+        BuildMipChain(file);
+    return true;
 }
 // =================================================
-// Name: CreateTextureImage
-// Desc: Load a image file for a texture
+// Name: ReadTextureFiles
+// Desc: Runs before there's a device. Reads every pre-compressed copy of each texture, or decodes the PNG if there
+//       aren't any (building its mips too when streaming), on a pool of worker threads
+// Params: NONE
+// Return: double - how long it took (ms)
+double HelloTriangleApplication::ReadTextureFiles()
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+    if (TEXTURE_PATHS.empty())
+        return 0.0;
+
+    // One thread per core, but there's no point having more than there are textures
+    const uint32_t threadCount = std::min(static_cast<uint32_t>(TEXTURE_PATHS.size()), std::max(1u, std::thread::hardware_concurrency()));
+    WorkerThreads readers;
+    readers.Start(threadCount);
+
+    // Each thread takes the next texture until they're gone, so one big image doesn't hold the others up
+    // Every texture has its own entry in m_textureFiles, so the threads never write to the same one
+    std::atomic<size_t> nextTexture{ 0 };
+    readers.Run([&](uint32_t) {
+        for (size_t i = nextTexture++; i < TEXTURE_PATHS.size(); i = nextTexture++) {
+            TextureFiles& files = m_textureFiles[i];
+
+            const std::string basePath = TEXTURE_PATHS[i].substr(0, TEXTURE_PATHS[i].find_last_of('.'));
+            for (const std::string& suffix : COMPRESSED_TEXTURE_SUFFIXES) {
+                TextureFile file;
+                if (LoadTextureFile(basePath + suffix, file)) {
+                    files.compressedPaths.push_back(basePath + suffix);
+                    files.compressed.push_back(std::move(file));
+                }
+            }
+
+            // A device that can't sample any of the copies is rare enough to leave its decode until that's known
+            if (files.compressed.empty())
+                files.isDecoded = DecodeTexture(TEXTURE_PATHS[i], m_textureStreaming, files.decoded);
+        }
+    });
+    readers.Stop();
+
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+}
+// =================================================
+// Name: CreateTextureImages
+// Desc: Makes every texture in TEXTURE_PATHS from what ReadTextureFiles left. Pre-compressed copies are uploaded as
+//       they are, the decoded PNGs get their copies and blits recorded into the upload batch
+//       Streamed textures keep every level on the CPU and upload just the small ones
 // Params: NONE
 // Return: NONE
-void HelloTriangleApplication::CreateTextureImage()
+void HelloTriangleApplication::CreateTextureImages()
 {
-    // Use the STB library to load our image
-    int texWidth, texHeight, texChannels;
-    stbi_uc* pixels = stbi_load(TEXTURE_PATH.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    // max (largest dimension)  log2 (how many times can be divided by 2)  floor (for times when it's not divisible by 2)
-    m_mipLevels = static_cast<uint8_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1; // +1 for original image level
-    assert(pixels);
+    auto startTime = std::chrono::high_resolution_clock::now();
 
-    // Define the size of the image in memory
-    VkDeviceSize imgSize = texWidth * texHeight * 4; // 4 bytes per pixel
+    // Usually finished long before now, it's been running since the start of InitVulkan
+    m_asyncPhases.push_back({ "texture reads", m_textureRead.get() });
 
-    // The usual staging buffer setup
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingMemory;
+    m_textures.resize(TEXTURE_PATHS.size());
 
-    CreateBuffer(imgSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        stagingBuffer, stagingMemory);
+    size_t decodedCount = 0;
+    size_t lateDecodes = 0;
+    for (size_t i = 0; i < TEXTURE_PATHS.size(); ++i) {
+        TextureFiles& files = m_textureFiles[i];
+        Texture& texture = m_textures[i];
 
-    void* data;
-    vkMapMemory(m_device, stagingMemory, 0, imgSize, 0, &data);
-    memcpy(data, pixels, imgSize);
-    vkUnmapMemory(m_device, stagingMemory);
+        // A pre-compressed copy skips the decode and the blits altogether
+        if (CreateCompressedTextureImage(files, texture))
+            continue;
 
-    // Free the pixel array made by stb
-    stbi_image_free(pixels);
+        // There were copies but the device can't sample any of them, so the PNG is decoded after all
+        if (!files.isDecoded) {
+            files.isDecoded = DecodeTexture(TEXTURE_PATHS[i], m_textureStreaming, files.decoded);
+            ++lateDecodes;
+        }
+        assert(files.isDecoded);
+        ++decodedCount;
+
+        if (m_textureStreaming) {
+            // Its mips were built on the worker, all of them stay on the CPU
+            texture.source = std::move(files.decoded);
+            texture.streamed = true;
+            texture.format = texture.source.format;
+            texture.residentMip = GetStreamingMip(texture.source, static_cast<float>(STREAMING_START_SIZE));
+            texture.wantedMip = texture.residentMip;
+            texture.mipLevels = static_cast<uint8_t>(texture.source.mips.size() - texture.residentMip);
+            texture.residentSize = CreateTextureLevels(texture.source, texture.residentMip, texture.image, texture.memory, texture.view);
+        }
+        else {
+            // Staged here, the upload context can't be used from the workers (and didn't exist yet when they ran)
+            const TextureFile& decoded = files.decoded;
+            const StagingSlice staging = m_uploads.Stage(decoded.data.data(), decoded.data.size());
+            CreateTextureImage(texture, staging, static_cast<int32_t>(decoded.width), static_cast<int32_t>(decoded.height));
+        }
+    }
+
+    // Everything that's still wanted on the CPU was moved into its texture
+    m_textureFiles.clear();
+
+    float totalTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+    printf("Textures: %zu made in %.2fms, %zu from decoded images (%zu decoded late, the rest on worker threads)\n",
+        m_textures.size(), totalTime, decodedCount, lateDecodes);
+}
+// =================================================
+// Name: CreateTextureImage
+// Desc: Records the upload of a decoded RGBA image that's already in staging, then its mip chain
+// Params: texture, staging, texWidth, texHeight
+// Return: NONE
+void HelloTriangleApplication::CreateTextureImage(Texture& texture, const StagingSlice& staging, int32_t texWidth, int32_t texHeight)
+{
+    texture.format = VK_FORMAT_R8G8B8A8_SRGB;
+    // max (largest dimension)  log2 (how many times can be divided by 2)  floor (for times when it's not divisible by 2)
+    texture.mipLevels = static_cast<uint8_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1; // +1 for original image level
 
     // Create an image buffer
-    CreateImageBuffer(texWidth, texHeight, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, 
+    CreateImageBuffer(texWidth, texHeight, texture.format, VK_IMAGE_TILING_OPTIMAL, 
         VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_textImage, m_textMemory, m_mipLevels, VK_SAMPLE_COUNT_1_BIT);
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, texture.image, texture.memory, texture.mipLevels, VK_SAMPLE_COUNT_1_BIT, MemoryCategory::Texture);
 
     // Transfer it to the right layout
-    TransitionImageLayout(m_textImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, m_mipLevels);
+    TransitionImageLayout(texture.image, texture.format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, texture.mipLevels);
 
     // Copy the staging buffer to texture image buffer
-    CopyBuffer2Image(stagingBuffer, m_textImage, texWidth, texHeight);
+    CopyBuffer2Image(staging, texture.image, texWidth, texHeight);
 
-    // Generate smaller images for lower LOD
-    GenerateMipmaps(m_textImage, texWidth, texHeight, m_mipLevels);
-    // Convert back to a format that the shader can access
-    
-    //TransitionImageLayout(m_textImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, m_mipLevels);
+    // Hand the image over to the graphics queue for the blits, it stays in the transfer dst layout
+    VkImageSubresourceRange allMips{};
+    allMips.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    allMips.baseMipLevel = 0;
+    allMips.levelCount = texture.mipLevels;
+    allMips.baseArrayLayer = 0;
+    allMips.layerCount = 1;
+    m_uploads.TransferImageOwnership(texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, allMips,
+        VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    // Generate smaller images for lower LOD, which also leaves it ready for the shader
+    GenerateMipmaps(texture.image, texWidth, texHeight, texture.mipLevels);
+
+    texture.view = CreateImageViews(texture.image, texture.format, VK_IMAGE_ASPECT_COLOR_BIT, texture.mipLevels);
+
+    // Nothing has actually run yet, it all goes with the rest of the upload batch
+}
+// =================================================
+// Name: CreateCompressedTextureImage
+// Desc: Picks the first of the texture's pre-compressed copies the device can sample, uploading it and all its mips in
+//       one copy (or just the small ones when streaming, the file's kept so the rest can follow)
+// Params: files, texture
+// Return: bool - false if there wasn't one, the PNG gets used instead
+bool HelloTriangleApplication::CreateCompressedTextureImage(TextureFiles& files, Texture& texture)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    size_t chosen = files.compressed.size();
+    for (size_t i = 0; i < files.compressed.size(); ++i) {
+        // The format is only reported as sampleable if its compression feature is there (and we enabled it)
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(m_physicalDevice, files.compressed[i].format, &properties);
+        if ((properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) && files.compressed[i].mips.size() <= UINT8_MAX) {
+            chosen = i;
+            break;
+        }
+    }
+    if (chosen == files.compressed.size())
+        return false;
+
+    TextureFile& file = files.compressed[chosen];
+    const std::string& path = files.compressedPaths[chosen];
+
+    texture.format = file.format;
+    texture.streamed = m_textureStreaming;
+    texture.residentMip = m_textureStreaming ? GetStreamingMip(file, static_cast<float>(STREAMING_START_SIZE)) : 0;
+    texture.wantedMip = texture.residentMip;
+    texture.mipLevels = static_cast<uint8_t>(file.mips.size() - texture.residentMip);
+    texture.residentSize = CreateTextureLevels(file, texture.residentMip, texture.image, texture.memory, texture.view);
+
+    float loadTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+    printf("Texture %s uploaded in %.2fms (%ux%u, %u of %zu mips, %.2f MB)\n", path.c_str(), loadTime, file.width, file.height,
+        static_cast<uint32_t>(texture.mipLevels), file.mips.size(), static_cast<double>(texture.residentSize) / (1024.0 * 1024.0));
+
+    if (texture.streamed)
+        texture.source = std::move(file);
+    return true;
+}
+// =================================================
+// Name: CreateTextureLevels
+// Desc: Makes an image holding firstMip and every level after it from a file's data, all uploaded in a single copy
+//       Used for pre-compressed files and streamed textures, anything that already has its levels on the CPU
+// Params: file, firstMip, image, memory, view
+// Return: VkDeviceSize - the bytes uploaded
+VkDeviceSize HelloTriangleApplication::CreateTextureLevels(const TextureFile& file, uint8_t firstMip, VkImage& image,
+    MemoryAllocation& memory, VkImageView& view)
+{
+    const uint8_t mipLevels = static_cast<uint8_t>(file.mips.size() - firstMip);
+
+    // The levels can be stored in either order (KTX2 is smallest first), but they're always next to each other
+    VkDeviceSize start = file.data.size();
+    VkDeviceSize end = 0;
+    for (size_t i = firstMip; i < file.mips.size(); ++i) {
+        start = std::min(start, file.mips[i].offset);
+        end = std::max(end, file.mips[i].offset + file.mips[i].size);
+    }
+
+    // Every level in one go, block offsets only need to be a multiple of the block size (16 covers them all)
+    const StagingSlice staging = m_uploads.Stage(file.data.data() + start, end - start);
+
+    // No blits, so it doesn't need to be a transfer source
+    const TextureMip& top = file.mips[firstMip];
+    CreateImageBuffer(top.width, top.height, file.format, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, memory, mipLevels, VK_SAMPLE_COUNT_1_BIT, MemoryCategory::Texture);
+
+    TransitionImageLayout(image, file.format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
+
+    // One region per level, all in a single copy command. The image's level 0 is the file's firstMip
+    std::vector<VkBufferImageCopy> regions(mipLevels);
+    for (size_t i = 0; i < regions.size(); ++i) {
+        const TextureMip& mip = file.mips[firstMip + i];
+        regions[i] = {};
+        regions[i].bufferOffset = staging.offset + mip.offset - start;
+        regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        regions[i].imageSubresource.mipLevel = static_cast<uint32_t>(i);
+        regions[i].imageSubresource.baseArrayLayer = 0;
+        regions[i].imageSubresource.layerCount = 1;
+        regions[i].imageOffset = { 0, 0, 0 };
+        regions[i].imageExtent = { mip.width, mip.height, 1 };
+    }
+    vkCmdCopyBufferToImage(m_uploads.GetCommandBuffer(), staging.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        static_cast<uint32_t>(regions.size()), regions.data());
+
+    // Straight to shader reading, handed to the graphics queue on the way if the copy ran on the transfer queue
+    VkImageSubresourceRange allMips{};
+    allMips.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    allMips.baseMipLevel = 0;
+    allMips.levelCount = mipLevels;
+    allMips.baseArrayLayer = 0;
+    allMips.layerCount = 1;
+    m_uploads.TransferImageOwnership(image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, allMips,
+        VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+    view = CreateImageViews(image, file.format, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+
+    return end - start;
+}
+// =================================================
+// Name: GetStreamingMip
+// Desc: The smallest level that's still at least screenSize pixels across, any bigger and the extra texels are wasted
+// Params: file, screenSize
+// Return: uint8_t
+uint8_t HelloTriangleApplication::GetStreamingMip(const TextureFile& file, float screenSize) const
+{
+    for (size_t i = file.mips.size(); i > 0; --i) {
+        const TextureMip& mip = file.mips[i - 1];
+        if (static_cast<float>(std::max(mip.width, mip.height)) >= screenSize)
+            return static_cast<uint8_t>(i - 1);
+    }
+    return 0;
+}
+// =================================================
+// Name: UpdateTextureStreaming
+// Desc: Swaps in any finished uploads, works out the level each streamed texture wants from how big the scene gets on
+//       screen, squeezes that into the budget, and starts the next upload. Only safe once the frame's fence has been waited on
+// Params: frame, view, proj
+// Return: NONE
+void HelloTriangleApplication::UpdateTextureStreaming(uint32_t frame, const glm::mat4& view, const glm::mat4& proj)
+{
+    // Old images go once every frame that could have drawn with them has finished
+    for (size_t i = 0; i < m_retiredTextures.size();) {
+        if (m_frameNumber < m_retiredTextures[i].freeFrame) {
+            ++i;
+            continue;
+        }
+        vkDestroyImageView(m_device, m_retiredTextures[i].view, nullptr);
+        vkDestroyImage(m_device, m_retiredTextures[i].image, nullptr);
+        m_allocator.Free(m_retiredTextures[i].memory);
+        m_retiredTextures.erase(m_retiredTextures.begin() + i);
+    }
+
+    // Uploads that have landed replace the texture's image. The sets still using the old one are rewritten on their
+    // next turn, so it has to live until the frames in flight now (and the ones recorded before the rewrites) are done
+    for (Texture& texture : m_textures) {
+        if (texture.pendingUpload == 0 || !m_uploads.IsFinished(texture.pendingUpload))
+            continue;
+
+        RetiredTexture retired;
+        retired.image = texture.image;
+        retired.memory = texture.memory;
+        retired.view = texture.view;
+        retired.size = texture.residentSize;
+        retired.freeFrame = m_frameNumber + m_framesInFlight;
+        m_retiredTextures.push_back(retired);
+
+        texture.image = texture.pendingImage;
+        texture.memory = texture.pendingMemory;
+        texture.view = texture.pendingView;
+        texture.residentMip = texture.pendingMip;
+        texture.residentSize = texture.pendingSize;
+        texture.mipLevels = static_cast<uint8_t>(texture.source.mips.size() - texture.residentMip);
+        texture.pendingImage = VK_NULL_HANDLE;
+        texture.pendingView = VK_NULL_HANDLE;
+        texture.pendingUpload = 0;
+    }
+
+    // This frame's table isn't in use any more, point it at the current images
+    UpdateTextureTable(frame);
+
+    if (!m_textureStreaming)
+        return;
+
+    // A texture is mapped across the whole mesh, so the biggest any object using it gets on screen (the bounding sphere's
+    // projected diameter) is how many texels across are worth having
+    const float pixelScale = std::abs(proj[1][1]) * static_cast<float>(m_renderExtent.height);
+    std::vector<float> screenSizes(m_textures.size(), 0.0f);
+    auto addToScreen = [&](const glm::mat4& model, uint32_t mesh, uint32_t texture) {
+        const glm::vec4& sphere = m_meshes[mesh].sphere;
+        const glm::vec3 centre = glm::vec3(view * model * glm::vec4(glm::vec3(sphere), 1.0f));
+        const float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+        const float radius = sphere.w * scale;
+
+        // The camera looks down -z, anything entirely behind it can't be seen
+        const float distance = -centre.z;
+        if (distance < -radius)
+            return;
+        // Up close (or inside it) it's treated as being at the near plane
+        float& screenSize = screenSizes[texture];
+        screenSize = std::max(screenSize, radius * pixelScale / std::max(distance - radius, 0.1f));
+    };
+    for (const RenderObject& object : m_renderObjects) {
+        const glm::mat4& model = m_sceneGraph.GetWorld(object.node);
+        addToScreen(m_compactVertices ? model * GetDequantisation(object.mesh) : model, object.mesh, object.texture);
+    }
+    for (const InstanceBatch& batch : m_instanceBatches) {
+        // Already has the dequantisation folded in
+        for (uint32_t i = 0; i < batch.instanceCount; ++i) {
+            const InstanceData& instance = m_instances[batch.firstInstance + i];
+            addToScreen(instance.model, batch.mesh, instance.texture);
+        }
+    }
+
+    auto levelsSize = [](const Texture& texture, uint8_t firstMip) {
+        VkDeviceSize size = 0;
+        for (size_t i = firstMip; i < texture.source.mips.size(); ++i)
+            size += texture.source.mips[i].size;
+        return size;
+    };
+
+    VkDeviceSize wantedTotal = 0;
+    for (Texture& texture : m_textures) {
+        if (!texture.streamed) {
+            wantedTotal += texture.residentSize;
+            continue;
+        }
+        texture.wantedMip = GetStreamingMip(texture.source, screenSizes[&texture - m_textures.data()]);
+        wantedTotal += levelsSize(texture, texture.wantedMip);
+    }
+
+    // Over budget, take a level off whichever texture is wanting the most memory until it fits
+    // (or everything's down to its last level)
+    while (wantedTotal > m_textureBudget) {
+        Texture* biggest = nullptr;
+        VkDeviceSize biggestSize = 0;
+        for (Texture& texture : m_textures) {
+            if (!texture.streamed || texture.wantedMip + 1u >= texture.source.mips.size())
+                continue;
+            const VkDeviceSize size = levelsSize(texture, texture.wantedMip);
+            if (size > biggestSize) {
+                biggest = &texture;
+                biggestSize = size;
+            }
+        }
+        if (!biggest)
+            break;
+
+        wantedTotal -= biggestSize - levelsSize(*biggest, biggest->wantedMip + 1);
+        ++biggest->wantedMip;
+    }
+
+    // One upload started a frame so a big change doesn't hitch. Shrinking goes first, it makes room for the rest
+    Texture* next = nullptr;
+    for (Texture& texture : m_textures) {
+        if (!texture.streamed || texture.pendingUpload != 0 || texture.wantedMip == texture.residentMip)
+            continue;
+        if (!next || texture.wantedMip > texture.residentMip)
+            next = &texture;
+        if (texture.wantedMip > texture.residentMip)
+            break;
+    }
+    if (!next)
+        return;
+
+    // Until a swap is done the old image and the new one are both on the GPU, and the old one stays until its free frame
+    // So what's there right now is the resident levels plus every upload in flight and every image waiting to go
+    VkDeviceSize currentTotal = 0;
+    VkDeviceSize inFlight = 0;
+    for (const Texture& texture : m_textures) {
+        currentTotal += texture.residentSize;
+        if (texture.pendingUpload != 0)
+            inFlight += texture.pendingSize;
+    }
+    for (const RetiredTexture& retired : m_retiredTextures)
+        inFlight += retired.size;
+    currentTotal += inFlight;
+
+    // Left for a later frame if the new levels don't fit on top of that. A shrink is let through once nothing else is in
+    // flight though, it's the only way back under the budget and only goes over for as long as its own swap takes
+    const bool shrinking = next->wantedMip > next->residentMip;
+    if (currentTotal + levelsSize(*next, next->wantedMip) > m_textureBudget && !(shrinking && inFlight == 0))
+        return;
+
+    StreamTexture(*next, next->wantedMip);
+}
+// =================================================
+// Name: UpdateTextureTable
+// Desc: Writes every slot of the frame's texture table whose texture has a different image to last time, which covers
+//       new textures as well as streamed ones. Only safe once the frame's fence has been waited on
+// Params: frame
+// Return: NONE
+void HelloTriangleApplication::UpdateTextureTable(uint32_t frame)
+{
+    std::vector<VkImageView>& bound = m_boundTextureViews[frame];
+    const size_t slotCount = std::min(m_textures.size(), static_cast<size_t>(m_textureSlots));
+
+    // Reserved up front, the writes point into it
+    std::vector<VkDescriptorImageInfo> imageInfos;
+    std::vector<VkWriteDescriptorSet> writes;
+    imageInfos.reserve(slotCount);
+    writes.reserve(slotCount);
+
+    for (size_t slot = 0; slot < slotCount; ++slot) {
+        if (bound[slot] == m_textures[slot].view)
+            continue;
+        bound[slot] = m_textures[slot].view;
+
+        VkDescriptorImageInfo imageInfo;
+        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        imageInfo.imageView = m_textures[slot].view;
+        imageInfo.sampler = m_textureSampler;
+        imageInfos.push_back(imageInfo);
+
+        VkWriteDescriptorSet write{};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = m_textureSets[frame];
+        write.dstBinding = 0;
+        write.dstArrayElement = static_cast<uint32_t>(slot);
+        write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        write.descriptorCount = 1;
+        write.pImageInfo = &imageInfos.back();
+        writes.push_back(write);
+    }
 
-    vkDestroyBuffer(m_device, stagingBuffer, nullptr);
-    vkFreeMemory(m_device, stagingMemory, nullptr);
+    if (writes.empty())
+        return;
+
+    vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+    // Update after bind leaves command buffers recorded with the set alone, without it the secondary is invalidated
+    if (!m_bindlessTextures)
+        m_sceneDirty[frame] = true;
+}
+// =================================================
+// Name: StreamTexture
+// Desc: Starts uploading a copy of the texture from firstMip down, it's swapped in by UpdateTextureStreaming once it's done
+//       Every level is uploaded again rather than copying the ones already resident, they're the small ones anyway
+// Params: texture, firstMip
+// Return: NONE
+void HelloTriangleApplication::StreamTexture(Texture& texture, uint8_t firstMip)
+{
+    texture.pendingMip = firstMip;
+    texture.pendingSize = CreateTextureLevels(texture.source, firstMip, texture.pendingImage, texture.pendingMemory, texture.pendingView);
+    texture.pendingUpload = m_uploads.Submit();
+
+    const TextureMip& mip = texture.source.mips[firstMip];
+    printf("Streaming texture %zu: mip %u -> %u (%ux%u, %.2f MB)\n", static_cast<size_t>(&texture - m_textures.data()),
+        static_cast<uint32_t>(texture.residentMip), static_cast<uint32_t>(firstMip), mip.width, mip.height,
+        static_cast<double>(texture.pendingSize) / (1024.0 * 1024.0));
 }
 // =================================================
 // Name: TransitionImageLayout
@@ -655,7 +1466,7 @@ void HelloTriangleApplication::CreateTextureImage()
 // Return: NONE
 void HelloTriangleApplication::TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint8_t mipLevels)
 {
-    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+    VkCommandBuffer commandBuffer = m_uploads.GetCommandBuffer();
 
     VkPipelineStageFlags sourceStage = 0;
     VkPipelineStageFlags destinationStage = 0;
@@ -702,8 +1513,6 @@ void HelloTriangleApplication::TransitionImageLayout(VkImage image, VkFormat for
         0, nullptr,
         1, &barrier            // We want one image one
     );
-
-    EndSingleTimeCommands(commandBuffer);
 }
 // =================================================
 // Name: CreateImageSampler
@@ -739,17 +1548,60 @@ void HelloTriangleApplication::CreateImageSampler()
     samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
     samplerInfo.mipLodBias = 0.0f; // Optional
     samplerInfo.minLod = 0.0f;     // Optional
-    samplerInfo.maxLod = static_cast<float>(m_mipLevels);
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;   // Shared by every texture, so each one is clamped to its own mips instead
 
     // Finally we can make our sampler
     assert(vkCreateSampler(m_device, &samplerInfo, nullptr, &m_textureSampler) == VK_SUCCESS);
 }
 // =================================================
+// Name: LoadMeshes
+// Desc: Adds every model to the shared vertex and index arrays, in MODEL_PATHS order whichever finished loading first
+// Params: NONE
+// Return: NONE
+void HelloTriangleApplication::LoadMeshes()
+{
+    double loadTime = 0.0;
+    for (size_t i = 0; i < m_meshLoads.size(); ++i) {
+        const LoadedMesh mesh = m_meshLoads[i].get();
+        printf("Mesh %s in %.2fms (%s)\n", mesh.cached ? "read from cache" : "built from OBJ", mesh.time, MeshCachePath(MODEL_PATHS[i]).c_str());
+
+        AddMesh(mesh.verts, mesh.indices);
+        loadTime += mesh.time;
+    }
+    m_meshLoads.clear();
+
+    // Added up across the threads, so it can be more than the time they were running for
+    m_asyncPhases.push_back({ "mesh loads", loadTime });
+
+    printf("%zu meshes sharing %zu verts and %zu indices\n", m_meshes.size(), verts.size(), indices.size());
+}
+// =================================================
+// Name: LoadMeshFile
+// Desc: Uses the binary mesh cache if it's still valid, otherwise loads and optimises the OBJ and writes a new cache
+//       Runs on its own thread at startup, it only touches the mesh it returns
+// Params: path
+// Return: LoadedMesh
+LoadedMesh HelloTriangleApplication::LoadMeshFile(const std::string& path)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    LoadedMesh mesh;
+    mesh.cached = ReadMeshCache(path, mesh.verts, mesh.indices);
+    if (!mesh.cached) {
+        LoadModel(path, mesh.verts, mesh.indices);
+        OptimiseModel(mesh.verts, mesh.indices);
+        WriteMeshCache(path, mesh.verts, mesh.indices);
+    }
+
+    mesh.time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+    return mesh;
+}
+// =================================================
 // Name: LoadModel
 // Desc: Loads a model to be used in the vertex buffer
-// Params: NONE
+// Params: path, meshVerts, meshIndices
 // Return: NONE
-void HelloTriangleApplication::LoadModel()
+void HelloTriangleApplication::LoadModel(const std::string& path, std::vector<Vertex>& meshVerts, std::vector<uint32_t>& meshIndices)
 {
     // Declare our variables
     tinyobj::attrib_t attrib;
@@ -758,11 +1610,16 @@ void HelloTriangleApplication::LoadModel()
     std::string warn, err;
 
     // Call tiny OBJ's function
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, MODEL_PATH.c_str())) {
+    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path.c_str())) {
         throw std::runtime_error(warn + err);
         //TODO: load error model
     }
 
+    // Every index in the file used to become its own vertex, so track the unique ones
+    // and point repeat indices back at the first copy
+    std::unordered_map<Vertex, uint32_t> uniqueVerts;
+    size_t rawVertCount = 0;
+
     // Format the loaded info
     for (const auto& shape : shapes) {
         for (const auto& index : shape.mesh.indices) {
@@ -790,29 +1647,130 @@ void HelloTriangleApplication::LoadModel()
 
             vertex.colour = { 1.0f, 1.0f, 1.0f };
 
-            // Loop assumes each vert is unique and no duplication occurs
-            // It will still work if it does, just less efficiently
-            verts.emplace_back(vertex);
-            indices.emplace_back(indices.size());
+            // Only add the vertex if we haven't seen an identical one already
+            auto found = uniqueVerts.find(vertex);
+            if (found == uniqueVerts.end()) {
+                found = uniqueVerts.emplace(vertex, static_cast<uint32_t>(meshVerts.size())).first;
+                meshVerts.emplace_back(vertex);
+            }
+
+            meshIndices.emplace_back(found->second);
+            ++rawVertCount;
         }
     }
+
+    // Report what the deduplication saved us
+    const size_t savedBytes = (rawVertCount - meshVerts.size()) * sizeof(Vertex);
+    printf("Model loaded: %zu verts -> %zu unique verts, %zu indices (%.2f KB of vertex data saved)\n",
+        rawVertCount, meshVerts.size(), meshIndices.size(), static_cast<double>(savedBytes) / 1024.0);
 }
 // =================================================
-uint32_t FindMemoryType(VkPhysicalDevice physDevice, uint32_t filter, VkMemoryPropertyFlags flags) {
-    VkPhysicalDeviceMemoryProperties memoryProperties;
-    vkGetPhysicalDeviceMemoryProperties(physDevice, &memoryProperties);
-    // Gets two arrays, memoryType and memoryHeap
+// Name: OptimiseModel
+// Desc: Reorders the loaded triangles and verts for the GPU's caches, printing the before and after
+// Params: meshVerts, meshIndices
+// Return: NONE
+void HelloTriangleApplication::OptimiseModel(std::vector<Vertex>& meshVerts, std::vector<uint32_t>& meshIndices)
+{
+    // Nothing to reorder, and the overdraw pass needs a first vertex to read the positions from
+    if (meshVerts.empty() || meshIndices.empty())
+        return;
 
-    // Check for a suitable memory type (can hold vertex data, can be read and written to)
-    for(uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
-        if (filter & (1 << i) && (memoryProperties.memoryTypes[i].propertyFlags & flags) == flags)
-            return i;
+    const VertexCacheStats before = AnalyseVertexCache(meshIndices, meshVerts.size());
+
+    // Triangles first for the post-transform cache, then overdraw (keeps most of the cache order),
+    // then the verts last as they just follow whatever order the indices ended up in
+    OptimiseVertexCache(meshIndices, meshVerts.size());
+    OptimiseOverdraw(meshIndices, &meshVerts[0].pos.x, meshVerts.size(), sizeof(Vertex));
+    OptimiseVertexFetch(meshVerts, meshIndices);
+
+    const VertexCacheStats after = AnalyseVertexCache(meshIndices, meshVerts.size());
+
+    printf("Mesh optimised (%u entry FIFO): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+        VERTEX_CACHE_SIZE, before.acmr, after.acmr, before.atvr, after.atvr);
+}
+// =================================================
+// Name: AddMesh
+// Desc: Appends a mesh to the shared arrays, its indices stay relative to its own first vertex
+// Params: meshVerts, meshIndices
+// Return: uint32_t - the new mesh's index in m_meshes
+uint32_t HelloTriangleApplication::AddMesh(const std::vector<Vertex>& meshVerts, const std::vector<uint32_t>& meshIndices)
+{
+    MeshRange range;
+    range.firstIndex = static_cast<uint32_t>(indices.size());
+    range.indexCount = static_cast<uint32_t>(meshIndices.size());
+    range.vertexOffset = static_cast<int32_t>(verts.size());
+
+    // A sphere around the bounding box's centre, loose but only a few instructions to test
+    glm::vec3 minPos(std::numeric_limits<float>::max());
+    glm::vec3 maxPos(std::numeric_limits<float>::lowest());
+    for (const Vertex& vertex : meshVerts) {
+        minPos = glm::min(minPos, vertex.pos);
+        maxPos = glm::max(maxPos, vertex.pos);
     }
+    const glm::vec3 centre = (minPos + maxPos) * 0.5f;
+
+    float radius = 0.0f;
+    for (const Vertex& vertex : meshVerts)
+        radius = std::max(radius, glm::length(vertex.pos - centre));
+    range.sphere = glm::vec4(centre, radius);
+
+    verts.insert(verts.end(), meshVerts.begin(), meshVerts.end());
+    indices.insert(indices.end(), meshIndices.begin(), meshIndices.end());
+
+    m_meshes.push_back(range);
+    return static_cast<uint32_t>(m_meshes.size() - 1);
+}
+// =================================================
+// Name: BuildCompactVertices
+// Desc: Quantises every mesh's verts into the compact layout, moving its bounding sphere into the quantised space
+// Params: compactVerts
+// Return: NONE
+void HelloTriangleApplication::BuildCompactVertices(std::vector<CompactVertex>& compactVerts)
+{
+    compactVerts.resize(verts.size());
+
+    for (MeshRange& mesh : m_meshes) {
+        // The mesh's verts are a contiguous run starting at its vertex offset
+        const size_t first = static_cast<size_t>(mesh.vertexOffset);
+        size_t last = first;
+        for (uint32_t i = 0; i < mesh.indexCount; ++i)
+            last = std::max<size_t>(last, first + indices[mesh.firstIndex + i] + 1);
+
+        glm::vec3 minPos(std::numeric_limits<float>::max());
+        glm::vec3 maxPos(std::numeric_limits<float>::lowest());
+        for (size_t i = first; i < last; ++i) {
+            minPos = glm::min(minPos, verts[i].pos);
+            maxPos = glm::max(maxPos, verts[i].pos);
+        }
 
-    // No check for memoryHeap, can lead to less then desirable performance
+        // One scale for every axis so the dequantisation is a uniform scale, which the bounding sphere survives
+        const glm::vec3 extent = maxPos - minPos;
+        const float scale = std::max(std::max(extent.x, extent.y), std::max(extent.z, std::numeric_limits<float>::min()));
+        mesh.quantisation = glm::vec4(minPos, scale);
+        mesh.sphere = glm::vec4((glm::vec3(mesh.sphere) - minPos) / scale, mesh.sphere.w / scale);
+
+        for (size_t i = first; i < last; ++i) {
+            const glm::vec3 unorm = (verts[i].pos - minPos) / scale;
+            compactVerts[i].pos[0] = glm::packUnorm1x16(unorm.x);
+            compactVerts[i].pos[1] = glm::packUnorm1x16(unorm.y);
+            compactVerts[i].pos[2] = glm::packUnorm1x16(unorm.z);
+            compactVerts[i].pos[3] = 0;
+            compactVerts[i].texCoord[0] = glm::packHalf1x16(verts[i].texCoord.x);
+            compactVerts[i].texCoord[1] = glm::packHalf1x16(verts[i].texCoord.y);
+        }
+    }
 
-    // If nothing suitable is found assert false
-    assert(false);
+    printf("Compact verts: %zu KB -> %zu KB\n", verts.size() * sizeof(Vertex) / 1024, compactVerts.size() * sizeof(CompactVertex) / 1024);
+}
+// =================================================
+// Name: GetDequantisation
+// Desc: The transform from a mesh's vertex buffer space back to its own, identity unless it was quantised
+// Params: mesh
+// Return: glm::mat4
+glm::mat4 HelloTriangleApplication::GetDequantisation(uint32_t mesh) const
+{
+    const glm::vec4& quantisation = m_meshes[mesh].quantisation;
+    return glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(quantisation)), glm::vec3(quantisation.w));
 }
 // =================================================
 // Name: CreateBuffer
@@ -821,72 +1779,63 @@ uint32_t FindMemoryType(VkPhysicalDevice physDevice, uint32_t filter, VkMemoryPr
 // Return: NONE
 template<typename BufferType>
 void HelloTriangleApplication::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags uFlags, VkMemoryPropertyFlags pFlags, 
-    BufferType& buffer, VkDeviceMemory& memory)
+    BufferType& buffer, MemoryAllocation& memory, MemoryCategory category)
 {
     VkBufferCreateInfo bufferInfo;
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferInfo.pNext = nullptr;
     bufferInfo.size = size;      // Size of buffer
     bufferInfo.usage = uFlags;   // The purpose of the data
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;     // Its level of protection, only the graphics queue needs it so exclusive
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;     // Its level of protection, one queue family at a time (uploads hand ownership over)
     bufferInfo.flags = 0;   // Used to configure sparse memory
 
     // Create a buffer
     assert(vkCreateBuffer(m_device, &bufferInfo, nullptr, &buffer) == VK_SUCCESS);
 
-    AllocateBindBuffer(pFlags, buffer, memory, vkGetBufferMemoryRequirements, vkBindBufferMemory);
+    AllocateBindBuffer(pFlags, buffer, memory, true, vkGetBufferMemoryRequirements, vkBindBufferMemory, category);
 }
 // =================================================
 template<typename BufferType>
-void HelloTriangleApplication::AllocateBindBuffer(VkMemoryPropertyFlags pFlags, BufferType& buffer, VkDeviceMemory& memory, 
-    void(*reqFunction)(VkDevice, BufferType, VkMemoryRequirements*), VkResult(*bindFunction)(VkDevice, BufferType, VkDeviceMemory, VkDeviceSize))
+void HelloTriangleApplication::AllocateBindBuffer(VkMemoryPropertyFlags pFlags, BufferType& buffer, MemoryAllocation& memory, bool linearResource,
+    void(*reqFunction)(VkDevice, BufferType, VkMemoryRequirements*), VkResult(*bindFunction)(VkDevice, BufferType, VkDeviceMemory, VkDeviceSize),
+    MemoryCategory category, VkMemoryPropertyFlags preferredFlags)
 {
     // Get the memory requirements for our allocator
     VkMemoryRequirements memoryRequirements;
     reqFunction(m_device, buffer, &memoryRequirements);
 
-    // The memory allocator to be paired with the buffer
-    VkMemoryAllocateInfo allocInfo;
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.pNext = nullptr;
-    allocInfo.allocationSize = memoryRequirements.size;
-    allocInfo.memoryTypeIndex = FindMemoryType(m_physicalDevice, memoryRequirements.memoryTypeBits, pFlags);
+    // Take a piece of one of the allocator's blocks rather than allocating for every buffer
+    // Linear resources (buffers) and optimal images come from different blocks so bufferImageGranularity can't bite
+    // The category is only for the stats, so a leak or a budget problem can be pinned on one kind of resource
+    memory = m_allocator.Allocate(memoryRequirements, pFlags, linearResource, category, preferredFlags);
     // vkFlushMappedMemoryRanges(m_device, memoryrange.length, memoryrange.data) can be used instead of VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
     // Ensures the memory is made available immidiately with explicit caching
 
-    // Allocate the memory that can accomdate our requirements
-    assert(vkAllocateMemory(m_device, &allocInfo, nullptr, &memory) == VK_SUCCESS);
-    // TODO: IRL calling allocate for every buffer is bad practice, the 'right' way is for many buffers to share an allocate
-    // Could make own allocator or use the VulkanMemoryAllocator library (Red Kite recommended making own allocator remember)
-
-    // Bind our buffer and memory together (Vertex buffer in this case)
-    bindFunction(m_device, buffer, memory, 0);
-    // Offset should always be divisible by memReqs.allignment
+    // Bind our buffer and memory together at the offset the allocator gave us (already aligned to memReqs.alignment)
+    bindFunction(m_device, buffer, memory.memory, memory.offset);
 }
 // =================================================
-void HelloTriangleApplication::CopyBuffer(VkBuffer srcBuff, VkBuffer dstBuff, VkDeviceSize size)
+void HelloTriangleApplication::CopyBuffer(StagingSlice src, VkBuffer dstBuff, VkDeviceSize size)
 {
     // Memory transfer operations are done using command buffers, like drawing commands
-
-    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+    // They're all recorded into the upload context's batch and submitted together
+    VkCommandBuffer commandBuffer = m_uploads.GetCommandBuffer();
 
     // The copy info for..
     VkBufferCopy copyInfo;
-    copyInfo.srcOffset = 0; // Optional 
+    copyInfo.srcOffset = src.offset;
     copyInfo.dstOffset = 0; // Optional 
     copyInfo.size = size;
     // .. The copy instruction
-    vkCmdCopyBuffer(commandBuffer, srcBuff, dstBuff, 1, &copyInfo);
-
-    EndSingleTimeCommands(commandBuffer);
+    vkCmdCopyBuffer(commandBuffer, src.buffer, dstBuff, 1, &copyInfo);
 }
 // =================================================
-void HelloTriangleApplication::CopyBuffer2Image(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+void HelloTriangleApplication::CopyBuffer2Image(StagingSlice src, VkImage image, uint32_t width, uint32_t height)
 {
-    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+    VkCommandBuffer commandBuffer = m_uploads.GetCommandBuffer();
 
     VkBufferImageCopy region;
-    region.bufferOffset = 0;        // Where the pixel values start
+    region.bufferOffset = src.offset;   // Where the pixel values start
     region.bufferRowLength = 0;     // How the pixels are laid out in memory
     region.bufferImageHeight = 0;   // 0 means there is no padding out 
 
@@ -900,14 +1849,13 @@ void HelloTriangleApplication::CopyBuffer2Image(VkBuffer buffer, VkImage image,
     region.imageExtent = { width, height,1 };
 
     // The copy command
-    vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    vkCmdCopyBufferToImage(commandBuffer, src.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
     // The 4th param assumes the image is already in the most optimal format for copying
-
-    EndSingleTimeCommands(commandBuffer);
 }
 // =================================================
 void HelloTriangleApplication::CreateImageBuffer(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
-    VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory, uint8_t mipLevels, VkSampleCountFlagBits sampleCount)
+    VkMemoryPropertyFlags properties, VkImage& image, MemoryAllocation& imageMemory, uint8_t mipLevels, VkSampleCountFlagBits sampleCount,
+    MemoryCategory category)
 {
     // To make an image we need an info struct (classic Vulkan stuff)
     VkImageCreateInfo imageInfo;
@@ -931,113 +1879,89 @@ void HelloTriangleApplication::CreateImageBuffer(uint32_t width, uint32_t height
     // Possible for VK_FORMAT_R8G8B8A8_SRGB to not be supported but uncommon
     assert(vkCreateImage(m_device, &imageInfo, nullptr, &image) == VK_SUCCESS);
 
-    AllocateBindBuffer<VkImage>(properties, image, imageMemory, vkGetImageMemoryRequirements, vkBindImageMemory);
+    // Transient attachments never leave tile memory on a tiler, so lazily allocated memory (if there is any) is only
+    // ever backed when the driver really has to spill them
+    const VkMemoryPropertyFlags preferred = (usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) ? VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT : 0;
+    AllocateBindBuffer<VkImage>(properties, image, imageMemory, tiling == VK_IMAGE_TILING_LINEAR, vkGetImageMemoryRequirements, vkBindImageMemory,
+        category, preferred);
 }
 // =================================================
-VkCommandBuffer HelloTriangleApplication::BeginSingleTimeCommands()
-{
-    // Create temporary command buffer for this operation
-    // TODO: Make this have it's own command pool with VK_COMMAND_POOL_CREATE_TRANSIENT_BIT enabled
-    VkCommandBufferAllocateInfo allocInfo;
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.pNext = nullptr;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = m_commandPool;
-    allocInfo.commandBufferCount = 1;
-
-    VkCommandBuffer commandBuffer;
-    vkAllocateCommandBuffers(m_device, &allocInfo, &commandBuffer);
-
-    // Immediately start recording to the command buffer
-    VkCommandBufferBeginInfo beginInfo;
-    beginInfo.pNext = nullptr;
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT; // Tells the driver we just want to do this once
-
-    vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-    return commandBuffer;
-}
-// =================================================
-void HelloTriangleApplication::EndSingleTimeCommands(VkCommandBuffer cmdBuffer)
-{
-    // And then end it
-    vkEndCommandBuffer(cmdBuffer);
-
-    // and execute it to complete the transfer
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.pNext = nullptr;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &cmdBuffer;
-
-    vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(m_graphicsQueue);
-    // There are no events to wait on like draw commands
-    // TODO: Could use WaitForFences to schedule multiple transfers, vkQueueWaitIdle has to be done one at a time
-
-    // Free the command buffer now we no longer need it
-    vkFreeCommandBuffers(m_device, m_commandPool, 1, &cmdBuffer);
-}
-// =================================================
-// Name: CreateVertexIndexBuffer
-// Desc: Fills out the vertex buffer for binding
-// Params: NONE
-// Return: NONE
-template<typename Type>
-void HelloTriangleApplication::CreateVertexIndexBuffer(std::vector<Type>dataVec, VkBufferUsageFlagBits useFlag, VkBuffer& buffer, VkDeviceMemory& memory)
+// Name: CreateVertexIndexBuffer
+// Desc: Fills out the vertex buffer for binding
+// Params: NONE
+// Return: NONE
+template<typename Type>
+void HelloTriangleApplication::CreateVertexIndexBuffer(const std::vector<Type>& dataVec, VkBufferUsageFlagBits useFlag, VkBuffer& buffer, MemoryAllocation& memory)
 {
     const VkDeviceSize size = sizeof(dataVec[0]) * dataVec.size();
 
-    // Create the staging buffer to temporarily hold our data on the CPU for reading and writing
+    // Stage the data to temporarily hold it on the CPU side
     // Holds all the same vertex buffer data as the real deal
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingMemory;
-    CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        stagingBuffer, stagingMemory);
-    // Without the 'SRC_BIT and the 'DST_BIT we cannot copy data between them!
-
-    // A pointer to the memory location
-    void* data;
-    // Assign an area in VRAM and set the pointer to be that location
-    vkMapMemory(m_device, stagingMemory, 0, size, 0, &data);
-    // Copy the data to that location
-    memcpy(data, dataVec.data(), size);
-    // And release it to the GPU for processing
-    vkUnmapMemory(m_device, stagingMemory);
+    const StagingSlice staging = m_uploads.Stage(dataVec.data(), size);
 
     // Create the actual vertex buffer using the aptly named function
+    // Without the 'DST_BIT we cannot copy the staged data into it!
     CreateBuffer(size, useFlag | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, memory);
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, memory, MemoryCategory::Mesh);
     // 'LOCAL_BIT disables the use of vkMapMemory
 
     // So we use our own copy function instead
     // copying the staging buffer to the vertex buffer on the GPU
-    CopyBuffer(stagingBuffer, buffer, size);
+    CopyBuffer(staging, buffer, size);
+
+    // If the copy ran on the transfer queue the graphics queue has to take ownership before drawing with it
+    m_uploads.TransferBufferOwnership(buffer, useFlag == VK_BUFFER_USAGE_INDEX_BUFFER_BIT ? VK_ACCESS_INDEX_READ_BIT : VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
 
-    // Our staging buffer is no longer needed, so can be cleaned up
-    vkDestroyBuffer(m_device, stagingBuffer, nullptr);
-    vkFreeMemory(m_device, stagingMemory, nullptr);
+    // The staging memory is freed by the upload context once the batch's fence says the copy is done
 }
 // =================================================
 // Name: CreateUniformBuffers
-// Desc: Create what will be the uniform buffers
+// Desc: Create the uniform ring buffer, one slice for each frame in flight
 // Params: NONE
 // Return: NONE
 void HelloTriangleApplication::CreateUniformBuffers()
 {
-    VkDeviceSize size = sizeof(UniformBufferObject);
+    // Each push has to start on a multiple of the device's dynamic offset alignment
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+    m_uniformAlignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 1);
 
-    // Have a buffer for each frame, since values may change from frame to frame
+    // Have a slice for each frame, since values may change from frame to frame
     // And we don't want to have one value being changed while being read
-    m_uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-    m_uniformMemory.resize(MAX_FRAMES_IN_FLIGHT);
+    // It's all one buffer though, which the allocator keeps mapped so there's no map/unmap every frame
+    CreateBuffer(UNIFORM_SLICE_SIZE * m_framesInFlight, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_uniformBuffer, m_uniformMemory, MemoryCategory::Uniform);
 
-    // Make our buffers
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        CreateBuffer(size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            m_uniformBuffers[i], m_uniformMemory[i]);
-    }
+    m_uniformOffsets.resize(m_framesInFlight, 0);
+}
+// =================================================
+// Name: BeginUniformFrame
+// Desc: Moves the ring on to a frame's slice. Only safe once that frame's fence has been waited on
+// Params: frame
+// Return: NONE
+void HelloTriangleApplication::BeginUniformFrame(uint32_t frame)
+{
+    m_uniformSliceStart = UNIFORM_SLICE_SIZE * frame;
+    m_uniformHead = m_uniformSliceStart;
+}
+// =================================================
+// Name: PushUniformData
+// Desc: Copies data into the current frame's slice
+// Params: data, size
+// Return: uint32_t - the dynamic offset to bind it with
+uint32_t HelloTriangleApplication::PushUniformData(const void* data, VkDeviceSize size)
+{
+    // Align the start (alignment is always a power of 2)
+    const VkDeviceSize offset = (m_uniformHead + m_uniformAlignment - 1) & ~(m_uniformAlignment - 1);
+
+    // Running out means the slice needs to be bigger, wrapping would write over data the GPU could be reading
+    assert(offset + size <= m_uniformSliceStart + UNIFORM_SLICE_SIZE);
+
+    memcpy(static_cast<char*>(m_uniformMemory.mapped) + offset, data, size);
+    m_uniformHead = offset + size;
+
+    return static_cast<uint32_t>(offset);
 }
 // =================================================
 // Name: UpdateUniformBuffers
@@ -1052,21 +1976,159 @@ void HelloTriangleApplication::UpdateUniformBuffers(uint32_t currentImage)
     // TODO: move this time code somewhere more appropriate
     auto currentTime = std::chrono::high_resolution_clock::now();
     float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+    // Benchmarks step a fixed amount a frame so every run draws exactly the same frames, however fast the GPU is
+    if (m_headless)
+        time = static_cast<float>(m_frameNumber) * BENCHMARK_TIMESTEP;
+
+    // The objects' transforms go through the object buffer, only what moved is recomputed and copied in
+    // A static scene stays put, otherwise the recorded draws would be out of date every frame
+    if (!m_staticScene) {
+        for (const RenderObject& object : m_renderObjects)
+            m_sceneGraph.SetLocal(object.node, glm::rotate(glm::translate(glm::mat4(1.0f), object.position), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
+    }
+    // The recording threads are idle until the draws are recorded, they take the big levels
+    m_sceneGraph.Update(m_recordThreadCount > 0 ? &m_recordThreads : nullptr);
 
-    // Our UBO
+    // Our UBO only holds what's shared by everything in the frame
     UniformBufferObject ubo{};
-    // Some transforms
-    ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-    ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-    ubo.proj = glm::perspective(glm::radians(45.0f), static_cast<float>(m_swapChainExtent.width) / static_cast<float>(m_swapChainExtent.height), 0.1f, 10.0f);
+    // Pull the camera back to fit bigger grids in
+    const float sceneScale = static_cast<float>(m_sceneGridSize);
+    ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f) * sceneScale, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    ubo.proj = glm::perspective(glm::radians(45.0f), static_cast<float>(m_swapChainExtent.width) / static_cast<float>(m_swapChainExtent.height), 0.1f, 10.0f * sceneScale);
     // Invert as glm was made for OpenGL
     ubo.proj[1][1] *= -1;
+    ubo.viewProj = ubo.proj * ubo.view;
+
+    // Gribb/Hartmann: each plane is the last row of viewProj plus or minus another row
+    // glm is column major so row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+    const glm::mat4& m = ubo.viewProj;
+    const glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    const glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    const glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    const glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+    ubo.frustumPlanes[0] = row3 + row0;     // Left
+    ubo.frustumPlanes[1] = row3 - row0;     // Right
+    ubo.frustumPlanes[2] = row3 + row1;     // Bottom (top after the flip, it doesn't matter which)
+    ubo.frustumPlanes[3] = row3 - row1;     // Top
+    ubo.frustumPlanes[4] = row2;            // Near, depth is 0 to 1 rather than OpenGL's -1 to 1
+    ubo.frustumPlanes[5] = row3 - row2;     // Far
+    // Normalised so the distances are real distances, the sphere test needs them to be
+    for (glm::vec4& plane : ubo.frustumPlanes)
+        plane /= glm::length(glm::vec3(plane));
+
+    BeginUniformFrame(currentImage);
+    m_uniformOffsets[currentImage] = PushUniformData(&ubo, sizeof(ubo));
+
+    UpdateObjectBuffers(currentImage);
+
+    // The same camera decides which texture levels are worth having
+    UpdateTextureStreaming(currentImage, ubo.view, ubo.proj);
+}
+// =================================================
+// Name: CreateObjectBuffers
+// Desc: Creates the per object storage buffer and the indirect draw buffer, a slice of each for every frame in flight
+// Params: NONE
+// Return: NONE
+void HelloTriangleApplication::CreateObjectBuffers()
+{
+    // Written by the CPU every frame and left mapped, like the uniform ring
+    CreateBuffer(sizeof(ObjectData) * MAX_OBJECTS * m_framesInFlight, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_objectBuffer, m_objectMemory, MemoryCategory::Uniform);
+    m_objectSliceVersions.assign(m_framesInFlight, 0);     // Nothing's been written yet
+
+    // The draws never leave the GPU, the cull pass writes them and the draw reads them
+    CreateBuffer(sizeof(VkDrawIndexedIndirectCommand) * MAX_OBJECTS * m_framesInFlight,
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_indirectBuffer, m_indirectMemory, MemoryCategory::Other);
+
+    // Cleared with vkCmdFillBuffer before each cull, so it needs to be a transfer destination as well
+    CreateBuffer(sizeof(uint32_t) * m_framesInFlight,
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_drawCountBuffer, m_drawCountMemory, MemoryCategory::Other);
+}
+// =================================================
+// Name: CreateMeshBuffer
+// Desc: Uploads every mesh's range and bounds for the cull pass, they don't change after loading
+// Params: NONE
+// Return: NONE
+void HelloTriangleApplication::CreateMeshBuffer()
+{
+    const VkDeviceSize size = sizeof(MeshRange) * m_meshes.size();
+    const StagingSlice staging = m_uploads.Stage(m_meshes.data(), size);
 
-    // TODO: This is inefficient and would be better as a push constant
-    void* data;
-    vkMapMemory(m_device, m_uniformMemory[currentImage], 0, sizeof(ubo), 0, &data);
-    memcpy(data, &ubo, sizeof(ubo));
-    vkUnmapMemory(m_device, m_uniformMemory[currentImage]);
+    CreateBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_meshBuffer, m_meshMemory, MemoryCategory::Mesh);
+    CopyBuffer(staging, m_meshBuffer, size);
+
+    m_uploads.TransferBufferOwnership(m_meshBuffer, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+}
+// =================================================
+// Name: UpdateObjectBuffers
+// Desc: Brings the frame's slice up to date with the scene graph, the cull pass turns it into draws. Only safe once that frame's fence has been waited on
+//       Each slice remembers the graph version it was last written at, so only the objects that moved since are copied in
+// Params: frame
+// Return: NONE
+void HelloTriangleApplication::UpdateObjectBuffers(uint32_t frame)
+{
+    assert(m_renderObjects.size() <= MAX_OBJECTS);
+
+    ObjectData* objects = static_cast<ObjectData*>(m_objectMemory.mapped) + frame * MAX_OBJECTS;
+    const uint64_t sliceVersion = m_objectSliceVersions[frame];
+
+    for (size_t i = 0; i < m_renderObjects.size(); ++i) {
+        const RenderObject& object = m_renderObjects[i];
+        if (m_sceneGraph.GetChangedVersion(object.node) <= sliceVersion)
+            continue;
+
+        // Compact positions come out of the vertex fetch as 0 to 1, the dequantisation takes them back first
+        const glm::mat4& model = m_sceneGraph.GetWorld(object.node);
+        objects[i].model = m_compactVertices ? model * GetDequantisation(object.mesh) : model;
+        objects[i].mesh = object.mesh;
+        objects[i].texture = object.texture;
+    }
+
+    m_objectSliceVersions[frame] = m_sceneGraph.GetVersion();
+}
+// =================================================
+// Name: RecordCullCommands
+// Desc: Records the cull dispatch that fills the frame's draws, has to go before the render pass
+// Params: buffer, frame
+// Return: NONE
+void HelloTriangleApplication::RecordCullCommands(VkCommandBuffer buffer, uint32_t frame)
+{
+    const bool compact = UsesDrawCount();
+
+    // The survivors are counted up from 0 with atomics
+    if (compact) {
+        vkCmdFillBuffer(buffer, m_drawCountBuffer, sizeof(uint32_t) * frame, sizeof(uint32_t), 0);
+
+        VkMemoryBarrier clearBarrier{};
+        clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+            1, &clearBarrier, 0, nullptr, 0, nullptr);
+    }
+
+    CullConstants constants;
+    constants.objectCount = static_cast<uint32_t>(m_renderObjects.size());
+    constants.frame = frame;
+    constants.sliceSize = MAX_OBJECTS;
+    constants.flags = (m_frustumCulling ? CULL_ENABLED : 0) | (compact ? CULL_COMPACT : 0);
+
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullPipeline);
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullPipelineLayout, 0, 1, &m_cullSet,
+        1, &m_uniformOffsets[frame]);
+    vkCmdPushConstants(buffer, m_cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+    vkCmdDispatch(buffer, (constants.objectCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+    // The draws (and count) have to be written before the indirect draw reads them
+    VkMemoryBarrier drawBarrier{};
+    drawBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    drawBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    drawBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0,
+        1, &drawBarrier, 0, nullptr, 0, nullptr);
 }
 // =================================================
 // Name: CreateDescriptorPool
@@ -1077,18 +2139,30 @@ void HelloTriangleApplication::CreateDescriptorPool()
 {
     std::vector<VkDescriptorPoolSize> poolSizes(2);
     
-    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;                      // What our descriptor sets will contain
-    poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT); // How many of them
-    poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;              // What our descriptor sets will contain
-    poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT); // How many of them
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;              // What our descriptor sets will contain
+    poolSizes[0].descriptorCount = m_framesInFlight + 1; // How many of them (+ the cull set's)
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = m_framesInFlight + 4;   // The cull set has 4
 
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());       // How many to create each frame
     poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);         // The maximum amount that can exist from the pool
+    poolInfo.maxSets = m_framesInFlight + 1;     // The maximum amount that can exist from the pool
 
     assert(vkCreateDescriptorPool(m_device, &poolInfo, nullptr, &m_descriptorPool) == VK_SUCCESS);
+
+    // The texture tables get their own pool, update after bind sets can only come from a pool made for them
+    VkDescriptorPoolSize textureSize;
+    textureSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    textureSize.descriptorCount = m_textureSlots * m_framesInFlight;
+
+    poolInfo.flags = m_bindlessTextures ? VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT : 0;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &textureSize;
+    poolInfo.maxSets = m_framesInFlight;
+
+    assert(vkCreateDescriptorPool(m_device, &poolInfo, nullptr, &m_texturePool) == VK_SUCCESS);
 }
 // =================================================
 // Name: CreateDescriptorSets
@@ -1097,28 +2171,42 @@ void HelloTriangleApplication::CreateDescriptorPool()
 // Return: NONE
 void HelloTriangleApplication::CreateDescriptorSets()
 {
-    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, m_descriptorSetLayout);
+    std::vector<VkDescriptorSetLayout> layouts(m_framesInFlight, m_descriptorSetLayout);
     VkDescriptorSetAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool = m_descriptorPool;                                // The pool to allocate from
-    allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT); // How many
+    allocInfo.descriptorSetCount = m_framesInFlight; // How many
     allocInfo.pSetLayouts = layouts.data();                                     // The layout to use
 
-    m_descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);  
+    m_descriptorSets.resize(m_framesInFlight);  
 
     assert(vkAllocateDescriptorSets(m_device, &allocInfo, m_descriptorSets.data()) == VK_SUCCESS);
 
+    // The texture tables are filled in by UpdateTextureTable on each frame's first turn, before anything's recorded with them
+    assert(!m_bindlessTextures || m_textures.size() <= m_textureSlots);
+    std::vector<VkDescriptorSetLayout> textureLayouts(m_framesInFlight, m_textureSetLayout);
+    VkDescriptorSetAllocateInfo textureAllocInfo = allocInfo;
+    textureAllocInfo.descriptorPool = m_texturePool;
+    textureAllocInfo.pSetLayouts = textureLayouts.data();
+
+    m_textureSets.resize(m_framesInFlight);
+    m_boundTextureViews.assign(m_framesInFlight, std::vector<VkImageView>(m_textureSlots, VK_NULL_HANDLE));
+
+    assert(vkAllocateDescriptorSets(m_device, &textureAllocInfo, m_textureSets.data()) == VK_SUCCESS);
+
     // Loop to populate the descriptors
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    for (size_t i = 0; i < m_framesInFlight; i++) {
+        // Every set points at the start of the ring, the dynamic offset picks the slice when it's bound
         VkDescriptorBufferInfo bufferInfo;
-        bufferInfo.buffer = m_uniformBuffers[i];
+        bufferInfo.buffer = m_uniformBuffer;
         bufferInfo.offset = 0;
         bufferInfo.range = sizeof(UniformBufferObject);
 
-        VkDescriptorImageInfo imageInfo;
-        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        imageInfo.imageView = m_textImgView;
-        imageInfo.sampler = m_textureSampler;
+        // Each frame's set sees only its own slice of the object data
+        VkDescriptorBufferInfo objectInfo;
+        objectInfo.buffer = m_objectBuffer;
+        objectInfo.offset = sizeof(ObjectData) * MAX_OBJECTS * i;
+        objectInfo.range = sizeof(ObjectData) * MAX_OBJECTS;
 
         std::vector<VkWriteDescriptorSet> writeDescriptors(2);
         
@@ -1126,7 +2214,7 @@ void HelloTriangleApplication::CreateDescriptorSets()
         writeDescriptors[0].dstSet = m_descriptorSets[i];
         writeDescriptors[0].dstBinding = 0;                                      // The binding of the uniform buffer in the shader
         writeDescriptors[0].dstArrayElement = 0;                                 // It's not an array, so just 0
-        writeDescriptors[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;  // Type 
+        writeDescriptors[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;  // Type 
         writeDescriptors[0].descriptorCount = 1;                                 // How many
         writeDescriptors[0].pBufferInfo = &bufferInfo;
         writeDescriptors[0].pImageInfo = nullptr;           // Optional - for sampling 
@@ -1134,18 +2222,44 @@ void HelloTriangleApplication::CreateDescriptorSets()
       
         writeDescriptors[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         writeDescriptors[1].dstSet = m_descriptorSets[i];
-        writeDescriptors[1].dstBinding = 1;                                              // The binding of the uniform buffer in the shader
-        writeDescriptors[1].dstArrayElement = 0;                                         // It's not an array, so just 0
-        writeDescriptors[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;  // Type 
-        writeDescriptors[1].descriptorCount = 1;                                         // How many
-        writeDescriptors[1].pBufferInfo = nullptr;
-        writeDescriptors[1].pImageInfo = &imageInfo;           // for sampling 
+        writeDescriptors[1].dstBinding = 2;
+        writeDescriptors[1].dstArrayElement = 0;
+        writeDescriptors[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writeDescriptors[1].descriptorCount = 1;
+        writeDescriptors[1].pBufferInfo = &objectInfo;
+        writeDescriptors[1].pImageInfo = nullptr;
         writeDescriptors[1].pTexelBufferView = nullptr;
 
         // Apply the descriptor set
         vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writeDescriptors.size()), writeDescriptors.data(),
             0, nullptr);
     }
+
+    // The cull pass only needs the one set, its buffers are bound whole and the push constants pick the frame's slice
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &m_cullSetLayout;
+    assert(vkAllocateDescriptorSets(m_device, &allocInfo, &m_cullSet) == VK_SUCCESS);
+
+    std::vector<VkDescriptorBufferInfo> cullBuffers(5);
+    cullBuffers[0] = { m_uniformBuffer, 0, sizeof(UniformBufferObject) };   // Dynamic, like the draw's
+    cullBuffers[1] = { m_objectBuffer, 0, VK_WHOLE_SIZE };
+    cullBuffers[2] = { m_meshBuffer, 0, VK_WHOLE_SIZE };
+    cullBuffers[3] = { m_indirectBuffer, 0, VK_WHOLE_SIZE };
+    cullBuffers[4] = { m_drawCountBuffer, 0, VK_WHOLE_SIZE };
+
+    std::vector<VkWriteDescriptorSet> cullWrites(cullBuffers.size());
+    for (uint32_t binding = 0; binding < cullWrites.size(); ++binding) {
+        cullWrites[binding] = {};
+        cullWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        cullWrites[binding].dstSet = m_cullSet;
+        cullWrites[binding].dstBinding = binding;
+        cullWrites[binding].dstArrayElement = 0;
+        cullWrites[binding].descriptorType = binding == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        cullWrites[binding].descriptorCount = 1;
+        cullWrites[binding].pBufferInfo = &cullBuffers[binding];
+    }
+
+    vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(cullWrites.size()), cullWrites.data(), 0, nullptr);
 }
 // =================================================
 // Name: CreateCommandBuffers
@@ -1167,6 +2281,15 @@ void HelloTriangleApplication::CreateCommandBuffers()
 
     assert(vkAllocateCommandBuffers(m_device, &allocInfo, m_commandBuffers.data()) == VK_SUCCESS);
 
+    // The secondaries for static mode, recorded the first time each frame uses them
+    m_sceneCommandBuffers.resize(m_framesInFlight);
+    m_sceneDirty.assign(m_framesInFlight, true);
+    m_sceneUniformOffsets.assign(m_framesInFlight, 0);
+
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    allocInfo.commandBufferCount = static_cast<uint32_t>(m_sceneCommandBuffers.size());
+
+    assert(vkAllocateCommandBuffers(m_device, &allocInfo, m_sceneCommandBuffers.data()) == VK_SUCCESS);
 }
 // =================================================
 // Name: RecordCommandBuffer
@@ -1183,6 +2306,17 @@ void HelloTriangleApplication::RecordCommandBuffer(VkCommandBuffer buffer, uint3
     assert(vkBeginCommandBuffer(buffer, &beginInfo) == VK_SUCCESS);
     // Will end any other command buffer being recorded when called
 
+    // Picks up this frame's timestamps from last time round and resets them, before anything else is recorded
+    m_profiler.BeginFrame(buffer, static_cast<uint32_t>(m_currentFrame));
+    const uint32_t frameScope = m_profiler.BeginScope(buffer, "frame");
+
+    // The GPU works out the frame's draws first, compute can't run inside a render pass
+    if (m_indirectDraws) {
+        const uint32_t cullScope = m_profiler.BeginScope(buffer, "cull");
+        RecordCullCommands(buffer, static_cast<uint32_t>(m_currentFrame));
+        m_profiler.EndScope(buffer, cullScope);
+    }
+
     // Drawing starts by beginning the render pass
     VkRenderPassBeginInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -1191,7 +2325,7 @@ void HelloTriangleApplication::RecordCommandBuffer(VkCommandBuffer buffer, uint3
 
     // Define the size of the render area
     renderPassInfo.renderArea.offset = { 0, 0 };
-    renderPassInfo.renderArea.extent = m_swapChainExtent;
+    renderPassInfo.renderArea.extent = m_renderExtent;
 
     // Define the clear colour of our frame
     std::vector<VkClearValue> clearValues(2);                   // Order of clear colours have to match attachments
@@ -1201,12 +2335,64 @@ void HelloTriangleApplication::RecordCommandBuffer(VkCommandBuffer buffer, uint3
     renderPassInfo.pClearValues = clearValues.data();
 
     // The render pass has now begun
-    vkCmdBeginRenderPass(buffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE); // Inline doesn't call secondary command buffers
+    const uint32_t passScope = m_profiler.BeginScope(buffer, "scene pass");
+    if (m_staticScene) {
+        // Everything in the pass is already recorded, so just replay it
+        vkCmdBeginRenderPass(buffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+        vkCmdExecuteCommands(buffer, 1, &m_sceneCommandBuffers[m_currentFrame]);
+    }
+    else if (m_recordThreadCount > 0) {
+        // The workers record the draws in parallel, this just stitches their secondaries together
+        vkCmdBeginRenderPass(buffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+        RecordThreadedDrawCommands(buffer, imageidx);
+    }
+    else {
+        vkCmdBeginRenderPass(buffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE); // Inline doesn't call secondary command buffers
+        RecordDrawCommands(buffer, static_cast<uint32_t>(m_currentFrame), 0, m_renderObjects.size());
+    }
 
+    // Now end the render pass
+    vkCmdEndRenderPass(buffer);
+    m_profiler.EndScope(buffer, passScope);
+
+    // Drawn at a lower resolution, so it still has to be scaled up into the image that's presented
+    if (IsUpscaling()) {
+        const uint32_t upscaleScope = m_profiler.BeginScope(buffer, "upscale");
+        RecordUpscale(buffer, imageidx);
+        m_profiler.EndScope(buffer, upscaleScope);
+    }
+    m_profiler.EndScope(buffer, frameScope);
+
+    // And finish recording the buffer
+    assert(vkEndCommandBuffer(buffer) == VK_SUCCESS);
+}
+// =================================================
+// Name: RecordDrawCommands
+// Desc: Everything inside the render pass for a slice of the draw list, recorded inline or into a secondary
+// Params: buffer, frame, firstObject, objectCount
+// Return: NONE
+void HelloTriangleApplication::RecordDrawCommands(VkCommandBuffer buffer, uint32_t frame, size_t firstObject, size_t objectCount)
+{
     // Bind the graphics pipeline
     // The second parameter specifies the pipeline type
     vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphicsPipeline);
 
+    // The pipeline's viewport and scissor are dynamic, so give them the current size here
+    VkViewport viewport{};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = static_cast<float>(m_renderExtent.width);
+    viewport.height = static_cast<float>(m_renderExtent.height);
+    viewport.minDepth = 0.0f;   // Values should be within 0 and 1
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(buffer, 0, 1, &viewport);
+
+    // In our case we don't want to clip any of it
+    VkRect2D scissor{};
+    scissor.offset = { 0, 0 };
+    scissor.extent = m_renderExtent;
+    vkCmdSetScissor(buffer, 0, 1, &scissor);
+
     VkBuffer vertexBuffers[] = { m_vertexBuffer }; // We only have one buffer
     VkDeviceSize offsets[] =   { 0 };              // And offset       
     // Bind our vertex buffers to the bindings specified
@@ -1214,22 +2400,322 @@ void HelloTriangleApplication::RecordCommandBuffer(VkCommandBuffer buffer, uint3
 
     vkCmdBindIndexBuffer(buffer, m_indexBuffer, 0, VK_INDEX_TYPE_UINT32);
 
-    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descriptorSets[m_currentFrame], 0, nullptr);
+    // The dynamic offset selects where in the uniform ring this frame's UBO was written
+    // The texture table goes with it, once for the whole pass whatever each object samples
+    const VkDescriptorSet sets[] = { m_descriptorSets[frame], m_textureSets[frame] };
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 2, sets,
+        1, &m_uniformOffsets[frame]);
+
+    // All that remains is to tell it to draw
+    if (m_indirectDraws) {
+        // The draws themselves were written into the frame's slice of the indirect buffer
+        const VkDeviceSize stride = sizeof(VkDrawIndexedIndirectCommand);
+        const VkDeviceSize offset = stride * (static_cast<VkDeviceSize>(frame) * MAX_OBJECTS + firstObject);
+        const uint32_t drawCount = static_cast<uint32_t>(objectCount);
+
+        if (UsesDrawCount()) {
+            // The cull pass packed the survivors at the front and counted them, so only those get drawn
+            m_cmdDrawIndexedIndirectCount(buffer, m_indirectBuffer, offset, m_drawCountBuffer, sizeof(uint32_t) * frame,
+                drawCount, static_cast<uint32_t>(stride));
+        }
+        else if (m_multiDrawIndirect) {
+            vkCmdDrawIndexedIndirect(buffer, m_indirectBuffer, offset, drawCount, static_cast<uint32_t>(stride));
+        }
+        else {
+            // One draw per call is all the device allows
+            for (uint32_t i = 0; i < drawCount; ++i)
+                vkCmdDrawIndexedIndirect(buffer, m_indirectBuffer, offset + stride * i, 1, static_cast<uint32_t>(stride));
+        }
+    }
+    else {
+        for (size_t i = firstObject; i < firstObject + objectCount; ++i) {
+            // The object's index goes in as the first instance, the shader reads its data with it
+            const MeshRange& mesh = m_meshes[m_renderObjects[i].mesh];
+            vkCmdDrawIndexed(buffer, mesh.indexCount, 1, mesh.firstIndex, mesh.vertexOffset, static_cast<uint32_t>(i));
+        }
+    }
 
-    // All that remains is to tell it to draw the triangle
+    // The instanced batches are only a few calls, so they just go with the first slice
+    if (firstObject == 0)
+        RecordInstancedDrawCommands(buffer);
+}
+// =================================================
+// Name: RecordInstancedDrawCommands
+// Desc: Draws every instanced batch with one call each, after RecordDrawCommands has set up the rest of the state
+// Params: buffer
+// Return: NONE
+void HelloTriangleApplication::RecordInstancedDrawCommands(VkCommandBuffer buffer)
+{
+    if (m_instanceBatches.empty())
+        return;
 
-    vkCmdDrawIndexed(buffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
-    // vkCmdDraw()
-    // vertexCount: Even though we don't have a vertex buffer, we technically still have 3 vertices to draw.
-    // instanceCount: Used for instanced rendering, use 1 if you're not doing that.
-    // firstVertex : Used as an offset into the vertex buffer, defines the lowest value of gl_VertexIndex.
-    // firstInstance : Used as an offset for instanced rendering, defines the lowest value of gl_InstanceIndex.
+    // Same layout, so the descriptor sets and dynamic state carry over
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_instancedPipeline);
 
-    // Now end the render pass
-    vkCmdEndRenderPass(buffer);
+    // Binding 0 is still the shared vertex buffer, binding 1 steps through the instances
+    VkBuffer vertexBuffers[] = { m_vertexBuffer, m_instanceBuffer };
+    VkDeviceSize offsets[] = { 0, 0 };
+    vkCmdBindVertexBuffers(buffer, 0, 2, vertexBuffers, offsets);
 
-    // And finish recording the buffer
+    for (const InstanceBatch& batch : m_instanceBatches) {
+        const MeshRange& mesh = m_meshes[batch.mesh];
+        vkCmdDrawIndexed(buffer, mesh.indexCount, batch.instanceCount, mesh.firstIndex, mesh.vertexOffset, batch.firstInstance);
+    }
+}
+// =================================================
+// Name: RecordSceneCommands
+// Desc: Records the frame's static mode secondary, only called when it's dirty
+// Params: frame
+// Return: NONE
+void HelloTriangleApplication::RecordSceneCommands(uint32_t frame)
+{
+    VkCommandBuffer buffer = m_sceneCommandBuffers[frame];
+    vkResetCommandBuffer(buffer, 0);
+
+    // A secondary has to say which render pass it will be executed inside
+    // Leaving the framebuffer out means it works with any of the swap chain's
+    VkCommandBufferInheritanceInfo inheritanceInfo{};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = m_renderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = VK_NULL_HANDLE;
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;  // Entirely inside a render pass
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    assert(vkBeginCommandBuffer(buffer, &beginInfo) == VK_SUCCESS);
+    RecordDrawCommands(buffer, frame, 0, m_renderObjects.size());
     assert(vkEndCommandBuffer(buffer) == VK_SUCCESS);
+
+    m_sceneDirty[frame] = false;
+    m_sceneUniformOffsets[frame] = m_uniformOffsets[frame];
+}
+// =================================================
+// Name: RecordThreadedDrawCommands
+// Desc: Splits the draw list between the worker threads, each recording its slice into its own secondary,
+//       then executes them all in order from the primary
+// Params: primary, imageidx
+// Return: NONE
+void HelloTriangleApplication::RecordThreadedDrawCommands(VkCommandBuffer primary, uint32_t imageidx)
+{
+    const uint32_t frame = static_cast<uint32_t>(m_currentFrame);
+    const uint32_t threadCount = m_recordThreads.GetCount();
+    const size_t objectCount = m_renderObjects.size();
+
+    std::function<void(uint32_t)> task = [&](uint32_t thread) {
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        // The frame's fence was waited on, so everything from this pool is finished with and can go in one reset
+        vkResetCommandPool(m_device, m_threadCommandPools[frame][thread], 0);
+
+        // Knowing the framebuffer as well lets the driver optimise a bit more
+        VkCommandBufferInheritanceInfo inheritanceInfo{};
+        inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritanceInfo.renderPass = m_renderPass;
+        inheritanceInfo.subpass = 0;
+        inheritanceInfo.framebuffer = m_swapChainFramebuffers[imageidx];
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+        // An even slice each, they differ by one object at most when it doesn't divide
+        const size_t first = objectCount * thread / threadCount;
+        const size_t last = objectCount * (thread + 1) / threadCount;
+
+        VkCommandBuffer buffer = m_threadCommandBuffers[frame][thread];
+        assert(vkBeginCommandBuffer(buffer, &beginInfo) == VK_SUCCESS);
+        RecordDrawCommands(buffer, frame, first, last - first);
+        assert(vkEndCommandBuffer(buffer) == VK_SUCCESS);
+
+        auto endTime = std::chrono::high_resolution_clock::now();
+        m_threadRecordTimes[thread] += std::chrono::duration<double, std::milli>(endTime - startTime).count();
+    };
+    m_recordThreads.Run(task);
+
+    // Executed in thread order, so the draws stay in draw list order
+    vkCmdExecuteCommands(primary, threadCount, m_threadCommandBuffers[frame].data());
+
+    // Every so often report how long each thread took on average
+    if (++m_recordTimedFrames == RECORD_TIMING_FRAMES) {
+        printf("Recording %zu objects on %u threads (avg ms/frame):", objectCount, threadCount);
+        for (uint32_t i = 0; i < threadCount; ++i)
+            printf(" %.3f", m_threadRecordTimes[i] / m_recordTimedFrames);
+        printf("\n");
+
+        std::fill(m_threadRecordTimes.begin(), m_threadRecordTimes.end(), 0.0);
+        m_recordTimedFrames = 0;
+    }
+}
+// =================================================
+// Name: CreateRecordThreads
+// Desc: Starts the recording workers and makes each one a command pool and secondary per frame in flight
+// Params: NONE
+// Return: NONE
+void HelloTriangleApplication::CreateRecordThreads()
+{
+    if (m_recordThreadCount == 0)
+        return;
+
+    // Don't go past what the CPU can actually run at once
+    const uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    m_recordThreadCount = std::min(m_recordThreadCount, hardwareThreads);
+
+    QueueFamilyIndices queueFamilyIndices = FindQueueFamilies(m_physicalDevice);
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = queueFamilyIndices.graphics_family.value();
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;     // Reset as a whole every frame, never per buffer
+
+    m_threadCommandPools.assign(m_framesInFlight, std::vector<VkCommandPool>(m_recordThreadCount));
+    m_threadCommandBuffers.assign(m_framesInFlight, std::vector<VkCommandBuffer>(m_recordThreadCount));
+
+    for (size_t frame = 0; frame < m_framesInFlight; ++frame) {
+        for (uint32_t thread = 0; thread < m_recordThreadCount; ++thread) {
+            assert(vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_threadCommandPools[frame][thread]) == VK_SUCCESS);
+
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = m_threadCommandPools[frame][thread];
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocInfo.commandBufferCount = 1;
+
+            assert(vkAllocateCommandBuffers(m_device, &allocInfo, &m_threadCommandBuffers[frame][thread]) == VK_SUCCESS);
+        }
+    }
+
+    m_threadRecordTimes.assign(m_recordThreadCount, 0.0);
+    m_recordThreads.Start(m_recordThreadCount);
+
+    printf("Recording draws on %u threads\n", m_recordThreadCount);
+}
+// =================================================
+// Name: DestroyRecordThreads
+// Desc: Stops the workers and destroys their pools (and so their command buffers)
+// Params: NONE
+// Return: NONE
+void HelloTriangleApplication::DestroyRecordThreads()
+{
+    m_recordThreads.Stop();
+
+    for (std::vector<VkCommandPool>& pools : m_threadCommandPools)
+        for (VkCommandPool pool : pools)
+            vkDestroyCommandPool(m_device, pool, nullptr);
+
+    m_threadCommandPools.clear();
+    m_threadCommandBuffers.clear();
+}
+// =================================================
+// Name: BuildScene
+// Desc: Fills the draw list with a grid of the model, centred on the origin
+// Params: NONE
+// Return: NONE
+void HelloTriangleApplication::BuildScene()
+{
+    const float spacing = 2.5f;
+    const float centre = (m_sceneGridSize - 1) * spacing * 0.5f;
+    // Without the bindless table only the first texture can be drawn with
+    const size_t textureCount = m_bindlessTextures ? m_textures.size() : 1;
+
+    m_renderObjects.clear();
+    m_renderObjects.reserve(m_sceneGridSize * m_sceneGridSize);
+    assert(m_sceneGridSize * m_sceneGridSize <= MAX_OBJECTS);
+
+    // A new set of nodes, every slice of the object buffer has to be written out in full again
+    m_sceneGraph.Clear();
+    m_sceneRoot = m_sceneGraph.AddNode(SceneGraph::NO_PARENT, glm::mat4(1.0f));
+    std::fill(m_objectSliceVersions.begin(), m_objectSliceVersions.end(), 0);
+
+    for (uint32_t y = 0; y < m_sceneGridSize; ++y) {
+        for (uint32_t x = 0; x < m_sceneGridSize; ++x) {
+            RenderObject object;
+            object.mesh = static_cast<uint32_t>(m_renderObjects.size() % m_meshes.size());     // Cycle through the meshes
+            object.texture = static_cast<uint32_t>(m_renderObjects.size() % textureCount);        // and the textures
+            object.position = glm::vec3(x * spacing - centre, y * spacing - centre, 0.0f);
+            object.node = m_sceneGraph.AddNode(m_sceneRoot, glm::translate(glm::mat4(1.0f), object.position));
+            m_renderObjects.push_back(object);
+        }
+    }
+
+    // The props sit in a grid underneath, every one a slightly different shade
+    m_instances.clear();
+    m_instanceBatches.clear();
+    if (m_propGridSize > 0) {
+        const float propCentre = (m_propGridSize - 1) * spacing * 0.5f;
+
+        std::vector<InstanceData> props;
+        props.reserve(m_propGridSize * m_propGridSize);
+        for (uint32_t y = 0; y < m_propGridSize; ++y) {
+            for (uint32_t x = 0; x < m_propGridSize; ++x) {
+                InstanceData prop;
+                prop.model = glm::translate(glm::mat4(1.0f), glm::vec3(x * spacing - propCentre, y * spacing - propCentre, -2.0f));
+                prop.tint = glm::vec4(0.5f + 0.5f * x / m_propGridSize, 0.5f + 0.5f * y / m_propGridSize, 1.0f, 1.0f);
+                prop.texture = static_cast<uint32_t>(props.size() % textureCount);
+                props.push_back(prop);
+            }
+        }
+
+        AddInstanceBatch(0, props);
+    }
+
+    MarkSceneDirty();
+}
+// =================================================
+// Name: AddInstanceBatch
+// Desc: Queues up copies of a mesh to be drawn in one call, CreateInstanceBuffer has to be called after adding them
+// Params: mesh, instances
+// Return: uint32_t - the batch's index
+uint32_t HelloTriangleApplication::AddInstanceBatch(uint32_t mesh, const std::vector<InstanceData>& instances)
+{
+    InstanceBatch batch;
+    batch.mesh = mesh;
+    batch.firstInstance = static_cast<uint32_t>(m_instances.size());
+    batch.instanceCount = static_cast<uint32_t>(instances.size());
+
+    m_instances.insert(m_instances.end(), instances.begin(), instances.end());
+
+    // Like the objects, the instances need the dequantisation folded into their transforms
+    if (m_compactVertices) {
+        const glm::mat4 dequantisation = GetDequantisation(mesh);
+        for (size_t i = batch.firstInstance; i < m_instances.size(); ++i)
+            m_instances[i].model = m_instances[i].model * dequantisation;
+    }
+
+    m_instanceBatches.push_back(batch);
+    return static_cast<uint32_t>(m_instanceBatches.size() - 1);
+}
+// =================================================
+// Name: CreateInstanceBuffer
+// Desc: Uploads every batch's instances into one device local vertex buffer, replacing the last one
+// Params: NONE
+// Return: NONE
+void HelloTriangleApplication::CreateInstanceBuffer()
+{
+    if (m_instanceBuffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(m_device, m_instanceBuffer, nullptr);
+        m_allocator.Free(m_instanceMemory);
+        m_instanceBuffer = VK_NULL_HANDLE;
+    }
+
+    if (m_instances.empty())
+        return;
+
+    // It's just another vertex buffer as far as the upload is concerned
+    CreateVertexIndexBuffer(m_instances, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, m_instanceBuffer, m_instanceMemory);
+}
+// =================================================
+// Name: MarkSceneDirty
+// Desc: Call whenever anything the static mode secondaries recorded changes (objects, the swap chain)
+//       Each one is re-recorded the next time its frame comes round, when it's no longer in use
+// Params: NONE
+// Return: NONE
+void HelloTriangleApplication::MarkSceneDirty()
+{
+    std::fill(m_sceneDirty.begin(), m_sceneDirty.end(), true);
 }
 // =================================================
 // Name: CheckDeviceExtensionSupport
@@ -1280,17 +2766,31 @@ VkSurfaceFormatKHR HelloTriangleApplication::ChooseSwapSurfaceFormat(const std::
 }
 // =================================================
 // Name: ChooseSwapPresentMode
-// Desc: Choose the swap mode between the different frames
+// Desc: Choose the swap mode between the different frames, in the latency mode's order of preference
+//       IMMEDIATE shows a frame the moment it's done (it can tear), MAILBOX replaces the waiting one without tearing
 // Params: available_present_modes
 // Return: VkSurfaceFormatKHR
 VkPresentModeKHR HelloTriangleApplication::ChooseSwapPresentMode(const std::vector<VkPresentModeKHR>& available_present_modes)
 {
-    for (const auto& availablePresentMode : available_present_modes) {
-        if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
-            return availablePresentMode;
-        }
+    std::vector<VkPresentModeKHR> preferred;
+    switch (m_latencyMode) {
+    case LatencyMode::LowLatency:
+        preferred = { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR };
+        break;
+    case LatencyMode::Throughput:
+        preferred = { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR };
+        break;
+    default:
+        preferred = { VK_PRESENT_MODE_MAILBOX_KHR };
+        break;
     }
 
+    for (VkPresentModeKHR mode : preferred) {
+        if (std::find(available_present_modes.begin(), available_present_modes.end(), mode) != available_present_modes.end())
+            return mode;
+    }
+
+    // Always supported
     return VK_PRESENT_MODE_FIFO_KHR;
 }
 // =================================================
@@ -1364,6 +2864,8 @@ void HelloTriangleApplication::CreateLogicalDevice()
 
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
     std::set<uint32_t> uniqueQueueFamilies = { indices.graphics_family.value(), indices.present_family.value() };
+    if (indices.transfer_family.has_value())
+        uniqueQueueFamilies.insert(indices.transfer_family.value());
 
     // Assign priorities to queues to influence the scheduling of command buffer execution
     float queuePriority = 1.0f;                                 // Numbers should be between 0 and 1
@@ -1386,9 +2888,52 @@ void HelloTriangleApplication::CreateLogicalDevice()
     deviceFeatures.samplerAnisotropy = m_AnisotropyEnabled;
     deviceFeatures.sampleRateShading = VK_TRUE;
 
+    // Indirect drawing passes each object's index as firstInstance, which isn't allowed without drawIndirectFirstInstance
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(m_physicalDevice, &supportedFeatures);
+    m_indirectDraws = m_indirectDraws && supportedFeatures.drawIndirectFirstInstance;
+    m_multiDrawIndirect = m_indirectDraws && supportedFeatures.multiDrawIndirect;
+    deviceFeatures.drawIndirectFirstInstance = m_indirectDraws;
+    deviceFeatures.multiDrawIndirect = m_multiDrawIndirect;
+
+    // Both compact vertex formats are almost always fetchable, but check rather than assume
+    VkFormatProperties positionFormat, texCoordFormat;
+    vkGetPhysicalDeviceFormatProperties(m_physicalDevice, VK_FORMAT_R16G16B16A16_UNORM, &positionFormat);
+    vkGetPhysicalDeviceFormatProperties(m_physicalDevice, VK_FORMAT_R16G16_SFLOAT, &texCoordFormat);
+    m_compactVertices = m_compactVertices && (positionFormat.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT) &&
+        (texCoordFormat.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT);
+
+    // Block compressed textures, BC on desktop and ASTC on most mobile, whichever the device has
+    deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+    deviceFeatures.textureCompressionASTC_LDR = supportedFeatures.textureCompressionASTC_LDR;
+
+    // The count variant is core in 1.2, we're on 1.0 so it comes from the extension
+    std::vector<const char*> extensions;
+    for (const char* extension : m_deviceExtensions) {
+        // Without a surface there's no swap chain to make
+        if (!m_headless || strcmp(extension, VK_KHR_SWAPCHAIN_EXTENSION_NAME) != 0)
+            extensions.push_back(extension);
+    }
+    const bool drawIndirectCount = m_multiDrawIndirect && IsDeviceExtensionAvailable(m_physicalDevice, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    if (drawIndirectCount)
+        extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+
+    // Descriptor indexing has no VkPhysicalDeviceFeatures entry, its features are chained on instead
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures;
+    CheckDescriptorIndexing(extensions, indexingFeatures);
+
+    // The driver's own heap budgets and usage, read through vkGetPhysicalDeviceMemoryProperties2
+    // Without it the allocator estimates them from the heap sizes and its own blocks
+    m_memoryBudget = IsInstanceExtensionAvailable(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) &&
+        vkGetInstanceProcAddr(m_instance, "vkGetPhysicalDeviceMemoryProperties2KHR") != nullptr &&
+        IsDeviceExtensionAvailable(m_physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (m_memoryBudget)
+        extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
     // Start filling in the main VkDeviceCreateInfo structure
     VkDeviceCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    createInfo.pNext = m_bindlessTextures ? &indexingFeatures : nullptr;
     // Pointers to the queue creation info and device features struct
     createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
     createInfo.pQueueCreateInfos = queueCreateInfos.data();
@@ -1396,8 +2941,8 @@ void HelloTriangleApplication::CreateLogicalDevice()
 
     // VkInstanceCreateInfo struct and requires you to specify extensions and validation layers
     // (The difference is that these are device specific this time)
-    createInfo.enabledExtensionCount = static_cast<uint32_t>(m_deviceExtensions.size());
-    createInfo.ppEnabledExtensionNames = m_deviceExtensions.data();
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+    createInfo.ppEnabledExtensionNames = extensions.data();
 
     // This step is no longer required but can be added for backwards compatability
     // ---------------
@@ -1413,10 +2958,22 @@ void HelloTriangleApplication::CreateLogicalDevice()
     // Instantiate the logical device, and check it was successful
     assert(vkCreateDevice(m_physicalDevice, &createInfo, nullptr, &m_device) == VK_SUCCESS);
 
+    if (drawIndirectCount)
+        m_cmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(m_device, "vkCmdDrawIndexedIndirectCountKHR");
+
+    printf("Drawing with %s\n", m_cmdDrawIndexedIndirectCount != nullptr ? "vkCmdDrawIndexedIndirectCount" :
+        m_multiDrawIndirect ? "multi draw vkCmdDrawIndexedIndirect" : m_indirectDraws ? "single draw vkCmdDrawIndexedIndirect" : "vkCmdDrawIndexed");
+
     // Retrieve queue handles for each queue family
     // We only have one queue so we'll just use 0
     vkGetDeviceQueue(m_device, indices.graphics_family.value(), 0, &m_graphicsQueue);
     vkGetDeviceQueue(m_device, indices.present_family.value(), 0, &m_presentQueue);
+
+    // Uploads fall back to the graphics queue when there's no separate transfer family
+    if (indices.transfer_family.has_value())
+        vkGetDeviceQueue(m_device, indices.transfer_family.value(), 0, &m_transferQueue);
+    else
+        m_transferQueue = m_graphicsQueue;
 }
 //==================================================================================================
 //  Debug Functions
@@ -1458,15 +3015,23 @@ bool HelloTriangleApplication::CheckValidationLayerSupport() const
 // Return: const char vector
 std::vector<const char*> HelloTriangleApplication::GetRequiredExtensions() const
 {
-    uint32_t glfwExtensionCount = 0;
-    const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    std::vector<const char*> extensions;
 
-    std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+    // The surface extensions, not wanted (and GLFW isn't initialised to ask) headless
+    if (!m_headless) {
+        uint32_t glfwExtensionCount = 0;
+        const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+    }
 
     if (m_enableValidationLayers) {
         extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
     }
 
+    // On 1.0 the descriptor indexing features and limits can only be asked for through this
+    if (IsInstanceExtensionAvailable(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME))
+        extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+
     return extensions;
 }
 // =================================================
@@ -1530,44 +3095,108 @@ void HelloTriangleApplication::SetupDebugMessenger() {
 //==================================================================================================
 //  Graphics Pipeline
 //==================================================================================================
-static std::vector<char> readFile(const std::string& filename) {
-    std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-    // ate: Start reading at the end of the file
-	// binary: Read the file as binary file(avoid text transformations)
-
-    assert(file.is_open()); // Make sure we opened the file
+// =================================================
+// Name: ReadShaderFiles
+// Desc: Gets every variant in SHADER_VARIANTS into m_shaderCode, on its own thread while the device is being made
+//       With a warm cache that's just reading the SPIR-V, otherwise whatever changed is compiled first
+// Params: NONE
+// Return: double - how long it took (ms)
+double HelloTriangleApplication::ReadShaderFiles()
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
 
-    // We start from the back so we can allocate a buffer from the starting read position
-    size_t fileSize = (size_t)file.tellg();
-    std::vector<char> buffer(fileSize);
+    for (const ShaderVariant& variant : SHADER_VARIANTS) {
+        // A failed one is left for GetShaderCode to try again, if it's ever actually wanted
+        std::vector<char> code = m_shaderCompiler.Get(variant);
+        if (!code.empty())
+            m_shaderCode[variant.name] = std::move(code);
+    }
 
-    // Go back to front reading all the data
-    file.seekg(0);
-    file.read(buffer.data(), fileSize);
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+}
+// =================================================
+// Name: FindShaderVariant
+// Desc: The entry in SHADER_VARIANTS with the name, any thread
+// Params: name
+// Return: const ShaderVariant&
+const ShaderVariant& HelloTriangleApplication::FindShaderVariant(const std::string& name) const
+{
+    for (const ShaderVariant& variant : SHADER_VARIANTS) {
+        if (variant.name == name)
+            return variant;
+    }
 
-    file.close();   // Close the file
+    assert(false && "Shader isn't in SHADER_VARIANTS");
+    return SHADER_VARIANTS.front();
+}
+// =================================================
+// Name: GetShaderCode
+// Desc: Hands over a shader's SPIR-V from the startup compiles, waiting for them the first time
+//       Anything made later goes back to the compiler, which will usually find it in the cache
+// Params: name
+// Return: std::vector<char>
+std::vector<char> HelloTriangleApplication::GetShaderCode(const std::string& name)
+{
+    if (m_shaderRead.valid())
+        m_asyncPhases.push_back({ "shaders", m_shaderRead.get() });
+
+    auto found = m_shaderCode.find(name);
+    if (found == m_shaderCode.end()) {
+        std::vector<char> code = m_shaderCompiler.Get(FindShaderVariant(name));
+        assert(!code.empty());      // Nothing to make the pipeline with, the errors have been printed
+        return code;
+    }
 
-    // Return all the data we extracted
-    return buffer;
+    std::vector<char> code = std::move(found->second);
+    m_shaderCode.erase(found);
+    return code;
+}
+// =================================================
+// Name: LoadGraphicsShaders
+// Desc: The SPIR-V for the vertex, instanced and fragment shaders this device uses, with the feature toggles
+//       At startup they come from the startup compiles (main thread), otherwise straight from the compiler (any thread)
+//       Any of them can be empty if it's not a startup load, which a rebuild checks for
+// Params: startup, useTexture, useVertexColour
+// Return: GraphicsShaders
+HelloTriangleApplication::GraphicsShaders HelloTriangleApplication::LoadGraphicsShaders(bool startup, bool useTexture, bool useVertexColour)
+{
+    // The compact variants don't read the vertex colour, the compact layout doesn't have one
+    const std::string names[] = {
+        m_compactVertices ? "Vertex_Shader_Compact.spv" : "Vertex_Shader.spv",
+        m_compactVertices ? "Instanced_Shader_Compact.spv" : "Instanced_Shader.spv",
+        m_bindlessTextures ? "Frag_Shader_Bindless.spv" : "Frag_Shader.spv"
+    };
+    std::vector<char> code[3];
+    for (int i = 0; i < 3; ++i)
+        code[i] = startup ? GetShaderCode(names[i]) : m_shaderCompiler.Get(FindShaderVariant(names[i]));
+
+    GraphicsShaders shaders;
+    shaders.vertex = std::move(code[0]);
+    shaders.instanced = std::move(code[1]);
+    shaders.fragment = std::move(code[2]);
+    shaders.useTexture = useTexture ? VK_TRUE : VK_FALSE;
+    shaders.useVertexColour = useVertexColour ? VK_TRUE : VK_FALSE;
+    return shaders;
 }
 void HelloTriangleApplication::CreateDescriptorSetLayouts()
 {
     VkDescriptorSetLayoutBinding uboLayout;
     uboLayout.binding = 0;                                          // Binding used in the shader
     uboLayout.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;              // And which shader it is
-    uboLayout.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;   // What we want to bind
+    uboLayout.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;   // What we want to bind (offset given at bind time)
     uboLayout.descriptorCount = 1;                                  // And how many of that thing we want to bind
     uboLayout.pImmutableSamplers = nullptr;                         // For image sampling (we don't want in this case)
 
-    VkDescriptorSetLayoutBinding samplerLayoutBinding;
-    samplerLayoutBinding.binding = 1;
-    samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-    samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    samplerLayoutBinding.descriptorCount = 1;
-    samplerLayoutBinding.pImmutableSamplers = nullptr;
+    // Every object's data, indexed by the instance index in the vertex shader
+    VkDescriptorSetLayoutBinding objectLayoutBinding;
+    objectLayoutBinding.binding = 2;
+    objectLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    objectLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    objectLayoutBinding.descriptorCount = 1;
+    objectLayoutBinding.pImmutableSamplers = nullptr;
 
-    const std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayout, samplerLayoutBinding };
+    // Binding 1 was the texture, it's in its own set now
+    const std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayout, objectLayoutBinding };
 
     VkDescriptorSetLayoutCreateInfo layoutInfo;
     layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -1578,13 +3207,90 @@ void HelloTriangleApplication::CreateDescriptorSetLayouts()
 
     assert(vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &m_descriptorSetLayout) == VK_SUCCESS);
 
+    // The texture table, set 1. An update after bind set can't have the dynamic UBO in it, hence the separate set
+    VkDescriptorSetLayoutBinding textureBinding;
+    textureBinding.binding = 0;
+    textureBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    textureBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    textureBinding.descriptorCount = m_textureSlots;
+    textureBinding.pImmutableSamplers = nullptr;
+
+    // Slots past the last texture are never written, and writing one doesn't disturb what's already recorded
+    const VkDescriptorBindingFlagsEXT textureFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT;
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlags{};
+    bindingFlags.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+    bindingFlags.bindingCount = 1;
+    bindingFlags.pBindingFlags = &textureFlags;
+
+    layoutInfo.pNext = m_bindlessTextures ? &bindingFlags : nullptr;
+    layoutInfo.flags = m_bindlessTextures ? VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT : 0;
+    layoutInfo.bindingCount = 1;
+    layoutInfo.pBindings = &textureBinding;
+
+    assert(vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &m_textureSetLayout) == VK_SUCCESS);
+    layoutInfo.pNext = nullptr;
+    layoutInfo.flags = 0;
+
+    // The cull pass: the UBO for the frustum, then objects, meshes, draws and draw counts
+    std::vector<VkDescriptorSetLayoutBinding> cullBindings(5);
+    for (uint32_t binding = 0; binding < cullBindings.size(); ++binding) {
+        cullBindings[binding].binding = binding;
+        cullBindings[binding].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        cullBindings[binding].descriptorType = binding == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        cullBindings[binding].descriptorCount = 1;
+        cullBindings[binding].pImmutableSamplers = nullptr;
+    }
+
+    layoutInfo.bindingCount = static_cast<uint32_t>(cullBindings.size());
+    layoutInfo.pBindings = cullBindings.data();
+
+    assert(vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &m_cullSetLayout) == VK_SUCCESS);
 }
 // =================================================
-// Name: CreateGraphicsPipeline
-// Desc: Sets up the grapics pipeline
+// Name: CreatePipelineLayouts
+// Desc: Makes the graphics and cull pipeline layouts, once. Every pipeline (and every rebuild of one) shares them,
+//       nothing in them depends on the sample count or the shaders' code
 // Params: NONE
 // Return: NONE
-void HelloTriangleApplication::CreateGraphicsPipeline()
+void HelloTriangleApplication::CreatePipelineLayouts()
+{
+    // The structure also specifies push constants
+    // None are needed, the per object data is in a storage buffer so indirect draws can reach it
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    // The per frame buffers, then the texture table
+    const VkDescriptorSetLayout setLayouts[] = { m_descriptorSetLayout, m_textureSetLayout };
+    pipelineLayoutInfo.setLayoutCount = 2;
+    pipelineLayoutInfo.pSetLayouts = setLayouts;
+    pipelineLayoutInfo.pushConstantRangeCount = 0;
+    pipelineLayoutInfo.pPushConstantRanges = nullptr;
+
+    assert(vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &m_pipelineLayout) == VK_SUCCESS);
+
+    // Which slice and what to do go in as push constants
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(CullConstants);
+
+    VkPipelineLayoutCreateInfo cullLayoutInfo{};
+    cullLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    cullLayoutInfo.setLayoutCount = 1;
+    cullLayoutInfo.pSetLayouts = &m_cullSetLayout;
+    cullLayoutInfo.pushConstantRangeCount = 1;
+    cullLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    assert(vkCreatePipelineLayout(m_device, &cullLayoutInfo, nullptr, &m_cullPipelineLayout) == VK_SUCCESS);
+}
+// =================================================
+// Name: CreateGraphicsPipeline
+// Desc: Sets up the grapics pipeline and its instanced twin for a render pass and sample count
+//       Only reads what's fixed once the device is made, so it's safe on a worker thread (the pipeline cache is
+//       internally synchronised)
+// Params: shaders, renderPass, samples, graphicsPipeline, instancedPipeline
+// Return: NONE
+void HelloTriangleApplication::CreateGraphicsPipeline(const GraphicsShaders& shaders, VkRenderPass renderPass, VkSampleCountFlagBits samples,
+                                                      VkPipeline& graphicsPipeline, VkPipeline& instancedPipeline) const
 {
 // index/          [FIXED]     |----------[PROGRAMMABLE]----------|      [FIXED]    [PROGRAMMABLE]  [FIXED]
 // vertex  |_____   input   ___ vertex ___ tesselation ___ geometry ___ rasteriser ___ fragment ___ colour  _____| frame
@@ -1600,13 +3306,9 @@ void HelloTriangleApplication::CreateGraphicsPipeline()
 // Shader code in Vulkan has to be specified in a bytecode format as opposed to hlsl / glsl
 // This bytecode format is called SPIR-V (we can however use glslc.exe to code and then compile into SPIR-V)
 
-    // Load our shaders
-    std::vector<char> vertShaderCode = readFile("Vertex_Shader.spv");
-    std::vector<char> fragShaderCode = readFile("Frag_Shader.spv");
-
-    // Create them from the loaded data
-    VkShaderModule vertShaderModule = CreateShaderModule(vertShaderCode);
-    VkShaderModule fragShaderModule = CreateShaderModule(fragShaderCode);
+    // Create our shaders from the loaded data
+    VkShaderModule vertShaderModule = CreateShaderModule(shaders.vertex);
+    VkShaderModule fragShaderModule = CreateShaderModule(shaders.fragment);
 
     // To use the shaders assign them to a specific pipeline stage
     VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
@@ -1626,13 +3328,27 @@ void HelloTriangleApplication::CreateGraphicsPipeline()
     fragShaderStageInfo.module = fragShaderModule;
     fragShaderStageInfo.pName = "main";
 
+    // The fragment shader's feature toggles, baked in here so the driver can strip out whatever's turned off
+    const VkBool32 specData[] = { shaders.useTexture, shaders.useVertexColour };
+    const VkSpecializationMapEntry specEntries[] = {
+        { 0, 0, sizeof(VkBool32) },                     // USE_TEXTURE
+        { 1, sizeof(VkBool32), sizeof(VkBool32) }       // USE_VERTEX_COLOUR
+    };
+    VkSpecializationInfo specInfo{};
+    specInfo.mapEntryCount = 2;
+    specInfo.pMapEntries = specEntries;
+    specInfo.dataSize = sizeof(specData);
+    specInfo.pData = specData;
+    fragShaderStageInfo.pSpecializationInfo = &specInfo;
+
     // Make an array containing our shader stages
     VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
 
     // -=-=-=-=-=-=-=-=-=- VERTEX INPUT AND ASSEMBLY -=-=-=-=-=-=-=-=-=-
 
-    VkVertexInputBindingDescription bindingDescription = Vertex::GetBindingDescription();
-    std::vector<VkVertexInputAttributeDescription> attributeDescriptions = Vertex::GetAttributeDescriptions();
+    VkVertexInputBindingDescription bindingDescription = m_compactVertices ? CompactVertex::GetBindingDescription() : Vertex::GetBindingDescription();
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions =
+        m_compactVertices ? CompactVertex::GetAttributeDescriptions() : Vertex::GetAttributeDescriptions();
 
     // Describes the format of the vertex data that will be passed to the vertex shader
     // We'll leave it for now 
@@ -1653,27 +3369,14 @@ void HelloTriangleApplication::CreateGraphicsPipeline()
     // -=-=-=-=-=-=-=-=-=- VIEWPORTS AND SCISSORS -=-=-=-=-=-=-=-=-=-
 
     // Viewport describes the region of the framebuffer that the output will be rendered to
-    VkViewport viewport{};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = static_cast<float>(m_swapChainExtent.width);
-    viewport.height = static_cast<float>(m_swapChainExtent.height);
-    viewport.minDepth = 0.0f;   // Values should be within 0 and 1
-    viewport.maxDepth = 1.0f;
-
     // The scissor clips part of viewport
-    // In our case we don't want to clip any of it
-    VkRect2D scissor{};
-    scissor.offset = { 0, 0 };
-    scissor.extent = m_swapChainExtent;
-
-    // Combine the viewport and scissor to one struct
+    // Both are dynamic state, set in RecordCommandBuffer, so the pipeline doesn't depend on the window size
     VkPipelineViewportStateCreateInfo viewportState{};
     viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     viewportState.viewportCount = 1;    // It's possible to use multiple on some GPUs
-    viewportState.pViewports = &viewport;
+    viewportState.pViewports = nullptr; // Ignored as it's dynamic
     viewportState.scissorCount = 1;
-    viewportState.pScissors = &scissor;
+    viewportState.pScissors = nullptr;
 
     // -=-=-=-=-=-=-=-=-=- RASTERISER -=-=-=-=-=-=-=-=-=-
 
@@ -1711,8 +3414,8 @@ void HelloTriangleApplication::CreateGraphicsPipeline()
     // This struct configures multisampling. Used for anti-aliasing
     VkPipelineMultisampleStateCreateInfo multisampling{};
     multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    multisampling.sampleShadingEnable = VK_TRUE;        // Enables shading in the pipeline
-    multisampling.rasterizationSamples = m_msaaSamples;
+    multisampling.sampleShadingEnable = samples != VK_SAMPLE_COUNT_1_BIT;    // Enables shading in the pipeline (nothing to do at 1x)
+    multisampling.rasterizationSamples = samples;
     multisampling.minSampleShading = .2f; // Optional - The minimum fraction for sample shading (closer to 1 is smoother)
     multisampling.pSampleMask = nullptr; // Optional
     multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
@@ -1764,10 +3467,10 @@ void HelloTriangleApplication::CreateGraphicsPipeline()
     // -=-=-=-=-=-=-=-=-=- DYNAMIC STATE -=-=-=-=-=-=-=-=-=-
 
     // Used for specifing parts of the pipeline we can change at runtime
-    // This step is optional
+    // The viewport and scissor change with the window, so they're set when recording instead
     VkDynamicState dynamicStates[] = {
     VK_DYNAMIC_STATE_VIEWPORT,
-    VK_DYNAMIC_STATE_LINE_WIDTH
+    VK_DYNAMIC_STATE_SCISSOR
     };
 
     VkPipelineDynamicStateCreateInfo dynamicState{};
@@ -1777,18 +3480,6 @@ void HelloTriangleApplication::CreateGraphicsPipeline()
 
     // -=-=-=-=-=-=-=-=-=- PIPELINE SETUP -=-=-=-=-=-=-=-=-=-
 
-    // The structure also specifies push constants, which are another way of passing dynamic values to shaders
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 1; 
-    pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayout; 
-    pipelineLayoutInfo.pushConstantRangeCount = 0; // Optional
-    pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
-
-    // -=-=-=-=-=-=-=-=-=- PIPELINE SETUP -=-=-=-=-=-=-=-=-=-
-
-    assert(vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &m_pipelineLayout) == VK_SUCCESS);
-
     // Now create the pipeline
     VkGraphicsPipelineCreateInfo pipelineInfo{};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
@@ -1803,13 +3494,13 @@ void HelloTriangleApplication::CreateGraphicsPipeline()
     pipelineInfo.pMultisampleState = &multisampling;
     pipelineInfo.pDepthStencilState = &depthStencil;
     pipelineInfo.pColorBlendState = &colorBlending;
-    pipelineInfo.pDynamicState = nullptr; // Optional
+    pipelineInfo.pDynamicState = &dynamicState;
 
-    // Describes the layout
+    // Describes the layout, made once in CreatePipelineLayouts and shared by every pass variant
     pipelineInfo.layout = m_pipelineLayout;
 
     // Reference the render pass and the index of the sub pass where this graphics pipeline will be used
-    pipelineInfo.renderPass = m_renderPass;
+    pipelineInfo.renderPass = renderPass;
     pipelineInfo.subpass = 0;
 
     // Vulkan allows to make subpipelines from this one
@@ -1817,21 +3508,67 @@ void HelloTriangleApplication::CreateGraphicsPipeline()
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
     pipelineInfo.basePipelineIndex = -1; // Optional
 
-    // Make it
-    assert(vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_graphicsPipeline) == VK_SUCCESS);
+    // Make it, through the cache so the driver can skip compiling anything it's seen before
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    assert(vkCreateGraphicsPipelines(m_device, m_pipelineCache, 1, &pipelineInfo, nullptr, &graphicsPipeline) == VK_SUCCESS);
+
+    // The instanced variant only swaps the vertex shader and adds the per instance binding
+    VkShaderModule instancedShaderModule = CreateShaderModule(shaders.instanced);
+    shaderStages[0].module = instancedShaderModule;
+
+    const VkVertexInputBindingDescription instancedBindings[] = { bindingDescription, InstanceData::GetBindingDescription() };
+    std::vector<VkVertexInputAttributeDescription> instancedAttributes = attributeDescriptions;
+    const std::vector<VkVertexInputAttributeDescription> instanceAttributes = InstanceData::GetAttributeDescriptions();
+    instancedAttributes.insert(instancedAttributes.end(), instanceAttributes.begin(), instanceAttributes.end());
+
+    vertexInputInfo.vertexBindingDescriptionCount = 2;
+    vertexInputInfo.pVertexBindingDescriptions = instancedBindings;
+    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(instancedAttributes.size());
+    vertexInputInfo.pVertexAttributeDescriptions = instancedAttributes.data();
+
+    assert(vkCreateGraphicsPipelines(m_device, m_pipelineCache, 1, &pipelineInfo, nullptr, &instancedPipeline) == VK_SUCCESS);
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    printf("Graphics pipelines created in %.2f ms\n", std::chrono::duration<double, std::milli>(endTime - startTime).count());
 
     // -=-=-=-=-=-=-=-=-=- CLEANUP -=-=-=-=-=-=-=-=-=-
 
     // Cleanup should then happen at the end of the function
     vkDestroyShaderModule(m_device, fragShaderModule, nullptr);
     vkDestroyShaderModule(m_device, vertShaderModule, nullptr);
+    vkDestroyShaderModule(m_device, instancedShaderModule, nullptr);
+}
+// =================================================
+// Name: CreateCullPipeline
+// Desc: Sets up the compute pipeline for the frustum culling pass, safe on a worker thread like the graphics ones
+// Params: code, pipeline
+// Return: NONE
+void HelloTriangleApplication::CreateCullPipeline(const std::vector<char>& code, VkPipeline& pipeline) const
+{
+    VkShaderModule cullShaderModule = CreateShaderModule(code);
+
+    VkPipelineShaderStageCreateInfo stageInfo{};
+    stageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    stageInfo.module = cullShaderModule;
+    stageInfo.pName = "main";
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage = stageInfo;
+    pipelineInfo.layout = m_cullPipelineLayout;
+
+    assert(vkCreateComputePipelines(m_device, m_pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) == VK_SUCCESS);
+
+    vkDestroyShaderModule(m_device, cullShaderModule, nullptr);
 }
 // =================================================
 // Name: CreateShaderModule
 // Desc: Create a Vulkan shader object from the file data we read
 // Params: code
 // Return: VkShaderModule
-VkShaderModule HelloTriangleApplication::CreateShaderModule(const std::vector<char>& code)
+VkShaderModule HelloTriangleApplication::CreateShaderModule(const std::vector<char>& code) const
 {
     VkShaderModuleCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
@@ -1845,22 +3582,173 @@ VkShaderModule HelloTriangleApplication::CreateShaderModule(const std::vector<ch
 
     return shaderModule;
 }
+// =================================================
+// Name: UpdateShaderReload
+// Desc: Frees the pipelines the last reload replaced once nothing in flight uses them, swaps in a finished rebuild and
+//       every SHADER_POLL_INTERVAL frames looks for saved sources, starting a rebuild of whatever uses them
+//       Never waits, a rebuild that's still going is just looked at again next frame. Off headless like the quality
+// Params: NONE
+// Return: NONE
+void HelloTriangleApplication::UpdateShaderReload()
+{
+    if (m_headless)
+        return;
+
+    for (size_t i = 0; i < m_retiredPipelines.size();) {
+        if (m_frameNumber < m_retiredPipelines[i].freeFrame) {
+            ++i;
+            continue;
+        }
+        vkDestroyPipeline(m_device, m_retiredPipelines[i].pipeline, nullptr);
+        m_retiredPipelines.erase(m_retiredPipelines.begin() + i);
+    }
+
+    if (m_pipelineRebuild.valid()) {
+        if (m_pipelineRebuild.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return;
+
+        PipelineRebuild rebuild = m_pipelineRebuild.get();
+        if (rebuild.failed) {
+            printf("Shader reload failed, keeping the current pipelines\n");
+        }
+        else {
+            // The frames in flight might still be drawing with the old ones
+            const uint64_t freeFrame = m_frameNumber + m_framesInFlight;
+            for (const PassVariant& rebuilt : rebuild.passVariants) {
+                for (PassVariant& variant : m_passVariants) {
+                    if (variant.renderPass != rebuilt.renderPass)
+                        continue;
+
+                    m_retiredPipelines.push_back({ variant.graphicsPipeline, freeFrame });
+                    m_retiredPipelines.push_back({ variant.instancedPipeline, freeFrame });
+                    variant.graphicsPipeline = rebuilt.graphicsPipeline;
+                    variant.instancedPipeline = rebuilt.instancedPipeline;
+                    if (variant.renderPass == m_renderPass) {
+                        m_graphicsPipeline = variant.graphicsPipeline;
+                        m_instancedPipeline = variant.instancedPipeline;
+                    }
+                }
+            }
+            if (rebuild.graphics) {
+                m_graphicsShaders = std::move(rebuild.shaders);
+                // A pass variant made while it ran got the old shaders, it's caught by another go
+                if (m_passVariants.size() > rebuild.passVariants.size())
+                    m_graphicsRebuildPending = true;
+            }
+            if (rebuild.cull) {
+                m_retiredPipelines.push_back({ m_cullPipeline, freeFrame });
+                m_cullPipeline = rebuild.cullPipeline;
+            }
+
+            // The static mode secondaries have the old pipelines baked in
+            MarkSceneDirty();
+            printf("Shaders reloaded: %s%s%s\n", rebuild.graphics ? "graphics" : "", rebuild.graphics && rebuild.cull ? ", " : "",
+                rebuild.cull ? "cull" : "");
+        }
+    }
+
+    if (++m_framesSinceShaderPoll >= SHADER_POLL_INTERVAL) {
+        m_framesSinceShaderPoll = 0;
+        // The compute source only feeds the cull pipeline, everything else is in the graphics ones
+        for (const std::string& source : m_shaderCompiler.PollChanges()) {
+            if (std::filesystem::path(source).extension() == ".comp")
+                m_cullRebuildPending = true;
+            else
+                m_graphicsRebuildPending = true;
+        }
+    }
+
+    if (m_graphicsRebuildPending || m_cullRebuildPending)
+        StartPipelineRebuild();
+}
+// =================================================
+// Name: StartPipelineRebuild
+// Desc: Compiles the shaders and makes the pipelines for what's pending on a worker, for every pass variant made so far
+//       Nothing current is touched, UpdateShaderReload swaps the results in. All the shaders compile or nothing's made
+// Params: NONE
+// Return: NONE
+void HelloTriangleApplication::StartPipelineRebuild()
+{
+    const bool graphics = m_graphicsRebuildPending;
+    const bool cull = m_cullRebuildPending;
+    m_graphicsRebuildPending = false;
+    m_cullRebuildPending = false;
+
+    // Copies, so the worker never reads anything the main thread changes
+    std::vector<PassVariant> passVariants = m_passVariants;
+    const bool useTexture = m_useTexture;
+    const bool useVertexColour = m_useVertexColour;
+
+    m_pipelineRebuild = std::async(std::launch::async, [this, graphics, cull, passVariants, useTexture, useVertexColour]() mutable {
+        PipelineRebuild rebuild;
+        rebuild.graphics = graphics;
+        rebuild.cull = cull;
+
+        std::vector<char> cullCode;
+        if (graphics)
+            rebuild.shaders = LoadGraphicsShaders(false, useTexture, useVertexColour);
+        if (cull)
+            cullCode = m_shaderCompiler.Get(FindShaderVariant("Cull_Shader.spv"));
+        if ((graphics && (rebuild.shaders.vertex.empty() || rebuild.shaders.instanced.empty() || rebuild.shaders.fragment.empty())) ||
+            (cull && cullCode.empty())) {
+            rebuild.failed = true;
+            return rebuild;
+        }
+
+        if (graphics) {
+            for (PassVariant& variant : passVariants)
+                CreateGraphicsPipeline(rebuild.shaders, variant.renderPass, variant.samples, variant.graphicsPipeline, variant.instancedPipeline);
+            rebuild.passVariants = std::move(passVariants);
+        }
+        if (cull)
+            CreateCullPipeline(cullCode, rebuild.cullPipeline);
+        return rebuild;
+    });
+}
+// =================================================
+// Name: CancelPipelineRebuild
+// Desc: Waits for a running rebuild and throws its pipelines away, before the render passes it used are destroyed
+//       What it was for is left pending, so it's redone against whatever replaces them
+// Params: NONE
+// Return: NONE
+void HelloTriangleApplication::CancelPipelineRebuild()
+{
+    if (!m_pipelineRebuild.valid())
+        return;
+
+    PipelineRebuild rebuild = m_pipelineRebuild.get();
+    for (const PassVariant& variant : rebuild.passVariants) {
+        vkDestroyPipeline(m_device, variant.graphicsPipeline, nullptr);
+        vkDestroyPipeline(m_device, variant.instancedPipeline, nullptr);
+    }
+    vkDestroyPipeline(m_device, rebuild.cullPipeline, nullptr);
+
+    m_graphicsRebuildPending = m_graphicsRebuildPending || rebuild.graphics;
+    m_cullRebuildPending = m_cullRebuildPending || rebuild.cull;
+}
 
 void HelloTriangleApplication::CreateRenderPass()
 {
+    // At 1x the colour attachment is where the frame ends up, otherwise it's resolved into there
+    const bool resolve = m_msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+    const bool upscaled = IsUpscaling();
+    // Offscreen images are left ready to be copied out, the scene image ready to be blitted up
+    const VkImageLayout targetLayout = (m_headless || upscaled) ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
     // Single color buffer attachment represented by one of the images from the swap chain
     VkAttachmentDescription colourAttachment{};
     colourAttachment.format = m_swapChainImageFormat;    // Format should match the format of the swap images
     colourAttachment.samples = m_msaaSamples;
     // What to do with data before and after rendering
     colourAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    colourAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    // Only the resolve is kept, storing the samples would write them all out (and force lazy memory to be backed)
+    colourAttachment.storeOp = resolve ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
     // We don't use the stencil buffer so we don't care
     colourAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colourAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     // Specifies the data format before and after rendering passes
     colourAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colourAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;    // Sampled images cannot be presented directly
+    colourAttachment.finalLayout = resolve ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : targetLayout;  // Sampled images cannot be presented directly
     // Subpass requires a reference to colour attachment
     VkAttachmentReference colourAttachmentRef{};
     colourAttachmentRef.attachment = 0;
@@ -1870,12 +3758,12 @@ void HelloTriangleApplication::CreateRenderPass()
     VkAttachmentDescription resolveAttachment{};
     resolveAttachment.format = m_swapChainImageFormat;
     resolveAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-    resolveAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    resolveAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    resolveAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;     // Every pixel's written by the resolve
+    resolveAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;       // The one thing that's kept
     resolveAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     resolveAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     resolveAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    resolveAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    resolveAttachment.finalLayout = targetLayout;
     VkAttachmentReference resolveReference{};
     resolveReference.attachment = 2;
     resolveReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
@@ -1903,7 +3791,7 @@ void HelloTriangleApplication::CreateRenderPass()
     subpass.colorAttachmentCount = 1; // The index of the attachment in this array is directly referenced from the fragment shader
     subpass.pColorAttachments = &colourAttachmentRef;
     subpass.pDepthStencilAttachment = &depthAttachmentRef; // Can only have one depth buffer test
-    subpass.pResolveAttachments = &resolveReference;
+    subpass.pResolveAttachments = resolve ? &resolveReference : nullptr;
 
     // -=-=-=-=-=-=-=-=-=- RENDER PASS -=-=-=-=-=-=-=-=-=-
 
@@ -1916,34 +3804,318 @@ void HelloTriangleApplication::CreateRenderPass()
     dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
     dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
-    std::vector<VkAttachmentDescription> attachDescs = { colourAttachment, depthAttachment, resolveAttachment };
+    // The scene image is shared by every frame, so the last frame's blit has to have read it before it's drawn over
+    // and this frame's writes have to land before its own blit reads them
+    VkSubpassDependency upscaleDependency{};
+    upscaleDependency.srcSubpass = 0;
+    upscaleDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+    upscaleDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    upscaleDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    upscaleDependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    upscaleDependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    if (upscaled)
+        dependency.srcStageMask |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+    const VkSubpassDependency dependencies[] = { dependency, upscaleDependency };
+
+    std::vector<VkAttachmentDescription> attachDescs = { colourAttachment, depthAttachment };
+    if (resolve)
+        attachDescs.push_back(resolveAttachment);
     VkRenderPassCreateInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
     renderPassInfo.attachmentCount = static_cast<uint32_t>(attachDescs.size());
     renderPassInfo.pAttachments = attachDescs.data();
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    renderPassInfo.dependencyCount = upscaled ? 2 : 1;
+    renderPassInfo.pDependencies = dependencies;
 
     assert(vkCreateRenderPass(m_device, &renderPassInfo, nullptr, &m_renderPass) == VK_SUCCESS);
 }
 // =================================================
 // Name: CreateRenderTargets
-// Desc: Generate an image used for multisampling
+// Desc: Generate an image used for multisampling, and the smaller scene image when it's upscaled
+//       Sets m_renderExtent, which the depth buffer and framebuffers are made at
 // Params: NONE
 // Return: NONE
 void HelloTriangleApplication::CreateRenderTargets()
 {
     VkFormat renderTargetFormat = m_swapChainImageFormat;
 
+    m_renderExtent = m_swapChainExtent;
+    if (IsUpscaling()) {
+        m_renderExtent.width = std::max(1u, static_cast<uint32_t>(m_swapChainExtent.width * m_renderScale));
+        m_renderExtent.height = std::max(1u, static_cast<uint32_t>(m_swapChainExtent.height * m_renderScale));
+
+        // The pass resolves (or draws) into it and the blit reads it, so it has to be kept
+        CreateImageBuffer(m_renderExtent.width, m_renderExtent.height, renderTargetFormat, VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            m_sceneImage, m_sceneMemory, 1, VK_SAMPLE_COUNT_1_BIT, MemoryCategory::RenderTarget);
+        m_sceneView = CreateImageViews(m_sceneImage, renderTargetFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+        printf("Scene target: %ux%u, %.0f%% scale\n", m_renderExtent.width, m_renderExtent.height, m_renderScale * 100.0f);
+    }
+
+    // Nothing to resolve at 1x
+    if (m_msaaSamples == VK_SAMPLE_COUNT_1_BIT)
+        return;
+
     // Mip level has to be 1. Enforced by Vulkan
-    CreateImageBuffer(m_swapChainExtent.width, m_swapChainExtent.height, renderTargetFormat, VK_IMAGE_TILING_OPTIMAL, 
+    // Resolved inside the render pass and never read again, so transient (lazily allocated if the device has it)
+    CreateImageBuffer(m_renderExtent.width, m_renderExtent.height, renderTargetFormat, VK_IMAGE_TILING_OPTIMAL, 
         VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        m_renderTargetImage, m_renderTargetMemory, 1, m_msaaSamples);
+        m_renderTargetImage, m_renderTargetMemory, 1, m_msaaSamples, MemoryCategory::RenderTarget);
+    printf("Colour target: %ux, %.2f MB %s\n", static_cast<uint32_t>(m_msaaSamples), m_renderTargetMemory.size / (1024.0 * 1024.0),
+        (m_allocator.GetMemoryTypeFlags(m_renderTargetMemory.memoryType) & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) ? "lazily allocated" : "device local");
 
     m_renderTargetView = CreateImageViews(m_renderTargetImage, renderTargetFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
 }
+// =================================================
+// Name: DestroyRenderTargets
+// Desc: Destroys everything made at the render size: the MSAA, scene and depth targets and the framebuffers
+//       The handles are cleared as a 1x or full scale rebuild doesn't make all of them again
+// Params: NONE
+// Return: NONE
+void HelloTriangleApplication::DestroyRenderTargets()
+{
+    vkDestroyImageView(m_device, m_depthView, nullptr);
+    vkDestroyImage(m_device, m_depthImage, nullptr);
+    m_allocator.Free(m_depthMemory);
+    m_depthView = VK_NULL_HANDLE;
+    m_depthImage = VK_NULL_HANDLE;
+
+    vkDestroyImageView(m_device, m_renderTargetView, nullptr);
+    vkDestroyImage(m_device, m_renderTargetImage, nullptr);
+    m_allocator.Free(m_renderTargetMemory);
+    m_renderTargetView = VK_NULL_HANDLE;
+    m_renderTargetImage = VK_NULL_HANDLE;
+
+    vkDestroyImageView(m_device, m_sceneView, nullptr);
+    vkDestroyImage(m_device, m_sceneImage, nullptr);
+    m_allocator.Free(m_sceneMemory);
+    m_sceneView = VK_NULL_HANDLE;
+    m_sceneImage = VK_NULL_HANDLE;
+
+    for (auto framebuffer : m_swapChainFramebuffers) {
+        vkDestroyFramebuffer(m_device, framebuffer, nullptr);
+    }
+    m_swapChainFramebuffers.clear();
+}
+// =================================================
+// Name: RebuildRenderTargets
+// Desc: Remakes what a new sample count or render scale touches, the swap chain and everything else stays as it is
+//       The render pass and pipelines are only made the first time a setting's used
+// Params: NONE
+// Return: NONE
+void HelloTriangleApplication::RebuildRenderTargets()
+{
+    vkDeviceWaitIdle(m_device);     // The frames in flight are still using the old targets
+
+    DestroyRenderTargets();
+    UsePassVariant();
+    CreateRenderTargets();
+    CreateDepthResources();
+    CreateFrameBuffers();
+
+    // The static mode secondaries have the old render pass and viewport baked in
+    MarkSceneDirty();
+}
+// =================================================
+// Name: UsePassVariant
+// Desc: Switches to the render pass and graphics pipelines for the current sample count and scale, making them
+//       (through the pipeline cache) if this is the first time they're needed
+// Params: NONE
+// Return: NONE
+void HelloTriangleApplication::UsePassVariant()
+{
+    const bool upscaled = IsUpscaling();
+    for (const PassVariant& variant : m_passVariants) {
+        if (variant.samples == m_msaaSamples && variant.upscaled == upscaled) {
+            m_renderPass = variant.renderPass;
+            m_graphicsPipeline = variant.graphicsPipeline;
+            m_instancedPipeline = variant.instancedPipeline;
+            return;
+        }
+    }
+
+    CreateRenderPass();
+    CreateGraphicsPipeline(m_graphicsShaders, m_renderPass, m_msaaSamples, m_graphicsPipeline, m_instancedPipeline);
+    m_passVariants.push_back({ m_msaaSamples, upscaled, m_renderPass, m_graphicsPipeline, m_instancedPipeline });
+}
+// =================================================
+// Name: DestroyPassVariants
+// Desc: Destroys every render pass and graphics pipeline made so far, the current ones included
+// Params: NONE
+// Return: NONE
+void HelloTriangleApplication::DestroyPassVariants()
+{
+    CancelPipelineRebuild();
+
+    for (const PassVariant& variant : m_passVariants) {
+        vkDestroyPipeline(m_device, variant.graphicsPipeline, nullptr);
+        vkDestroyPipeline(m_device, variant.instancedPipeline, nullptr);
+        vkDestroyRenderPass(m_device, variant.renderPass, nullptr);
+    }
+    m_passVariants.clear();
+
+    m_renderPass = VK_NULL_HANDLE;
+    m_graphicsPipeline = VK_NULL_HANDLE;
+    m_instancedPipeline = VK_NULL_HANDLE;
+}
+// =================================================
+// Name: SupportsUpscale
+// Desc: If images of the format can be blitted from and to with a linear filter, what the upscale needs
+// Params: format
+// Return: bool
+bool HelloTriangleApplication::SupportsUpscale(VkFormat format)
+{
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(m_physicalDevice, format, &properties);
+
+    const VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    return (properties.optimalTilingFeatures & needed) == needed;
+}
+// =================================================
+// Name: RecordUpscale
+// Desc: Blits the scene image (left as a transfer source by the render pass) up into the frame's swap chain image
+//       and leaves that ready to present (or copy out when headless)
+// Params: buffer, imageidx
+// Return: NONE
+void HelloTriangleApplication::RecordUpscale(VkCommandBuffer buffer, uint32_t imageidx)
+{
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;          // Every pixel's written, what was there doesn't matter
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = m_swapChainImages[imageidx];
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    // The acquire semaphore is waited on at colour output, so starting from that stage chains onto it
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        0, nullptr, 0, nullptr, 1, &barrier);
+
+    VkImageBlit blit{};
+    blit.srcOffsets[0] = { 0, 0, 0 };
+    blit.srcOffsets[1] = { static_cast<int32_t>(m_renderExtent.width), static_cast<int32_t>(m_renderExtent.height), 1 };
+    blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    blit.srcSubresource.mipLevel = 0;
+    blit.srcSubresource.baseArrayLayer = 0;
+    blit.srcSubresource.layerCount = 1;
+    blit.dstOffsets[0] = { 0, 0, 0 };
+    blit.dstOffsets[1] = { static_cast<int32_t>(m_swapChainExtent.width), static_cast<int32_t>(m_swapChainExtent.height), 1 };
+    blit.dstSubresource = blit.srcSubresource;
+
+    vkCmdBlitImage(buffer, m_sceneImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_swapChainImages[imageidx],
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+    // Present waits on the semaphore signalled after the whole submission, so nothing after this has to wait on it
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = m_headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+        0, nullptr, 0, nullptr, 1, &barrier);
+}
+// =================================================
+// Name: UpdateAdaptiveQuality
+// Desc: Every QUALITY_INTERVAL frames, steps the sample count or render scale one notch down if the recent frames went
+//       over the target frame time, or one notch up if they were well under it
+//       Off headless so a benchmark always measures the same thing
+// Params: NONE
+// Return: NONE
+void HelloTriangleApplication::UpdateAdaptiveQuality()
+{
+    if (!m_adaptiveQuality || m_headless || ++m_framesSinceQualityCheck < QUALITY_INTERVAL)
+        return;
+    m_framesSinceQualityCheck = 0;
+
+    // The GPU's own time for the frame if there are timestamps, as the CPU's is held to the refresh rate with vsync
+    // Falling back to that means it can still step down, it just won't ever look far enough under to step back up
+    float frameTime = m_profiler.GetRecentGpuTime("frame", QUALITY_INTERVAL);
+    if (frameTime <= 0.0f)
+        frameTime = m_profiler.GetRecentFrameTime(QUALITY_INTERVAL);
+    if (frameTime <= 0.0f)
+        return;
+
+    VkSampleCountFlagBits samples = m_msaaSamples;
+    float scale = m_renderScale;
+    if (frameTime > m_targetFrameTime * QUALITY_OVER_BUDGET) {
+        // Samples first as they cost the most for the least visible difference, 2x is kept until the scale's at its lowest
+        if (samples > VK_SAMPLE_COUNT_2_BIT)
+            samples = static_cast<VkSampleCountFlagBits>(samples / 2);
+        else if (m_resolutionScaling && scale > MIN_RENDER_SCALE)
+            scale = std::max(scale - RENDER_SCALE_STEP, MIN_RENDER_SCALE);
+        else if (samples > VK_SAMPLE_COUNT_1_BIT)
+            samples = VK_SAMPLE_COUNT_1_BIT;
+    }
+    else if (frameTime < m_targetFrameTime * QUALITY_UNDER_BUDGET) {
+        // The same steps backwards
+        if (samples == VK_SAMPLE_COUNT_1_BIT && m_maxMsaaSamples > VK_SAMPLE_COUNT_1_BIT)
+            samples = VK_SAMPLE_COUNT_2_BIT;
+        else if (m_resolutionScaling && scale < 1.0f)
+            scale = std::min(scale + RENDER_SCALE_STEP, 1.0f);
+        else if (samples < m_maxMsaaSamples)
+            samples = static_cast<VkSampleCountFlagBits>(samples * 2);
+    }
+
+    if (samples == m_msaaSamples && scale == m_renderScale)
+        return;
+
+    printf("Adaptive quality: %.2f ms against %.2f ms, %ux MSAA at %.0f%% -> %ux MSAA at %.0f%%\n", frameTime, m_targetFrameTime,
+        static_cast<uint32_t>(m_msaaSamples), m_renderScale * 100.0f, static_cast<uint32_t>(samples), scale * 100.0f);
+    m_msaaSamples = samples;
+    m_renderScale = scale;
+    RebuildRenderTargets();
+}
+// =================================================
+// Name: CheckMemoryBudget
+// Desc: Every MEMORY_CHECK_INTERVAL frames, puts the device local usage against its budget in the window title and
+//       warns about any heap that's gone past MEMORY_WARNING_FRACTION of its budget since the last look
+//       Past the budget allocations start failing or the driver pages memory out, either way the scene's too big
+// Params: NONE
+// Return: NONE
+void HelloTriangleApplication::CheckMemoryBudget()
+{
+    if (++m_framesSinceMemoryCheck < MEMORY_CHECK_INTERVAL)
+        return;
+    m_framesSinceMemoryCheck = 0;
+
+    const std::vector<HeapBudget> heaps = m_allocator.GetHeapBudgets();
+    m_heapsNearBudget.resize(heaps.size(), false);
+
+    VkDeviceSize deviceUsage = 0, deviceBudget = 0;
+    for (size_t h = 0; h < heaps.size(); ++h) {
+        const HeapBudget& heap = heaps[h];
+        if (heap.deviceLocal) {
+            deviceUsage += heap.usage;
+            deviceBudget += heap.budget;
+        }
+
+        const bool nearBudget = heap.usage > heap.budget * MEMORY_WARNING_FRACTION;
+        if (nearBudget && !m_heapsNearBudget[h]) {
+            printf("Memory: heap %zu (%s) is at %.2f of its %.2f MB budget, ours is %.2f MB. M dumps the breakdown\n", h,
+                heap.deviceLocal ? "device local" : "host", heap.usage / (1024.0 * 1024.0), heap.budget / (1024.0 * 1024.0),
+                heap.reserved / (1024.0 * 1024.0));
+        }
+        m_heapsNearBudget[h] = nearBudget;
+    }
+
+    // The closest thing to an overlay without any text rendering
+    if (!m_headless) {
+        char title[128];
+        snprintf(title, sizeof(title), "Vulkan Window - VRAM %.0f / %.0f MB%s", deviceUsage / (1024.0 * 1024.0),
+            deviceBudget / (1024.0 * 1024.0), m_memoryBudget ? "" : " (estimated)");
+        glfwSetWindowTitle(m_window, title);
+    }
+}
 //==================================================================================================
 //  Rendering
 //==================================================================================================
@@ -1951,9 +4123,9 @@ void HelloTriangleApplication::CreateRenderTargets()
 void HelloTriangleApplication::CreateSyncObjects()
 {
     // Assign the size we need
-    m_imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    m_renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    m_inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+    m_imageAvailableSemaphores.resize(m_framesInFlight);
+    m_renderFinishedSemaphores.resize(m_framesInFlight);
+    m_inFlightFences.resize(m_framesInFlight);
     m_imagesInFlight.resize(m_swapChainImages.size(), VK_NULL_HANDLE);
 
     // Fill out semaphore struct
@@ -1967,7 +4139,7 @@ void HelloTriangleApplication::CreateSyncObjects()
     fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
     // Make a semaphore for each frame
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    for (size_t i = 0; i < m_framesInFlight; i++) {
         assert(vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_imageAvailableSemaphores[i]) == VK_SUCCESS &&
             vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_renderFinishedSemaphores[i]) == VK_SUCCESS &&
             vkCreateFence(m_device, &fenceInfo, nullptr, &m_inFlightFences[i]) == VK_SUCCESS);
@@ -1992,35 +4164,236 @@ void HelloTriangleApplication::CreateSyncObjects()
 // Return: NONE
 void HelloTriangleApplication::MainLoop()
 {
+    if (m_headless) {
+        // As fast as the GPU goes for a set number of frames, there's no input to poll or window to close
+        for (uint32_t frame = 0; frame < m_benchmarkFrames; ++frame)
+            DrawFrame();
+
+        vkDeviceWaitIdle(m_device);
+        m_profiler.Flush();
+        m_profiler.Dump();
+        WriteBenchmarkReport();
+        return;
+    }
+
     while (!glfwWindowShouldClose(m_window)) {
         glfwPollEvents();
+
+        // Dump the profiler when P goes down
+        const bool profilerKey = glfwGetKey(m_window, GLFW_KEY_P) == GLFW_PRESS;
+        if (profilerKey && !m_profilerKeyDown)
+            m_profiler.Dump();
+        m_profilerKeyDown = profilerKey;
+
+        // T and C toggle the texture and vertex colour, the graphics pipelines are rebuilt in the background
+        const bool textureKey = glfwGetKey(m_window, GLFW_KEY_T) == GLFW_PRESS;
+        if (textureKey && !m_textureKeyDown) {
+            m_useTexture = !m_useTexture;
+            m_graphicsRebuildPending = true;
+        }
+        m_textureKeyDown = textureKey;
+
+        const bool colourKey = glfwGetKey(m_window, GLFW_KEY_C) == GLFW_PRESS;
+        if (colourKey && !m_colourKeyDown) {
+            m_useVertexColour = !m_useVertexColour;
+            m_graphicsRebuildPending = true;
+        }
+        m_colourKeyDown = colourKey;
+
+        // And the memory stats when M does
+        const bool memoryKey = glfwGetKey(m_window, GLFW_KEY_M) == GLFW_PRESS;
+        if (memoryKey && !m_memoryKeyDown)
+            m_allocator.DumpStats();
+        m_memoryKeyDown = memoryKey;
+
         DrawFrame();
     }
 
     // Wait for everything to finish before destroying
     vkDeviceWaitIdle(m_device);
+
+    // One last look at how the run went
+    m_profiler.Dump();
+}
+// =================================================
+// Name: EscapeJson
+// Desc: The text with its quotes, backslashes and control characters escaped, ready to go between quotes in the report
+// Params: text
+// Return: std::string
+static std::string EscapeJson(const char* text)
+{
+    std::string escaped;
+    for (const char* c = text; *c != '\0'; ++c) {
+        switch (*c) {
+        case '"':   escaped += "\\\""; break;
+        case '\\':  escaped += "\\\\"; break;
+        case '\n':  escaped += "\\n"; break;
+        case '\r':  escaped += "\\r"; break;
+        case '\t':  escaped += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(*c) < 0x20) {
+                char code[8];
+                snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned char>(*c));
+                escaped += code;
+            }
+            else
+                escaped += *c;
+            break;
+        }
+    }
+    return escaped;
+}
+// =================================================
+// Name: WriteBenchmarkReport
+// Desc: Writes the benchmark run out as JSON: the device, startup phases, memory and the profiler's frame, CPU and GPU
+//       timings, everything needed to compare one run (or driver) against another
+// Params: NONE
+// Return: NONE
+void HelloTriangleApplication::WriteBenchmarkReport()
+{
+    std::ofstream file(m_benchmarkReportPath, std::ios::trunc);
+    if (!file.is_open()) {
+        printf("Couldn't write the benchmark report to %s\n", m_benchmarkReportPath.c_str());
+        return;
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+
+    const MemoryUsage memory = m_allocator.GetUsage();
+    const std::vector<HeapBudget> heaps = m_allocator.GetHeapBudgets();
+    VkDeviceSize textureBytes = 0;
+    for (const Texture& texture : m_textures)
+        textureBytes += texture.residentSize;
+
+    const char* latencyModes[] = { "balanced", "low_latency", "throughput" };
+
+    file << std::fixed << std::setprecision(4);
+    file << "{\n";
+    file << "    \"device\": {\n";
+    file << "        \"name\": \"" << EscapeJson(properties.deviceName) << "\",\n";
+    file << "        \"vendor_id\": " << properties.vendorID << ",\n";
+    file << "        \"device_id\": " << properties.deviceID << ",\n";
+    // Packed differently by each vendor, left raw so two runs can still be told apart
+    file << "        \"driver_version\": " << properties.driverVersion << ",\n";
+    file << "        \"api_version\": \"" << VK_VERSION_MAJOR(properties.apiVersion) << "." << VK_VERSION_MINOR(properties.apiVersion)
+        << "." << VK_VERSION_PATCH(properties.apiVersion) << "\"\n";
+    file << "    },\n";
+    file << "    \"settings\": {\n";
+    file << "        \"frames\": " << m_benchmarkFrames << ",\n";
+    file << "        \"width\": " << m_swapChainExtent.width << ",\n";
+    file << "        \"height\": " << m_swapChainExtent.height << ",\n";
+    file << "        \"render_width\": " << m_renderExtent.width << ",\n";
+    file << "        \"render_height\": " << m_renderExtent.height << ",\n";
+    file << "        \"msaa_samples\": " << static_cast<uint32_t>(m_msaaSamples) << ",\n";
+    file << "        \"latency_mode\": \"" << latencyModes[static_cast<int>(m_latencyMode)] << "\",\n";
+    file << "        \"frames_in_flight\": " << m_framesInFlight << ",\n";
+    file << "        \"objects\": " << m_renderObjects.size() << ",\n";
+    file << "        \"instances\": " << m_instances.size() << "\n";
+    file << "    },\n";
+    file << "    \"startup_ms\": {\n";
+    file << "        \"total\": " << m_startupTime << ",\n";
+    file << "        \"pipeline_cache\": \"" << (m_pipelineCacheWarm ? "warm" : "cold") << "\",\n";
+    file << "        \"phases\": {";
+    for (size_t i = 0; i < m_startupPhases.size(); ++i)
+        file << (i > 0 ? "," : "") << "\n            \"" << m_startupPhases[i].name << "\": " << m_startupPhases[i].time;
+    file << "\n        },\n";
+    // On worker threads alongside the phases, not part of the total
+    file << "        \"async\": {";
+    for (size_t i = 0; i < m_asyncPhases.size(); ++i)
+        file << (i > 0 ? "," : "") << "\n            \"" << m_asyncPhases[i].name << "\": " << m_asyncPhases[i].time;
+    file << "\n        }\n";
+    file << "    },\n";
+    file << "    \"memory_mb\": {\n";
+    file << "        \"used\": " << memory.used / (1024.0 * 1024.0) << ",\n";
+    file << "        \"reserved\": " << memory.reserved / (1024.0 * 1024.0) << ",\n";
+    file << "        \"textures\": " << textureBytes / (1024.0 * 1024.0) << ",\n";
+    file << "        \"blocks\": " << memory.blocks << ",\n";
+    file << "        \"allocations\": " << memory.allocations << ",\n";
+    file << "        \"categories\": {";
+    for (uint32_t c = 0; c < DeviceMemoryAllocator::CATEGORY_COUNT; ++c) {
+        const MemoryCategory category = static_cast<MemoryCategory>(c);
+        file << (c > 0 ? "," : "") << "\n            \"" << DeviceMemoryAllocator::GetCategoryName(category) << "\": "
+            << m_allocator.GetCategoryUsage(category).used / (1024.0 * 1024.0);
+    }
+    file << "\n        },\n";
+    // Budget and usage are the driver's with VK_EXT_memory_budget, estimates otherwise
+    file << "        \"budget_from_driver\": " << (m_memoryBudget ? "true" : "false") << ",\n";
+    file << "        \"heaps\": [";
+    for (size_t h = 0; h < heaps.size(); ++h) {
+        file << (h > 0 ? "," : "") << "\n            { \"device_local\": " << (heaps[h].deviceLocal ? "true" : "false")
+            << ", \"size\": " << heaps[h].size / (1024.0 * 1024.0) << ", \"budget\": " << heaps[h].budget / (1024.0 * 1024.0)
+            << ", \"usage\": " << heaps[h].usage / (1024.0 * 1024.0) << " }";
+    }
+    file << "\n        ]\n";
+    file << "    },\n";
+    file << "    \"timings\": ";
+    m_profiler.WriteJson(file);
+    file << "\n}\n";
+
+    printf("Benchmark report written to %s\n", m_benchmarkReportPath.c_str());
 }
 
 void HelloTriangleApplication::DrawFrame()
 {
+    // Each stage's CPU time goes to the profiler, measured from the end of the last one
+    auto stageStart = std::chrono::high_resolution_clock::now();
+    auto endStage = [&](const char* name) {
+        auto now = std::chrono::high_resolution_clock::now();
+        m_profiler.AddCpuTime(name, std::chrono::duration<float, std::chrono::milliseconds::period>(now - stageStart).count());
+        stageStart = now;
+    };
+
+    // Start to start, so it's the whole frame whatever it was waiting on
+    if (m_lastFrameStart != std::chrono::high_resolution_clock::time_point())
+        m_profiler.AddFrameTime(std::chrono::duration<float, std::chrono::milliseconds::period>(stageStart - m_lastFrameStart).count());
+    m_lastFrameStart = stageStart;
+
+    // Before anything for this frame is touched, a change waits for the device to go idle
+    UpdateAdaptiveQuality();
+    // Reloaded shaders are just swapped in, this never waits
+    UpdateShaderReload();
+    CheckMemoryBudget();
+
     // Check if a previous frame is using this image (i.e. there is its fence to wait on)
 	vkWaitForFences(m_device, 1, &m_inFlightFences[m_currentFrame], VK_TRUE, UINT64_MAX);
+    endStage("fence wait");
 
     // Get the image from the swap chain we want to draw
-    uint32_t imageIndex;
-    VkResult result = vkAcquireNextImageKHR(m_device, m_swapChain, UINT64_MAX, m_imageAvailableSemaphores[m_currentFrame], VK_NULL_HANDLE, &imageIndex);
-
-    // If the window no longer matches the swap chain recreate it
-    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-        RecreateSwapChain();
-	    return;                 // and exit as we cannot proceed
+    // Headless each frame has its own offscreen image, which the fence just waited on already covers
+    uint32_t imageIndex = static_cast<uint32_t>(m_currentFrame);
+    VkResult result;
+    if (!m_headless) {
+        result = vkAcquireNextImageKHR(m_device, m_swapChain, UINT64_MAX, m_imageAvailableSemaphores[m_currentFrame], VK_NULL_HANDLE, &imageIndex);
+        endStage("acquire");
+
+        // If the window no longer matches the swap chain recreate it
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            RecreateSwapChain();
+	        return;                 // and exit as we cannot proceed
+        }
     }
     vkResetFences(m_device, 1, &m_inFlightFences[m_currentFrame]);
 
+    // Free the staging memory of any uploads that have finished (doesn't block)
+    m_uploads.Collect();
+
+    // The fence and acquire can both block, so the events polled before them are stale by now
+    // Picking them up again here gets the newest input into this frame
+    if (m_latencyMode == LatencyMode::LowLatency && !m_headless)
+        glfwPollEvents();
+
     UpdateUniformBuffers(m_currentFrame);
+    endStage("update");
+
+    // The frame's fence has been waited on, so its secondary is free to re-record if it has to be
+    // A different UBO offset to the one baked in counts as a change too
+    if (m_staticScene && (m_sceneDirty[m_currentFrame] || m_sceneUniformOffsets[m_currentFrame] != m_uniformOffsets[m_currentFrame]))
+        RecordSceneCommands(static_cast<uint32_t>(m_currentFrame));
 
     vkResetCommandBuffer(m_commandBuffers[m_currentFrame], 0);
     RecordCommandBuffer(m_commandBuffers[m_currentFrame], imageIndex);
+    endStage("record");
 
     // Queue submission and synchronization
     VkSubmitInfo submitInfo{};
@@ -2028,7 +4401,7 @@ void HelloTriangleApplication::DrawFrame()
 
     VkSemaphore waitSemaphores[] = { m_imageAvailableSemaphores[m_currentFrame] };
     VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.waitSemaphoreCount = m_headless ? 0 : 1;     // Nothing was acquired, nothing to wait for
     submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
 
@@ -2038,39 +4411,44 @@ void HelloTriangleApplication::DrawFrame()
 
     // Which semaphore to signal when execution is finished
     VkSemaphore signalSemaphores[] = { m_renderFinishedSemaphores[m_currentFrame] };
-    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.signalSemaphoreCount = m_headless ? 0 : 1;   // Or present
     submitInfo.pSignalSemaphores = signalSemaphores;
 
     result = vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, m_inFlightFences[m_currentFrame]);
 
     assert(result == VK_SUCCESS);
+    endStage("submit");
 
-    // Submit the results back to the swap chain
-    // Done through the VkPresentInfoKHR struct
-    VkPresentInfoKHR presentInfo{};
-    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    // Submit the results back to the swap chain, headless the frame's done once it's submitted
+    if (!m_headless) {
+        // Done through the VkPresentInfoKHR struct
+        VkPresentInfoKHR presentInfo{};
+        presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
-    // Which semaphores to wait on
-    presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores = signalSemaphores;
+        // Which semaphores to wait on
+        presentInfo.waitSemaphoreCount = 1;
+        presentInfo.pWaitSemaphores = signalSemaphores;
 
-    // The swap chains to present the image to
-    VkSwapchainKHR swapChains[] = { m_swapChain };
-    presentInfo.swapchainCount = 1;
-    presentInfo.pSwapchains = swapChains;
-    presentInfo.pImageIndices = &imageIndex;
+        // The swap chains to present the image to
+        VkSwapchainKHR swapChains[] = { m_swapChain };
+        presentInfo.swapchainCount = 1;
+        presentInfo.pSwapchains = swapChains;
+        presentInfo.pImageIndices = &imageIndex;
 
-    presentInfo.pResults = nullptr; // Optional
+        presentInfo.pResults = nullptr; // Optional
 
-    // Ask to present an image to the swap chain
-    result = vkQueuePresentKHR(m_presentQueue, &presentInfo);
+        // Ask to present an image to the swap chain
+        result = vkQueuePresentKHR(m_presentQueue, &presentInfo);
+        endStage("present");
 
-    // Check if suboptimal as well for best effect
-    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
-        RecreateSwapChain();
+        // Check if suboptimal as well for best effect
+        if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+            RecreateSwapChain();
+    }
 
-    m_currentFrame = (m_currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    m_currentFrame = (m_currentFrame + 1) % m_framesInFlight;
     // (%) operator index loops around after max
+    ++m_frameNumber;
 
     // We could use vkQueueWaitIdle to wait here, but we use "frames in flight"
 }
@@ -2097,27 +4475,20 @@ void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT
 
 void HelloTriangleApplication::CleanUpSwapChain()
 {
-    vkDestroyImageView(m_device, m_depthView, nullptr);
-    vkDestroyImage(m_device, m_depthImage, nullptr);
-    vkFreeMemory(m_device, m_depthMemory, nullptr);
-
-    vkDestroyImageView(m_device, m_renderTargetView, nullptr);
-    vkDestroyImage(m_device, m_renderTargetImage, nullptr);
-    vkFreeMemory(m_device, m_renderTargetMemory, nullptr);
-
-    for (auto framebuffer : m_swapChainFramebuffers) {
-        vkDestroyFramebuffer(m_device, framebuffer, nullptr);
-    }
-
-    vkDestroyPipeline(m_device, m_graphicsPipeline, nullptr);
-    vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
-    vkDestroyRenderPass(m_device, m_renderPass, nullptr);
+    DestroyRenderTargets();
 
     for (auto imageView : m_swapChainImageViews) {
         vkDestroyImageView(m_device, imageView, nullptr);
     }
 
-    vkDestroySwapchainKHR(m_device, m_swapChain, nullptr);
+    // Offscreen images are ours to free, swap chain ones belong to the swap chain
+    for (size_t i = 0; i < m_offscreenMemory.size(); i++) {
+        vkDestroyImage(m_device, m_swapChainImages[i], nullptr);
+        m_allocator.Free(m_offscreenMemory[i]);
+    }
+    m_offscreenMemory.clear();
+
+    // The swap chain itself is destroyed by the caller, RecreateSwapChain needs it for oldSwapchain
 }
 // =================================================
 // Name: CleanUp
@@ -2127,49 +4498,97 @@ void HelloTriangleApplication::CleanUpSwapChain()
 void HelloTriangleApplication::CleanUp()
 {
     CleanUpSwapChain();
+    if (m_swapChain != VK_NULL_HANDLE)
+        vkDestroySwapchainKHR(m_device, m_swapChain, nullptr);
+
+    DestroyPassVariants();                  // Waits for a shader rebuild that's still going first
+    vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+    vkDestroyPipeline(m_device, m_cullPipeline, nullptr);
+    vkDestroyPipelineLayout(m_device, m_cullPipelineLayout, nullptr);
+    for (RetiredPipeline& retired : m_retiredPipelines)
+        vkDestroyPipeline(m_device, retired.pipeline, nullptr);
 
     vkDestroySampler(m_device, m_textureSampler, nullptr);
-    vkDestroyImageView(m_device, m_textImgView, nullptr);
+    for (Texture& texture : m_textures) {
+        vkDestroyImageView(m_device, texture.view, nullptr);
 
-    vkDestroyImage(m_device, m_textImage, nullptr);
-    vkFreeMemory(m_device, m_textMemory, nullptr);
+        vkDestroyImage(m_device, texture.image, nullptr);
+        m_allocator.Free(texture.memory);
+
+        // A streaming upload that never got swapped in
+        if (texture.pendingImage != VK_NULL_HANDLE) {
+            vkDestroyImageView(m_device, texture.pendingView, nullptr);
+            vkDestroyImage(m_device, texture.pendingImage, nullptr);
+            m_allocator.Free(texture.pendingMemory);
+        }
+    }
+    for (RetiredTexture& retired : m_retiredTextures) {
+        vkDestroyImageView(m_device, retired.view, nullptr);
+        vkDestroyImage(m_device, retired.image, nullptr);
+        m_allocator.Free(retired.memory);
+    }
 
     vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayout, nullptr);
+    vkDestroyDescriptorSetLayout(m_device, m_cullSetLayout, nullptr);
+    vkDestroyDescriptorSetLayout(m_device, m_textureSetLayout, nullptr);
 
     vkDestroyDescriptorPool(m_device, m_descriptorPool, nullptr);
+    vkDestroyDescriptorPool(m_device, m_texturePool, nullptr);
     // Sets cleaned up implicitly 
 
     if(m_vertexBuffer != nullptr) {
         vkDestroyBuffer(m_device, m_vertexBuffer, nullptr);
-        vkFreeMemory(m_device, m_vertexBufferMemory, nullptr);
+        m_allocator.Free(m_vertexBufferMemory);
     }
     if (m_indexBuffer != nullptr) {
         vkDestroyBuffer(m_device, m_indexBuffer, nullptr);
-        vkFreeMemory(m_device, m_indexBufferMemory, nullptr);
+        m_allocator.Free(m_indexBufferMemory);
     }
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        vkDestroyBuffer(m_device, m_uniformBuffers[i], nullptr);
-        vkFreeMemory(m_device, m_uniformMemory[i], nullptr);
+    vkDestroyBuffer(m_device, m_uniformBuffer, nullptr);
+    m_allocator.Free(m_uniformMemory);
+    vkDestroyBuffer(m_device, m_objectBuffer, nullptr);
+    m_allocator.Free(m_objectMemory);
+    vkDestroyBuffer(m_device, m_indirectBuffer, nullptr);
+    m_allocator.Free(m_indirectMemory);
+    vkDestroyBuffer(m_device, m_drawCountBuffer, nullptr);
+    m_allocator.Free(m_drawCountMemory);
+    vkDestroyBuffer(m_device, m_meshBuffer, nullptr);
+    m_allocator.Free(m_meshMemory);
+    if (m_instanceBuffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(m_device, m_instanceBuffer, nullptr);
+        m_allocator.Free(m_instanceMemory);
     }
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    for (size_t i = 0; i < m_framesInFlight; i++) {
         vkDestroySemaphore(m_device, m_renderFinishedSemaphores[i], nullptr);
         vkDestroySemaphore(m_device, m_imageAvailableSemaphores[i], nullptr);
         vkDestroyFence(m_device, m_inFlightFences[i], nullptr);
     }
 
     vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+    DestroyRecordThreads();
+
+    // Save whatever the driver compiled this run for the next one
+    SavePipelineCache(m_device, m_pipelineCache, PIPELINE_CACHE_PATH);
+    vkDestroyPipelineCache(m_device, m_pipelineCache, nullptr);
 
+    m_profiler.Destroy();
+    m_uploads.Destroy();
+    m_allocator.Destroy();
     vkDestroyDevice(m_device, nullptr);
 
     if (m_enableValidationLayers) {
         DestroyDebugUtilsMessengerEXT(m_instance, m_debugMessenger, nullptr);
     }
 
-    vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
+    if (m_surface != VK_NULL_HANDLE)
+        vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
     vkDestroyInstance(m_instance, nullptr);
 
-    glfwDestroyWindow(m_window);
+    // Headless never started GLFW
+    if (m_window != nullptr) {
+        glfwDestroyWindow(m_window);
 
-    glfwTerminate();
+        glfwTerminate();
+    }
 }
@@ -11,8 +11,11 @@
 //---- GLM maths includes ----
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#define GLM_ENABLE_EXPERIMENTAL
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/hash.hpp>
+#include <glm/gtc/packing.hpp>
 
 //---- VS functionality includes ----
 // iostream and stdexcept headers are included for reporting and propagating errors
@@ -22,6 +25,17 @@
 #include <cstdlib>
 #include <vector>
 #include <optional>
+#include <chrono>
+#include <future>
+#include <unordered_map>
+
+#include "MemoryAllocator.h"
+#include "UploadContext.h"
+#include "TextureFile.h"
+#include "WorkerThreads.h"
+#include "Profiler.h"
+#include "ShaderCompiler.h"
+#include "SceneGraph.h"
 // <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
 //=================================================
 //       HelloTriangleApplication Structs
@@ -31,6 +45,7 @@ struct QueueFamilyIndices {
     // Queue families supporting drawing commands and the ones supporting presentation may not overlap
     std::optional<uint32_t> graphics_family;    // Drawing commands
     std::optional<uint32_t> present_family;     // Presentation ability
+    std::optional<uint32_t> transfer_family;    // Transfer but no graphics, a separate copy engine (optional)
 
     // If it can do both
     bool IsComplete() {
@@ -76,7 +91,139 @@ struct Vertex {
 
         return attributeDescription;
     }
+
+    // Used by the hash map in LoadModel to spot duplicate verts
+    bool operator==(const Vertex& other) const {
+        return pos == other.pos && colour == other.colour && texCoord == other.texCoord;
+    }
+};
+// The compact layout: 12 bytes instead of 32, built from the full verts at upload time
+// Positions are 16 bit unorm across the mesh's bounding box (the model matrix gets the dequantisation folded in)
+// UVs are half floats, and the colour is dropped as it's always white
+struct CompactVertex {
+    uint16_t pos[4];        // xyz and a pad, the 3 component 16 bit formats often can't be fetched
+    uint16_t texCoord[2];
+
+    static VkVertexInputBindingDescription GetBindingDescription() {
+        VkVertexInputBindingDescription bindingDescription;
+        bindingDescription.binding = 0;
+        bindingDescription.stride = sizeof(CompactVertex);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        return bindingDescription;
+    }
+
+    static std::vector<VkVertexInputAttributeDescription> GetAttributeDescriptions() {
+        // Same locations as Vertex, just without the colour at 1
+        std::vector<VkVertexInputAttributeDescription> attributeDescription(2);
+
+        attributeDescription[0].binding = 0;
+        attributeDescription[0].location = 0;
+        attributeDescription[0].format = VK_FORMAT_R16G16B16A16_UNORM;     // Read as 0 to 1 floats
+        attributeDescription[0].offset = offsetof(CompactVertex, pos);
+
+        attributeDescription[1].binding = 0;
+        attributeDescription[1].location = 2;
+        attributeDescription[1].format = VK_FORMAT_R16G16_SFLOAT;
+        attributeDescription[1].offset = offsetof(CompactVertex, texCoord);
+
+        return attributeDescription;
+    }
+};
+// Per instance data, read from a second vertex binding that only moves on once per instance
+// Lets one vkCmdDrawIndexed draw any number of copies of a mesh
+struct InstanceData {
+    glm::mat4 model;
+    glm::vec4 tint;
+    uint32_t texture = 0;               // Its slot in the texture table, each copy can have its own
+
+    static VkVertexInputBindingDescription GetBindingDescription() {
+        VkVertexInputBindingDescription bindingDescription;
+        bindingDescription.binding = 1;                                 // After the vertex binding
+        bindingDescription.stride = sizeof(InstanceData);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;   // Next entry every instance rather than every vertex
+
+        return bindingDescription;
+    }
+
+    static std::vector<VkVertexInputAttributeDescription> GetAttributeDescriptions() {
+        // An attribute is at most a vec4, so the matrix goes in as its four columns
+        std::vector<VkVertexInputAttributeDescription> attributeDescription(6);
+
+        for (uint32_t column = 0; column < 4; ++column) {
+            attributeDescription[column].binding = 1;
+            attributeDescription[column].location = 3 + column;             // Following on from Vertex's attributes
+            attributeDescription[column].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+            attributeDescription[column].offset = static_cast<uint32_t>(offsetof(InstanceData, model) + sizeof(glm::vec4) * column);
+        }
+
+        attributeDescription[4].binding = 1;
+        attributeDescription[4].location = 7;
+        attributeDescription[4].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        attributeDescription[4].offset = offsetof(InstanceData, tint);
+
+        attributeDescription[5].binding = 1;
+        attributeDescription[5].location = 8;
+        attributeDescription[5].format = VK_FORMAT_R32_UINT;
+        attributeDescription[5].offset = offsetof(InstanceData, texture);
+
+        return attributeDescription;
+    }
 };
+// A sampled image and everything needed to free it
+struct Texture {
+    uint8_t mipLevels = 0;                      // How many levels the GPU image has, fewer than the source when streamed
+    VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;  // A block compressed format if a pre-compressed file was found
+    VkImage image = VK_NULL_HANDLE;             // A specialised buffer for images (faster accessing times)
+    MemoryAllocation memory;
+    VkImageView view = VK_NULL_HANDLE;
+
+    // Streaming: every level stays on the CPU and the image only holds residentMip and the ones smaller than it
+    bool streamed = false;
+    TextureFile source;
+    uint8_t residentMip = 0;
+    uint8_t wantedMip = 0;
+    VkDeviceSize residentSize = 0;              // Bytes of the levels on the GPU
+
+    // The replacement with more or fewer levels while its upload is in flight
+    VkImage pendingImage = VK_NULL_HANDLE;
+    MemoryAllocation pendingMemory;
+    VkImageView pendingView = VK_NULL_HANDLE;
+    uint8_t pendingMip = 0;
+    VkDeviceSize pendingSize = 0;
+    uint64_t pendingUpload = 0;                 // The upload batch, 0 when nothing is in flight
+};
+// A texture's files, read (and decoded) off the main thread while the device is still being made
+// Which pre-compressed copy gets used can only be decided once there's a device to ask about its format
+struct TextureFiles {
+    std::vector<std::string> compressedPaths;
+    std::vector<TextureFile> compressed;        // Every pre-compressed copy that exists, in COMPRESSED_TEXTURE_SUFFIXES order
+    TextureFile decoded;                        // The PNG as RGBA (plus its mip chain when streaming), only if there were no copies
+    bool isDecoded = false;
+};
+// A model loaded off the main thread, added to the shared arrays in MODEL_PATHS order once it's done
+struct LoadedMesh {
+    std::vector<Vertex> verts;
+    std::vector<uint32_t> indices;
+    bool cached = false;                        // Read from the mesh cache rather than built from the OBJ
+    double time = 0.0;                          // ms on its own thread
+};
+// How the frame loop trades latency against throughput, picked before Run
+enum class LatencyMode {
+    Balanced,       // 2 frames in flight, MAILBOX if there is one
+    LowLatency,     // 1 frame in flight, IMMEDIATE or MAILBOX, and the input's polled again right before the frame is built
+    Throughput      // 3 frames in flight with a swap chain image spare, never waiting on the display if it can help it
+};
+// Hash the full vertex so identical verts end up in the same bucket
+namespace std {
+    template<> struct hash<Vertex> {
+        size_t operator()(const Vertex& vertex) const noexcept {
+            return ((hash<glm::vec3>()(vertex.pos) ^
+                (hash<glm::vec3>()(vertex.colour) << 1)) >> 1) ^
+                (hash<glm::vec2>()(vertex.texCoord) << 1);
+        }
+    };
+}
 //=================================================
 //          HelloTriangleApplication
 //=================================================
@@ -84,6 +231,12 @@ struct Vertex {
 class HelloTriangleApplication {
 public:
     // --- Public Functions ---
+    void SetLatencyMode(LatencyMode mode);
+    void SetBenchmark(uint32_t frameCount, const std::string& reportPath);
+    void SetTargetFrameRate(float framesPerSecond);
+    void SetStaticScene(bool staticScene);
+    void SetRecordThreads(uint32_t threadCount);
+    void SetPropGridSize(uint32_t gridSize);
     // Runs the app, called in main 
     void Run() {
         InitWindow();
@@ -107,7 +260,11 @@ private:
     int RateSuitableDevices(VkPhysicalDevice device);
     QueueFamilyIndices FindQueueFamilies(VkPhysicalDevice device);
     bool CheckDeviceExtensionSupport(VkPhysicalDevice device);
+    bool IsDeviceExtensionAvailable(VkPhysicalDevice device, const char* extensionName);
+    static bool IsInstanceExtensionAvailable(const char* extensionName);
+    void CheckDescriptorIndexing(std::vector<const char*>& extensions, VkPhysicalDeviceDescriptorIndexingFeaturesEXT& features);
     void CreateSwapChain();
+    void CreateOffscreenTargets();
     void RecreateSwapChain();
     void CreateFrameBuffers();
     void CreateCommandPool();
@@ -115,30 +272,64 @@ private:
                                  VkFormatFeatureFlags features);
     void CreateDepthResources();
     void GenerateMipmaps(VkImage image, int32_t texWidth, int32_t texHeight, uint8_t mipLevels);
-    void CreateTextureImage();
+    void StartStartupLoads();
+    double ReadTextureFiles();
+    void CreateTextureImages();
+    void CreateTextureImage(Texture& texture, const StagingSlice& staging, int32_t width, int32_t height);
+    bool CreateCompressedTextureImage(TextureFiles& files, Texture& texture);
+    VkDeviceSize CreateTextureLevels(const TextureFile& file, uint8_t firstMip, VkImage& image, MemoryAllocation& memory,
+        VkImageView& view);
+    uint8_t GetStreamingMip(const TextureFile& file, float screenSize) const;
+    void UpdateTextureStreaming(uint32_t frame, const glm::mat4& view, const glm::mat4& proj);
+    void UpdateTextureTable(uint32_t frame);
+    void StreamTexture(Texture& texture, uint8_t firstMip);
     void TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint8_t mipLevels);
     void CreateImageSampler();
-    void LoadModel();
+    void LoadMeshes();
+    LoadedMesh LoadMeshFile(const std::string& path);
+    void LoadModel(const std::string& path, std::vector<Vertex>& meshVerts, std::vector<uint32_t>& meshIndices);
+    void OptimiseModel(std::vector<Vertex>& meshVerts, std::vector<uint32_t>& meshIndices);
+    uint32_t AddMesh(const std::vector<Vertex>& meshVerts, const std::vector<uint32_t>& meshIndices);
+    void BuildCompactVertices(std::vector<CompactVertex>& compactVerts);
+    glm::mat4 GetDequantisation(uint32_t mesh) const;
     template<typename BufferType>
-    void CreateBuffer(VkDeviceSize size, VkBufferUsageFlags uFlags, VkMemoryPropertyFlags pFlags, BufferType& buffer, VkDeviceMemory& memory);
+    void CreateBuffer(VkDeviceSize size, VkBufferUsageFlags uFlags, VkMemoryPropertyFlags pFlags, BufferType& buffer, MemoryAllocation& memory,
+        MemoryCategory category);
     template<typename BufferType>
-    void AllocateBindBuffer(VkMemoryPropertyFlags pFlags, BufferType& buffer, VkDeviceMemory& memory, 
-        void(*reqFunction)(VkDevice, BufferType, VkMemoryRequirements*), VkResult(*bindFunction)(VkDevice, BufferType, VkDeviceMemory, VkDeviceSize));
-    void CopyBuffer(VkBuffer srcBuff, VkBuffer dstBuff, VkDeviceSize size);
-    void CopyBuffer2Image(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
+    void AllocateBindBuffer(VkMemoryPropertyFlags pFlags, BufferType& buffer, MemoryAllocation& memory, bool linearResource,
+        void(*reqFunction)(VkDevice, BufferType, VkMemoryRequirements*), VkResult(*bindFunction)(VkDevice, BufferType, VkDeviceMemory, VkDeviceSize),
+        MemoryCategory category, VkMemoryPropertyFlags preferredFlags = 0);
+    void CopyBuffer(StagingSlice src, VkBuffer dstBuff, VkDeviceSize size);
+    void CopyBuffer2Image(StagingSlice src, VkImage image, uint32_t width, uint32_t height);
     void CreateImageBuffer(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling,
                            VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image,
-                           VkDeviceMemory& imageMemory, uint8_t mipLevels, VkSampleCountFlagBits sampleCount);
-    VkCommandBuffer BeginSingleTimeCommands();
-    void EndSingleTimeCommands(VkCommandBuffer cmdBuffer);
+                           MemoryAllocation& imageMemory, uint8_t mipLevels, VkSampleCountFlagBits sampleCount, MemoryCategory category);
     template<typename Type>
-    void CreateVertexIndexBuffer(std::vector<Type>dataVec, VkBufferUsageFlagBits useFlag, VkBuffer& buffer, VkDeviceMemory& memory);
+    void CreateVertexIndexBuffer(const std::vector<Type>& dataVec, VkBufferUsageFlagBits useFlag, VkBuffer& buffer, MemoryAllocation& memory);
     void CreateUniformBuffers();
+    void BeginUniformFrame(uint32_t frame);
+    uint32_t PushUniformData(const void* data, VkDeviceSize size);
     void UpdateUniformBuffers(uint32_t currentImage);
+    void CreateObjectBuffers();
+    void CreateMeshBuffer();
+    void UpdateObjectBuffers(uint32_t frame);
+    void RecordCullCommands(VkCommandBuffer buffer, uint32_t frame);
+    // The count draw only works when one call draws the whole list, so not when it's split between threads
+    bool UsesDrawCount() const { return m_cmdDrawIndexedIndirectCount != nullptr && m_recordThreads.GetCount() <= 1; }
     void CreateDescriptorPool();
     void CreateDescriptorSets();
     void CreateCommandBuffers();
     void RecordCommandBuffer(VkCommandBuffer buffer, uint32_t imageidx);
+    void RecordDrawCommands(VkCommandBuffer buffer, uint32_t frame, size_t firstObject, size_t objectCount);
+    void RecordThreadedDrawCommands(VkCommandBuffer primary, uint32_t imageidx);
+    void RecordInstancedDrawCommands(VkCommandBuffer buffer);
+    void RecordSceneCommands(uint32_t frame);
+    void MarkSceneDirty();
+    void BuildScene();
+    uint32_t AddInstanceBatch(uint32_t mesh, const std::vector<InstanceData>& instances);
+    void CreateInstanceBuffer();
+    void CreateRecordThreads();
+    void DestroyRecordThreads();
     SwapChainSupportDetails QuerySwapChainSupport(VkPhysicalDevice device);
     VkSurfaceFormatKHR ChooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& available_formats);
     VkPresentModeKHR ChooseSwapPresentMode(const std::vector<VkPresentModeKHR>& available_present_modes);
@@ -157,48 +348,225 @@ private:
                                                  VkDebugUtilsMessengerEXT* p_debug_messenger);
     void SetupDebugMessenger();
     void CreateDescriptorSetLayouts();
-    void CreateGraphicsPipeline();
-    VkShaderModule CreateShaderModule(const std::vector<char>& code);
+    void CreatePipelineLayouts();
+    struct GraphicsShaders;
+    void CreateGraphicsPipeline(const GraphicsShaders& shaders, VkRenderPass renderPass, VkSampleCountFlagBits samples,
+                                VkPipeline& graphicsPipeline, VkPipeline& instancedPipeline) const;
+    void CreateCullPipeline(const std::vector<char>& code, VkPipeline& pipeline) const;
+    double ReadShaderFiles();
+    const ShaderVariant& FindShaderVariant(const std::string& name) const;
+    std::vector<char> GetShaderCode(const std::string& name);
+    GraphicsShaders LoadGraphicsShaders(bool startup, bool useTexture, bool useVertexColour);
+    VkShaderModule CreateShaderModule(const std::vector<char>& code) const;
+    void UpdateShaderReload();
+    void StartPipelineRebuild();
+    void CancelPipelineRebuild();
     void CreateRenderPass();
     void CreateRenderTargets();
+    void DestroyRenderTargets();
+    void RebuildRenderTargets();
+    void UsePassVariant();
+    void DestroyPassVariants();
+    // The scene goes through m_sceneImage and a blit only when it's drawn smaller than the swap chain
+    bool IsUpscaling() const { return m_resolutionScaling && m_renderScale < 1.0f; }
+    bool SupportsUpscale(VkFormat format);
+    void RecordUpscale(VkCommandBuffer buffer, uint32_t imageidx);
+    void UpdateAdaptiveQuality();
+    void CheckMemoryBudget();
     void CreateSyncObjects();
+    void WriteBenchmarkReport();
 
     // --- Private Attributes ---
+    // Every mesh is appended to the one shared vertex and index buffer, so drawing any of them needs no rebinding
     std::vector<Vertex> verts;
     VkBuffer m_vertexBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory m_vertexBufferMemory = VK_NULL_HANDLE;
+    MemoryAllocation m_vertexBufferMemory;
 
     std::vector<uint32_t> indices;
     VkBuffer m_indexBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory m_indexBufferMemory = VK_NULL_HANDLE;
+    MemoryAllocation m_indexBufferMemory;
+
+    // Where a mesh sits in the shared buffers, exactly what an indexed draw needs, plus its bounds for culling
+    // Laid out to match MeshData in the cull shader, the whole array is uploaded as it is
+    struct MeshRange {
+        uint32_t indexCount = 0;
+        uint32_t firstIndex = 0;
+        int32_t vertexOffset = 0;   // Added to every index, so each mesh keeps its own 0 based indices
+        uint32_t padding = 0;
+        glm::vec4 sphere = glm::vec4(0.0f);     // Bounding sphere in the vertex buffer's space, xyz centre and w radius
+        glm::vec4 quantisation = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);    // Compact positions are xyz + unorm * w
+    };
+    std::vector<MeshRange> m_meshes;
+    bool m_compactVertices = true;              // Upload CompactVertex instead of Vertex, if the device can fetch the formats
+    VkBuffer m_meshBuffer = VK_NULL_HANDLE;
+    MemoryAllocation m_meshMemory;
 
+    // Per frame data, the same for every object drawn
     struct UniformBufferObject {
-        glm::mat4 model;
         glm::mat4 view;
         glm::mat4 proj;
+        glm::mat4 viewProj;     // Premultiplied once on the CPU instead of per vertex
+        glm::vec4 frustumPlanes[6];     // Pulled out of viewProj for culling, normals point inwards
+    };
+
+    // Per object data, the shader picks its entry with gl_InstanceIndex (the draw's firstInstance is the object's index)
+    struct ObjectData {
+        glm::mat4 model;
+        uint32_t mesh;
+        uint32_t texture;       // Its slot in the texture table
+        uint32_t padding[2];    // std430 rounds the struct up to a multiple of 16
+    };
+
+    // The draw list, every object is one of the loaded meshes with its own node in the scene graph and texture
+    struct RenderObject {
+        uint32_t mesh = 0;
+        uint32_t texture = 0;
+        uint32_t node = 0;
+        glm::vec3 position;     // Where it sits under the root, the spin goes on top
+    };
+    std::vector<RenderObject> m_renderObjects;
+    // Every object's transform, the world matrices only recomputed for what moved and copied into the object buffer
+    SceneGraph m_sceneGraph;
+    uint32_t m_sceneRoot = 0;                   // The grid's node, everything's under it
+    std::vector<uint64_t> m_objectSliceVersions;    // The scene graph version each frame's slice of the object buffer has
+    uint32_t m_sceneGridSize = 1;               // The scene is a grid of this many objects squared, raise it to stress recording
+
+    // Instanced batches: copies of one mesh drawn by a single vkCmdDrawIndexed, their transforms in the instance buffer
+    // Meant for lots of identical props, they skip the cull pass and are drawn as they are
+    struct InstanceBatch {
+        uint32_t mesh = 0;
+        uint32_t firstInstance = 0;     // Where its instances start in the instance buffer
+        uint32_t instanceCount = 0;
+    };
+    std::vector<InstanceData> m_instances;
+    std::vector<InstanceBatch> m_instanceBatches;
+    VkBuffer m_instanceBuffer = VK_NULL_HANDLE;
+    MemoryAllocation m_instanceMemory;
+    uint32_t m_propGridSize = 0;                // A grid of this many props squared drawn as one batch, 0 for none
+
+    // The object data and the draw commands, both split into a slice per frame in flight
+    // Objects are written by the CPU and kept mapped, the draws (and their count) are only ever written by the cull pass
+    VkBuffer m_objectBuffer = VK_NULL_HANDLE;
+    MemoryAllocation m_objectMemory;
+    VkBuffer m_indirectBuffer = VK_NULL_HANDLE;
+    MemoryAllocation m_indirectMemory;
+    VkBuffer m_drawCountBuffer = VK_NULL_HANDLE;    // One count per frame for vkCmdDrawIndexedIndirectCount
+    MemoryAllocation m_drawCountMemory;
+
+    const uint32_t MAX_OBJECTS = 16384;         // Per frame, the size of each slice
+
+    // Indirect drawing: the GPU reads every draw from the indirect buffer, one call draws the whole list
+    // Needs drawIndirectFirstInstance, without it we fall back to a vkCmdDrawIndexed per object
+    bool m_indirectDraws = true;
+    bool m_multiDrawIndirect = false;           // More than one draw per indirect call
+    PFN_vkCmdDrawIndexedIndirectCountKHR m_cmdDrawIndexedIndirectCount = nullptr;   // Only if VK_KHR_draw_indirect_count is there
+
+    // GPU culling: a compute pass before the render pass tests every object against the frustum and writes the draws
+    // With the count draw the survivors are packed together, otherwise culled draws are left in place with no instances
+    bool m_frustumCulling = true;
+    VkDescriptorSetLayout m_cullSetLayout = VK_NULL_HANDLE;
+    VkDescriptorSet m_cullSet = VK_NULL_HANDLE;     // Sees every frame's slice, the push constants pick one
+    VkPipelineLayout m_cullPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline m_cullPipeline = VK_NULL_HANDLE;
+
+    struct CullConstants {
+        uint32_t objectCount;
+        uint32_t frame;
+        uint32_t sliceSize;
+        uint32_t flags;
     };
+    static constexpr uint32_t CULL_ENABLED = 1;
+    static constexpr uint32_t CULL_COMPACT = 2;
+    static constexpr uint32_t CULL_GROUP_SIZE = 64;     // local_size_x in the cull shader
 
-    std::vector<VkBuffer> m_uniformBuffers;
-    std::vector<VkDeviceMemory> m_uniformMemory;
+    // One persistently mapped uniform buffer, split into a slice per frame in flight
+    // Anything per frame is pushed into the current slice and bound with a dynamic offset
+    VkBuffer m_uniformBuffer = VK_NULL_HANDLE;
+    MemoryAllocation m_uniformMemory;
+    VkDeviceSize m_uniformAlignment = 0;        // minUniformBufferOffsetAlignment, every push starts on one of these
+    VkDeviceSize m_uniformSliceStart = 0;       // Start of the current frame's slice
+    VkDeviceSize m_uniformHead = 0;             // Next free byte in the current slice
+    std::vector<uint32_t> m_uniformOffsets;     // The UBO's dynamic offset for each frame in flight
+
+    const VkDeviceSize UNIFORM_SLICE_SIZE = 64 * 1024;
 
     VkDescriptorPool m_descriptorPool = VK_NULL_HANDLE;
     std::vector<VkDescriptorSet> m_descriptorSets;
 
-    uint8_t m_mipLevels = 0;
-    VkImage m_textImage;           // A specialised buffer for images (faster accessing times)
-    VkDeviceMemory m_textMemory = VK_NULL_HANDLE;
-    VkImageView m_textImgView = VK_NULL_HANDLE;
+    std::vector<Texture> m_textures;            // One per entry in TEXTURE_PATHS, each one's index is its slot in the texture table
     VkSampler m_textureSampler = VK_NULL_HANDLE;
+
+    // Texture streaming: textures start with just their small levels, the bigger ones are uploaded as they grow on screen
+    // and dropped again (biggest textures first) whenever what's wanted doesn't fit in the budget
+    bool m_textureStreaming = true;
+    VkDeviceSize m_textureBudget = 256ull * 1024 * 1024;
+    const uint32_t STREAMING_START_SIZE = 128;  // Textures load only the levels this size and under
+    // A replaced image, destroyed once every frame that might have drawn with it is done
+    struct RetiredTexture {
+        VkImage image = VK_NULL_HANDLE;
+        MemoryAllocation memory;
+        VkImageView view = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;          // Its levels' bytes, still counted against the budget until it's freed
+        uint64_t freeFrame = 0;
+    };
+    std::vector<RetiredTexture> m_retiredTextures;
+
+    // Bindless textures: every texture is in one big array (set 1) and each object or instance carries the index of its own,
+    // so nothing is rebound between materials and a new texture is just another slot written
+    // Needs VK_EXT_descriptor_indexing for the non uniform indexing, partially bound array and update after bind. Without
+    // it set 1 is the one sampler and everything is drawn with the first texture
+    // There's a table per frame in flight: a slot a pending frame reads can't be rewritten, so a streamed texture's
+    // new image goes into each frame's table on that frame's turn (update after bind keeps the static secondaries valid)
+    bool m_bindlessTextures = true;
+    uint32_t m_textureSlots = 1;                        // The size of each table's array
+    const uint32_t MAX_BINDLESS_TEXTURES = 4096;        // Lowered to the device's update after bind limits
+    VkDescriptorSetLayout m_textureSetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool m_texturePool = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> m_textureSets;
+    std::vector<std::vector<VkImageView>> m_boundTextureViews;  // What each frame's table has in each slot, rewritten when it's out of date
+    uint64_t m_frameNumber = 0;
     bool m_AnisotropyEnabled = VK_TRUE;
 
     VkSampleCountFlagBits m_msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+    VkSampleCountFlagBits m_maxMsaaSamples = VK_SAMPLE_COUNT_1_BIT;     // The most the device can do, where we start
+
+    // Adaptive quality: every QUALITY_INTERVAL frames the recent GPU frame time is held against the target
+    // Over it the MSAA samples come down to 2x, then the render scale, then MSAA goes. Well under it they go back up in reverse
+    bool m_adaptiveQuality = true;
+    float m_targetFrameTime = 1000.0f / 60.0f;              // ms
+    uint32_t m_framesSinceQualityCheck = 0;
+    const uint32_t QUALITY_INTERVAL = 60;
+    const float QUALITY_OVER_BUDGET = 0.95f;                // Fractions of the target, the gap stops it flipping back and forth
+    const float QUALITY_UNDER_BUDGET = 0.7f;
+
+    // Dynamic resolution: the scene's drawn at m_renderScale of the swap chain size into m_sceneImage, then blitted up to it
+    // Off (everything straight into the swap chain images) if the format can't be blitted with a linear filter
+    bool m_resolutionScaling = true;
+    float m_renderScale = 1.0f;
+    VkExtent2D m_renderExtent{};                            // What the render pass actually draws at
+    const float MIN_RENDER_SCALE = 0.5f;
+    const float RENDER_SCALE_STEP = 0.125f;
+    VkImage m_sceneImage = VK_NULL_HANDLE;                  // Single sampled, the resolve target (or the colour target at 1x)
+    MemoryAllocation m_sceneMemory;
+    VkImageView m_sceneView = VK_NULL_HANDLE;
+
+    // A render pass and graphics pipelines for each sample count (and upscaled or not) used so far, so going back to one
+    // is just a swap of handles. Only what those are baked into, the pipeline layout and cull pipeline are shared
+    struct PassVariant {
+        VkSampleCountFlagBits samples;
+        bool upscaled;              // Ends in the scene image ready for the blit, rather than in the swap chain image
+        VkRenderPass renderPass;
+        VkPipeline graphicsPipeline;
+        VkPipeline instancedPipeline;
+    };
+    std::vector<PassVariant> m_passVariants;
 
     VkImage m_renderTargetImage = VK_NULL_HANDLE;
-    VkDeviceMemory m_renderTargetMemory = VK_NULL_HANDLE;
-    VkImageView m_renderTargetView = VK_NULL_HANDLE;
+    MemoryAllocation m_renderTargetMemory;
+    VkImageView m_renderTargetView = VK_NULL_HANDLE;        // Not made at 1x, the pass draws into the scene or swap chain image
 
     VkImage m_depthImage = VK_NULL_HANDLE;
-    VkDeviceMemory m_depthMemory = VK_NULL_HANDLE;
+    MemoryAllocation m_depthMemory;
     VkImageView m_depthView = VK_NULL_HANDLE;
 
     GLFWwindow* m_window = VK_NULL_HANDLE;
@@ -212,25 +580,140 @@ private:
     std::vector<VkImageView> m_swapChainImageViews;
     std::vector<VkFramebuffer> m_swapChainFramebuffers;
 
+    // Headless benchmark: no window, surface or swap chain, m_swapChainImages are our own offscreen images instead
+    // A fixed number of frames with a fixed timestep, then a JSON report of the run
+    bool m_headless = false;
+    uint32_t m_benchmarkFrames = 0;
+    std::string m_benchmarkReportPath;
+    std::vector<MemoryAllocation> m_offscreenMemory;        // One per offscreen image
+    const float BENCHMARK_TIMESTEP = 1.0f / 60.0f;          // Seconds of animation per frame, whatever the real frame time
+
+    // How long each part of InitVulkan took (ms), printed and put in the benchmark report
+    struct StartupPhase {
+        const char* name;
+        double time;
+    };
+    std::vector<StartupPhase> m_startupPhases;
+    std::vector<StartupPhase> m_asyncPhases;                // The worker threads' times, overlapping the phases above
+    double m_startupTime = 0.0;
+
+    // Startup work that only needs the CPU, started first thing in InitVulkan so it runs alongside the instance, device and
+    // pipeline creation. Each future gives back how long it took on its own thread
+    // Nothing they write is touched by the main thread until it's waited on them
+    std::future<double> m_textureRead;
+    std::vector<TextureFiles> m_textureFiles;               // One per entry in TEXTURE_PATHS
+    std::vector<std::future<LoadedMesh>> m_meshLoads;       // One per entry in MODEL_PATHS
+    std::future<double> m_shaderRead;
+    std::unordered_map<std::string, std::vector<char>> m_shaderCode;    // Taken out as each module's made
+
+    // Shaders are compiled at runtime (or read from the SPIR-V cache) and their sources watched. A saved source rebuilds
+    // just the pipelines that use it on a worker thread, swapped in on the main thread once they're all made so the
+    // frame never waits on the driver. A source that doesn't compile leaves the current pipelines in place
+    ShaderCompiler m_shaderCompiler;
+    // Everything the graphics pipelines are made from, kept so a new pass variant doesn't go back to the files
+    struct GraphicsShaders {
+        std::vector<char> vertex;
+        std::vector<char> instanced;
+        std::vector<char> fragment;
+        // The fragment shader's specialisation constants (constant_id 0 and 1)
+        VkBool32 useTexture = VK_TRUE;
+        VkBool32 useVertexColour = VK_TRUE;
+    };
+    GraphicsShaders m_graphicsShaders;
+    // What the next pipelines should be made with, T and C flip them
+    bool m_useTexture = true;
+    bool m_useVertexColour = true;
+    bool m_textureKeyDown = false;
+    bool m_colourKeyDown = false;
+    // The background rebuild, one at a time. Anything asked for while it runs waits for the next one
+    struct PipelineRebuild {
+        bool graphics = false;
+        bool cull = false;
+        bool failed = false;                    // Nothing was made, the current pipelines stay
+        GraphicsShaders shaders;
+        std::vector<PassVariant> passVariants;  // The new pipelines, matched to the current ones by render pass
+        VkPipeline cullPipeline = VK_NULL_HANDLE;
+    };
+    std::future<PipelineRebuild> m_pipelineRebuild;
+    bool m_graphicsRebuildPending = false;
+    bool m_cullRebuildPending = false;
+    uint32_t m_framesSinceShaderPoll = 0;
+    const uint32_t SHADER_POLL_INTERVAL = 30;  // Frames between looking at the sources' write times
+    // A replaced pipeline, destroyed once every frame that might have drawn with it is done
+    struct RetiredPipeline {
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        uint64_t freeFrame = 0;
+    };
+    std::vector<RetiredPipeline> m_retiredPipelines;
+
     VkDescriptorSetLayout m_descriptorSetLayout;
     VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
     VkRenderPass m_renderPass = VK_NULL_HANDLE;
     VkPipeline m_graphicsPipeline = VK_NULL_HANDLE;
+    VkPipeline m_instancedPipeline = VK_NULL_HANDLE;        // The same but reading transforms from the instance binding
+    VkPipelineCache m_pipelineCache = VK_NULL_HANDLE;       // Used for every pipeline we make, saved on exit
+    bool m_pipelineCacheWarm = false;                       // If it was loaded from a previous run
 
     VkCommandPool m_commandPool = VK_NULL_HANDLE;                  // Managing memory for command buffer
     std::vector<VkCommandBuffer> m_commandBuffers;          // The command buffer we execute each update
 
+    // Static mode: the draws are recorded once into a secondary per frame in flight and replayed every frame
+    // The primary just begins the render pass and executes it. Turn off for anything that animates
+    bool m_staticScene = false;
+    std::vector<VkCommandBuffer> m_sceneCommandBuffers;     // Secondary, one per frame in flight
+    std::vector<bool> m_sceneDirty;                         // Needs re-recording before its next use
+    std::vector<uint32_t> m_sceneUniformOffsets;            // The UBO offset each one was recorded with
+
+    // Multithreaded recording: each worker records a slice of the draw list into its own secondary every frame
+    // Every worker has a command pool per frame in flight, pools can't be used from two threads at once
+    uint32_t m_recordThreadCount = 0;                       // 0 records everything inline on the main thread
+    WorkerThreads m_recordThreads;
+    std::vector<std::vector<VkCommandPool>> m_threadCommandPools;       // [frame][thread]
+    std::vector<std::vector<VkCommandBuffer>> m_threadCommandBuffers;   // [frame][thread]
+    std::vector<double> m_threadRecordTimes;                // Each thread's recording time (ms) since the last report
+    uint32_t m_recordTimedFrames = 0;
+
+    const uint32_t RECORD_TIMING_FRAMES = 1000;             // How often the per thread timings get printed
+
     std::vector<VkSemaphore> m_imageAvailableSemaphores;    // Semaphore for each frame
     std::vector<VkSemaphore> m_renderFinishedSemaphores;
     std::vector<VkFence> m_inFlightFences;                  // Sync GPU and CPU
     std::vector<VkFence> m_imagesInFlight;
     size_t m_currentFrame = 0;
 
+    LatencyMode m_latencyMode = LatencyMode::Balanced;
+    uint32_t m_framesInFlight = 2;                          // Set from the latency mode, everything per frame is sized by it
+
     const uint32_t WIDTH = 800;
     const uint32_t HIGHT = 600;
 
-    const std::string MODEL_PATH = "Models/viking_room.txt";
-    const std::string TEXTURE_PATH = "Textures/viking_room.png";
+    // Each one becomes a mesh in the shared buffers, the scene cycles through them
+    const std::vector<std::string> MODEL_PATHS = {
+        "Models/viking_room.txt"
+    };
+    // Decoded in parallel on startup, the PNGs on a pool of worker threads
+    const std::vector<std::string> TEXTURE_PATHS = {
+        "Textures/viking_room.png"
+    };
+    // Pre-compressed versions of a texture (its name without the extension plus one of these), the first usable one wins
+    // ASTC first since a device with it usually has no BC, then BC7, then anything else in a KTX2 or DDS
+    const std::vector<std::string> COMPRESSED_TEXTURE_SUFFIXES = {
+        "_astc.ktx2", "_bc7.ktx2", ".ktx2", ".dds"
+    };
+    // Every shader a pipeline might want, every variant as the device hasn't picked one when they're compiled
+    // Defines are kept for what changes the shader's interface (vertex layout, descriptor types), anything else that can be
+    // toggled is a specialisation constant
+    const std::vector<ShaderVariant> SHADER_VARIANTS = {
+        { "Vertex_Shader.spv", "Vertex_Shader.vert", {} },
+        { "Vertex_Shader_Compact.spv", "Vertex_Shader.vert", { "COMPACT_VERTEX" } },
+        { "Instanced_Shader.spv", "Instanced_Shader.vert", {} },
+        { "Instanced_Shader_Compact.spv", "Instanced_Shader.vert", { "COMPACT_VERTEX" } },
+        { "Frag_Shader.spv", "Frag_Shader.frag", {} },
+        { "Frag_Shader_Bindless.spv", "Frag_Shader.frag", { "BINDLESS" } },
+        { "Cull_Shader.spv", "Cull_Shader.comp", {} }
+    };
+    const std::string SHADER_CACHE_DIRECTORY = "shader_cache";
+    const std::string PIPELINE_CACHE_PATH = "pipeline_cache.bin";
 
     VkInstance m_instance = VK_NULL_HANDLE;                        // The vulkan library instance
     VkDebugUtilsMessengerEXT m_debugMessenger = VK_NULL_HANDLE;    // The vulkan debug messenger
@@ -238,6 +721,23 @@ private:
     VkDevice m_device = VK_NULL_HANDLE;                            // Logical device handle
     VkQueue m_graphicsQueue = VK_NULL_HANDLE;                      // Handle for the graphics queues made by the device
     VkQueue m_presentQueue = VK_NULL_HANDLE;                       // Handle for presentation queues
+    VkQueue m_transferQueue = VK_NULL_HANDLE;                      // Dedicated transfer queue, the graphics queue if there isn't one
+    DeviceMemoryAllocator m_allocator;                             // Where every buffer and image gets its memory from
+    UploadContext m_uploads;                                       // Batches the staging copies instead of waiting on each one
+    Profiler m_profiler;                                           // GPU scopes and CPU frame stages, P dumps them to the console
+    bool m_profilerKeyDown = false;
+
+    // Memory budget: each heap's usage against its budget, the driver's numbers if there's VK_EXT_memory_budget
+    // Looked at every MEMORY_CHECK_INTERVAL frames, the device local total goes in the window title and a heap passing
+    // MEMORY_WARNING_FRACTION of its budget is warned about (once, until it drops back under)
+    // M dumps the allocator's stats: the heaps, the memory types and what each category has allocated
+    bool m_memoryBudget = false;
+    std::vector<bool> m_heapsNearBudget;
+    uint32_t m_framesSinceMemoryCheck = 0;
+    bool m_memoryKeyDown = false;
+    const uint32_t MEMORY_CHECK_INTERVAL = 120;
+    const float MEMORY_WARNING_FRACTION = 0.9f;
+    std::chrono::high_resolution_clock::time_point m_lastFrameStart;
 
     const std::vector<const char*> m_deviceExtensions = {
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME
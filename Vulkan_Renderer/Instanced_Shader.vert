@@ -0,0 +1,46 @@
+// Specify the version of glsl
+#version 450
+
+#extension GL_KHR_vulkan_glsl : enable
+
+// Per frame data
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 view;
+    mat4 proj;
+    mat4 viewProj;
+} ubo;
+
+// Vertex positions and colour, binding 0 moves on every vertex
+// COMPACT_VERTEX works the same as in Vertex_Shader.vert
+layout(location = 0) in vec3 inPosition;
+#ifndef COMPACT_VERTEX
+layout(location = 1) in vec3 inColour;
+#endif
+layout(location = 2) in vec2 inTexCoord;
+
+// Per instance data, binding 1 only moves on every instance
+// A mat4 takes four locations, one for each column
+layout(location = 3) in mat4 inModel;
+layout(location = 7) in vec4 inTint;
+layout(location = 8) in uint inTexture;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragTexture;
+
+
+// The same as Vertex_Shader.vert, but the transform comes from the instance buffer
+void main() 
+{
+    gl_Position = ubo.viewProj * inModel * vec4(inPosition, 1.0);
+
+    // Each copy can be tinted differently
+#ifdef COMPACT_VERTEX
+    fragColor = inTint.rgb;
+#else
+    fragColor = inColour * inTint.rgb;
+#endif
+
+    fragTexCoord = inTexCoord;
+    fragTexture = inTexture;
+}
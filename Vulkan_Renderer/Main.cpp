@@ -1,10 +1,40 @@
 #include "HelloTriangleApp.h"
 
+#include <cstring>
 #include <iostream>
 
-int main() {
+int main(int argc, char** argv) {
     HelloTriangleApplication app;
 
+    // --static replays the draws recorded once at startup instead of recording every frame (nothing animates)
+    // --record-threads N records the draws on N worker threads (0, the default, records them on the main thread)
+    // --props N adds an N by N grid of props drawn as a single instanced batch
+    // --low-latency for interactive use, --throughput for capture, otherwise the balanced default
+    // --benchmark N renders N frames headless and writes the report to --report (benchmark.json if not given)
+    // --target-fps N sets the frame rate the MSAA and render scale adapt to hold (60 by default, 0 for always full quality)
+    uint32_t benchmarkFrames = 0;
+    std::string reportPath = "benchmark.json";
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--static") == 0)
+            app.SetStaticScene(true);
+        else if (strcmp(argv[i], "--record-threads") == 0 && i + 1 < argc)
+            app.SetRecordThreads(static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)));
+        else if (strcmp(argv[i], "--props") == 0 && i + 1 < argc)
+            app.SetPropGridSize(static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)));
+        else if (strcmp(argv[i], "--low-latency") == 0)
+            app.SetLatencyMode(LatencyMode::LowLatency);
+        else if (strcmp(argv[i], "--throughput") == 0)
+            app.SetLatencyMode(LatencyMode::Throughput);
+        else if (strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc)
+            benchmarkFrames = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc)
+            reportPath = argv[++i];
+        else if (strcmp(argv[i], "--target-fps") == 0 && i + 1 < argc)
+            app.SetTargetFrameRate(strtof(argv[++i], nullptr));
+    }
+    if (benchmarkFrames > 0)
+        app.SetBenchmark(benchmarkFrames, reportPath);
+
     try {
         app.Run();
     }
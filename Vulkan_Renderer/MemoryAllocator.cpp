@@ -0,0 +1,403 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+
+#include "MemoryAllocator.h"
+
+// =================================================
+// Name: Init
+// Desc: Caches the device's memory types and limits, no memory is allocated until it's asked for
+// Params: physicalDevice, device, blockSize
+// Return: NONE
+void DeviceMemoryAllocator::Init(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize)
+{
+    m_physicalDevice = physicalDevice;
+    m_device = device;
+    m_blockSize = blockSize;
+
+    // Gets two arrays, memoryType and memoryHeap
+    vkGetPhysicalDeviceMemoryProperties(m_physicalDevice, &m_memoryProperties);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+    m_maxAllocationCount = properties.limits.maxMemoryAllocationCount;
+}
+// =================================================
+// Name: Destroy
+// Desc: Frees every block, anything still pointing into them is left dangling
+// Params: NONE
+// Return: NONE
+void DeviceMemoryAllocator::Destroy()
+{
+    for (std::vector<MemoryBlock>& pool : m_pools) {
+        for (MemoryBlock& block : pool) {
+            if (block.allocationCount != 0)
+                printf("Allocator: block of %llu bytes destroyed with %u live allocations\n",
+                    static_cast<unsigned long long>(block.size), block.allocationCount);
+
+            // Freeing memory implicitly unmaps it
+            vkFreeMemory(m_device, block.memory, nullptr);
+        }
+        pool.clear();
+    }
+
+    m_deviceAllocationCount = 0;
+    for (MemoryUsage& category : m_categories)
+        category = MemoryUsage{};
+}
+// =================================================
+// Name: FindMemoryType
+// Desc: Finds a memory type which the resource can use and has all the properties asked for
+// Params: filter, flags
+// Return: uint32_t
+uint32_t DeviceMemoryAllocator::FindMemoryType(uint32_t filter, VkMemoryPropertyFlags flags) const
+{
+    // Check for a suitable memory type (can hold vertex data, can be read and written to)
+    for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; ++i) {
+        if (filter & (1 << i) && (m_memoryProperties.memoryTypes[i].propertyFlags & flags) == flags)
+            return i;
+    }
+
+    // No check for memoryHeap, can lead to less then desirable performance
+
+    // If nothing suitable is found assert false
+    assert(false);
+    return UINT32_MAX;
+}
+// =================================================
+// Name: HasMemoryType
+// Desc: Whether any memory type the resource can use has all the properties, without asserting like FindMemoryType
+// Params: filter, flags
+// Return: bool
+bool DeviceMemoryAllocator::HasMemoryType(uint32_t filter, VkMemoryPropertyFlags flags) const
+{
+    for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; ++i) {
+        if (filter & (1 << i) && (m_memoryProperties.memoryTypes[i].propertyFlags & flags) == flags)
+            return true;
+    }
+    return false;
+}
+// =================================================
+// Name: BlockSizeFor
+// Desc: The standard block size, shrunk for small heaps so one block can't eat most of it
+// Params: memoryType
+// Return: VkDeviceSize
+VkDeviceSize DeviceMemoryAllocator::BlockSizeFor(uint32_t memoryType) const
+{
+    const VkDeviceSize heapSize = m_memoryProperties.memoryHeaps[m_memoryProperties.memoryTypes[memoryType].heapIndex].size;
+    return std::min(m_blockSize, heapSize / 8);
+}
+// =================================================
+// Name: CreateBlock
+// Desc: Allocates a new block of device memory for a pool, mapping it if it's host visible
+// Params: memoryType, size, dedicated, pool
+// Return: MemoryBlock*
+DeviceMemoryAllocator::MemoryBlock* DeviceMemoryAllocator::CreateBlock(uint32_t memoryType, VkDeviceSize size, bool dedicated,
+    std::vector<MemoryBlock>& pool)
+{
+    // This is the limit the per resource allocations would have hit
+    assert(m_deviceAllocationCount < m_maxAllocationCount);
+
+    VkMemoryAllocateInfo allocInfo;
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.pNext = nullptr;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    MemoryBlock block;
+    block.size = size;
+    block.dedicated = dedicated;
+    block.freeRanges.push_back({ 0, size });    // All of it is free to start with
+
+    assert(vkAllocateMemory(m_device, &allocInfo, nullptr, &block.memory) == VK_SUCCESS);
+    ++m_deviceAllocationCount;
+
+    // Keep host visible blocks mapped for their whole life, mapping is a driver call we don't want per update
+    if (m_memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+        vkMapMemory(m_device, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mapped);
+
+    pool.push_back(block);
+    return &pool.back();
+}
+// =================================================
+// Name: AllocateFromBlock
+// Desc: First fit search of the block's free ranges, splitting off whatever is left either side
+// Params: block, size, alignment, offset
+// Return: bool
+bool DeviceMemoryAllocator::AllocateFromBlock(MemoryBlock& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+{
+    for (size_t i = 0; i < block.freeRanges.size(); ++i) {
+        const FreeRange range = block.freeRanges[i];
+
+        // Alignment is always a power of 2 (the spec guarantees it)
+        const VkDeviceSize alignedOffset = (range.offset + alignment - 1) & ~(alignment - 1);
+        if (alignedOffset + size > range.offset + range.size)
+            continue;
+
+        // Swap the range for what's left before and after the allocation
+        block.freeRanges.erase(block.freeRanges.begin() + i);
+
+        const VkDeviceSize tailOffset = alignedOffset + size;
+        const VkDeviceSize tailSize = range.offset + range.size - tailOffset;
+        if (tailSize > 0)
+            block.freeRanges.insert(block.freeRanges.begin() + i, { tailOffset, tailSize });
+        if (alignedOffset > range.offset)
+            block.freeRanges.insert(block.freeRanges.begin() + i, { range.offset, alignedOffset - range.offset });
+
+        offset = alignedOffset;
+        return true;
+    }
+
+    return false;
+}
+// =================================================
+// Name: ReleaseRange
+// Desc: Gives a range back to the block, merging it with any free neighbours
+// Params: block, offset, size
+// Return: NONE
+void DeviceMemoryAllocator::ReleaseRange(MemoryBlock& block, VkDeviceSize offset, VkDeviceSize size)
+{
+    // Find where it goes to keep the list sorted
+    auto next = std::lower_bound(block.freeRanges.begin(), block.freeRanges.end(), offset,
+        [](const FreeRange& range, VkDeviceSize value) { return range.offset < value; });
+    next = block.freeRanges.insert(next, { offset, size });
+
+    // Merge with the range after
+    auto after = next + 1;
+    if (after != block.freeRanges.end() && next->offset + next->size == after->offset) {
+        next->size += after->size;
+        block.freeRanges.erase(after);
+    }
+
+    // And the one before
+    if (next != block.freeRanges.begin()) {
+        auto before = next - 1;
+        if (before->offset + before->size == next->offset) {
+            before->size += next->size;
+            block.freeRanges.erase(next);
+        }
+    }
+}
+// =================================================
+// Name: Allocate
+// Desc: Sub-allocates memory meeting the requirements, making a new block if none of the existing ones fit
+//       preferredFlags are added on top of flags if there's a memory type with both, and dropped if there isn't
+// Params: requirements, flags, linearResource, category, preferredFlags
+// Return: MemoryAllocation
+MemoryAllocation DeviceMemoryAllocator::Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags flags, bool linearResource,
+    MemoryCategory category, VkMemoryPropertyFlags preferredFlags)
+{
+    if (preferredFlags != 0 && HasMemoryType(requirements.memoryTypeBits, flags | preferredFlags))
+        flags |= preferredFlags;
+
+    MemoryAllocation allocation;
+    allocation.memoryType = FindMemoryType(requirements.memoryTypeBits, flags);
+    allocation.pool = allocation.memoryType * 2 + (linearResource ? 1 : 0);
+    allocation.size = requirements.size;
+    allocation.category = category;
+
+    std::vector<MemoryBlock>& pool = m_pools[allocation.pool];
+    const VkDeviceSize blockSize = BlockSizeFor(allocation.memoryType);
+
+    MemoryBlock* target = nullptr;
+
+    // Anything bigger than half a block would waste most of it, so it gets its own
+    // Lazy memory too, sharing a block would have the driver commit it for everything in there
+    const bool lazy = (GetMemoryTypeFlags(allocation.memoryType) & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
+    if (requirements.size > blockSize / 2 || lazy) {
+        target = CreateBlock(allocation.memoryType, requirements.size, true, pool);
+        AllocateFromBlock(*target, requirements.size, requirements.alignment, allocation.offset);
+    }
+    else {
+        for (MemoryBlock& block : pool) {
+            if (!block.dedicated && block.size - block.used >= requirements.size &&
+                AllocateFromBlock(block, requirements.size, requirements.alignment, allocation.offset)) {
+                target = &block;
+                break;
+            }
+        }
+
+        if (target == nullptr) {
+            target = CreateBlock(allocation.memoryType, blockSize, false, pool);
+            const bool allocated = AllocateFromBlock(*target, requirements.size, requirements.alignment, allocation.offset);
+            assert(allocated);
+        }
+    }
+
+    target->used += requirements.size;
+    ++target->allocationCount;
+
+    MemoryUsage& categoryUsage = m_categories[static_cast<uint32_t>(category)];
+    categoryUsage.used += requirements.size;
+    ++categoryUsage.allocations;
+
+    allocation.memory = target->memory;
+    if (target->mapped != nullptr)
+        allocation.mapped = static_cast<char*>(target->mapped) + allocation.offset;
+
+    return allocation;
+}
+// =================================================
+// Name: Free
+// Desc: Returns an allocation to its block. Dedicated blocks are released straight away, normal ones are kept for reuse
+// Params: allocation
+// Return: NONE
+void DeviceMemoryAllocator::Free(MemoryAllocation& allocation)
+{
+    if (allocation.memory == VK_NULL_HANDLE)
+        return;
+
+    std::vector<MemoryBlock>& pool = m_pools[allocation.pool];
+    auto block = std::find_if(pool.begin(), pool.end(),
+        [&allocation](const MemoryBlock& candidate) { return candidate.memory == allocation.memory; });
+    assert(block != pool.end());
+
+    ReleaseRange(*block, allocation.offset, allocation.size);
+    block->used -= allocation.size;
+    --block->allocationCount;
+
+    MemoryUsage& categoryUsage = m_categories[static_cast<uint32_t>(allocation.category)];
+    categoryUsage.used -= allocation.size;
+    --categoryUsage.allocations;
+
+    if (block->dedicated && block->allocationCount == 0) {
+        vkFreeMemory(m_device, block->memory, nullptr);
+        --m_deviceAllocationCount;
+        pool.erase(block);
+    }
+
+    allocation = MemoryAllocation{};
+}
+// =================================================
+// Name: DumpStats
+// Desc: Prints each heap against its budget, the blocks, used and free bytes and fragmentation for each memory type in
+//       use, then what each category has allocated
+// Params: NONE
+// Return: NONE
+void DeviceMemoryAllocator::DumpStats() const
+{
+    printf("---- Device memory: %u of %u allocations ----\n", m_deviceAllocationCount, m_maxAllocationCount);
+
+    const std::vector<HeapBudget> heaps = GetHeapBudgets();
+    for (size_t h = 0; h < heaps.size(); ++h) {
+        const HeapBudget& heap = heaps[h];
+        printf("Heap %zu (%s, %.0f MB): %.2f of %.2f MB budget %s (%.1f%%), ours %.2f MB in blocks with %.2f MB used\n",
+            h, heap.deviceLocal ? "device local" : "host", heap.size / (1024.0 * 1024.0), heap.usage / (1024.0 * 1024.0),
+            heap.budget / (1024.0 * 1024.0), heap.fromDriver ? "from the driver" : "estimated",
+            heap.budget > 0 ? 100.0 * heap.usage / heap.budget : 0.0, heap.reserved / (1024.0 * 1024.0), heap.used / (1024.0 * 1024.0));
+    }
+
+    for (uint32_t p = 0; p < POOL_COUNT; ++p) {
+        const std::vector<MemoryBlock>& pool = m_pools[p];
+        if (pool.empty())
+            continue;
+
+        VkDeviceSize total = 0, used = 0, largestFree = 0;
+        uint32_t allocations = 0, freeRanges = 0;
+        for (const MemoryBlock& block : pool) {
+            total += block.size;
+            used += block.used;
+            allocations += block.allocationCount;
+            freeRanges += static_cast<uint32_t>(block.freeRanges.size());
+            for (const FreeRange& range : block.freeRanges)
+                largestFree = std::max(largestFree, range.size);
+        }
+
+        // 0% means all the free space is one range, closer to 100% means it's split into lots of small gaps
+        const VkDeviceSize freeBytes = total - used;
+        const float fragmentation = freeBytes > 0 ? 100.0f * (1.0f - static_cast<float>(largestFree) / static_cast<float>(freeBytes)) : 0.0f;
+
+        const uint32_t memoryType = p / 2;
+        printf("Type %u (%s, flags 0x%x): %zu blocks, %u allocations, %.2f MB used, %.2f MB free in %u ranges, %.1f%% fragmented\n",
+            memoryType, (p & 1) ? "linear" : "optimal", m_memoryProperties.memoryTypes[memoryType].propertyFlags,
+            pool.size(), allocations, used / (1024.0 * 1024.0), freeBytes / (1024.0 * 1024.0), freeRanges, fragmentation);
+    }
+
+    for (uint32_t c = 0; c < CATEGORY_COUNT; ++c) {
+        printf("%s: %u allocations, %.2f MB\n", GetCategoryName(static_cast<MemoryCategory>(c)), m_categories[c].allocations,
+            m_categories[c].used / (1024.0 * 1024.0));
+    }
+}
+// =================================================
+// Name: GetUsage
+// Desc: Adds up the blocks and what's been handed out of them across every pool
+// Params: NONE
+// Return: MemoryUsage
+MemoryUsage DeviceMemoryAllocator::GetUsage() const
+{
+    MemoryUsage usage;
+    for (uint32_t p = 0; p < POOL_COUNT; ++p) {
+        for (const MemoryBlock& block : m_pools[p]) {
+            usage.used += block.used;
+            usage.reserved += block.size;
+            usage.allocations += block.allocationCount;
+            ++usage.blocks;
+        }
+    }
+    return usage;
+}
+// =================================================
+// Name: GetCategoryName
+// Desc: What a category is called in the stats and reports
+// Params: category
+// Return: const char*
+const char* DeviceMemoryAllocator::GetCategoryName(MemoryCategory category)
+{
+    switch (category) {
+    case MemoryCategory::Mesh:          return "mesh";
+    case MemoryCategory::Texture:       return "texture";
+    case MemoryCategory::RenderTarget:  return "render_target";
+    case MemoryCategory::Staging:       return "staging";
+    case MemoryCategory::Uniform:       return "uniform";
+    default:                            return "other";
+    }
+}
+// =================================================
+// Name: GetHeapBudgets
+// Desc: Every heap's size, budget and usage, plus how much of it our blocks take up
+//       The driver's numbers are only current as of the call, they move as anything on the system allocates
+// Params: NONE
+// Return: std::vector<HeapBudget>
+std::vector<HeapBudget> DeviceMemoryAllocator::GetHeapBudgets() const
+{
+    std::vector<HeapBudget> heaps(m_memoryProperties.memoryHeapCount);
+    for (uint32_t h = 0; h < m_memoryProperties.memoryHeapCount; ++h) {
+        heaps[h].size = m_memoryProperties.memoryHeaps[h].size;
+        heaps[h].deviceLocal = (m_memoryProperties.memoryHeaps[h].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+    }
+
+    for (uint32_t p = 0; p < POOL_COUNT; ++p) {
+        if (m_pools[p].empty())
+            continue;
+
+        HeapBudget& heap = heaps[m_memoryProperties.memoryTypes[p / 2].heapIndex];
+        for (const MemoryBlock& block : m_pools[p]) {
+            heap.reserved += block.size;
+            heap.used += block.used;
+        }
+    }
+
+    if (m_getMemoryProperties2 != nullptr) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budget{};
+        budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+        VkPhysicalDeviceMemoryProperties2KHR properties{};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+        properties.pNext = &budget;
+        m_getMemoryProperties2(m_physicalDevice, &properties);
+
+        for (size_t h = 0; h < heaps.size(); ++h) {
+            heaps[h].budget = budget.heapBudget[h];
+            heaps[h].usage = budget.heapUsage[h];
+            heaps[h].fromDriver = true;
+        }
+    }
+    else {
+        for (HeapBudget& heap : heaps) {
+            heap.budget = static_cast<VkDeviceSize>(heap.size * ESTIMATED_BUDGET_FRACTION);
+            heap.usage = heap.reserved;
+        }
+    }
+
+    return heaps;
+}
@@ -0,0 +1,124 @@
+#pragma once
+//---- Include Vulkan ----
+#include <vulkan/vulkan.h>
+
+//---- VS functionality includes ----
+#include <cstdint>
+#include <vector>
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
+//=================================================
+//           MemoryAllocator Structs
+//=================================================
+// What an allocation is for, so the totals can be broken down (and a leak in one kind spotted)
+enum class MemoryCategory : uint32_t {
+    Mesh,           // Vertex, index, instance and mesh range buffers
+    Texture,
+    RenderTarget,   // Depth, MSAA colour, the scene image and offscreen swap chain images
+    Staging,
+    Uniform,        // Per frame data the CPU writes: the uniform ring and the object buffer
+    Other,          // Anything the GPU only writes for itself, like the indirect draws
+    Count
+};
+// A piece of a larger VkDeviceMemory block, what resources get bound to instead of their own allocation
+struct MemoryAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;     // The block this lives in (shared with other resources)
+    VkDeviceSize offset = 0;                    // Where it starts in the block, already aligned
+    VkDeviceSize size = 0;
+    void* mapped = nullptr;                     // Host visible blocks stay mapped, this points at offset
+    uint32_t memoryType = UINT32_MAX;
+    uint32_t pool = UINT32_MAX;                 // Which pool the block belongs to
+    MemoryCategory category = MemoryCategory::Other;
+};
+// Totals across every pool, for reports that want numbers rather than DumpStats' text
+struct MemoryUsage {
+    VkDeviceSize used = 0;                      // Bytes handed out to resources
+    VkDeviceSize reserved = 0;                  // Bytes of VkDeviceMemory behind them, used plus the free space in the blocks
+    uint32_t blocks = 0;
+    uint32_t allocations = 0;
+};
+// A memory heap's size and how close to its budget it is
+// With VK_EXT_memory_budget the budget and usage are the driver's (usage is the whole process, not just our blocks),
+// otherwise the budget is a fixed share of the heap and the usage is our blocks
+struct HeapBudget {
+    VkDeviceSize size = 0;
+    VkDeviceSize budget = 0;                    // What can be allocated before it fails or things are paged out
+    VkDeviceSize usage = 0;
+    VkDeviceSize reserved = 0;                  // Our blocks in the heap
+    VkDeviceSize used = 0;                      // What's handed out of them
+    bool deviceLocal = false;
+    bool fromDriver = false;
+};
+//=================================================
+//             DeviceMemoryAllocator
+//=================================================
+// Hands out sub-allocations from large per memory type blocks instead of a vkAllocateMemory per resource
+// Buffers/linear images and optimal images use separate pools so bufferImageGranularity never has to be handled
+// Lazily allocated memory (transient attachments on tilers) always gets a block of its own, the driver only
+// commits it if it's needed and that's tracked per VkDeviceMemory
+class DeviceMemoryAllocator {
+public:
+    // --- Public Functions ---
+    void Init(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE);
+    void Destroy();
+    MemoryAllocation Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags flags, bool linearResource,
+        MemoryCategory category, VkMemoryPropertyFlags preferredFlags = 0);
+    void Free(MemoryAllocation& allocation);
+    uint32_t FindMemoryType(uint32_t filter, VkMemoryPropertyFlags flags) const;
+    bool HasMemoryType(uint32_t filter, VkMemoryPropertyFlags flags) const;
+    VkMemoryPropertyFlags GetMemoryTypeFlags(uint32_t memoryType) const { return m_memoryProperties.memoryTypes[memoryType].propertyFlags; }
+    void DumpStats() const;
+    MemoryUsage GetUsage() const;
+    // Only used and allocations are filled in, a block is shared by anything
+    MemoryUsage GetCategoryUsage(MemoryCategory category) const { return m_categories[static_cast<uint32_t>(category)]; }
+    static const char* GetCategoryName(MemoryCategory category);
+
+    // Pass vkGetPhysicalDeviceMemoryProperties2KHR once VK_EXT_memory_budget is enabled, the heaps then use its numbers
+    void SetBudgetQuery(PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2) { m_getMemoryProperties2 = getMemoryProperties2; }
+    bool HasDriverBudget() const { return m_getMemoryProperties2 != nullptr; }
+    std::vector<HeapBudget> GetHeapBudgets() const;
+
+    // --- Public Attributes ---
+    static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+    static constexpr uint32_t CATEGORY_COUNT = static_cast<uint32_t>(MemoryCategory::Count);
+    // Without the extension, the share of a heap assumed to be ours (the rest is the OS's and other processes')
+    static constexpr float ESTIMATED_BUDGET_FRACTION = 0.8f;
+
+private:
+    // --- Private Structs ---
+    struct FreeRange {
+        VkDeviceSize offset;
+        VkDeviceSize size;
+    };
+    struct MemoryBlock {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        VkDeviceSize used = 0;
+        void* mapped = nullptr;
+        uint32_t allocationCount = 0;
+        bool dedicated = false;                 // Made for a single large resource, released as soon as it's freed
+        std::vector<FreeRange> freeRanges;      // Sorted by offset, neighbours are always merged
+    };
+    // Pools are [memoryType * 2 + linear]
+    static constexpr uint32_t POOL_COUNT = VK_MAX_MEMORY_TYPES * 2;
+
+    // --- Private Functions ---
+    MemoryBlock* CreateBlock(uint32_t memoryType, VkDeviceSize size, bool dedicated, std::vector<MemoryBlock>& pool);
+    static bool AllocateFromBlock(MemoryBlock& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+    static void ReleaseRange(MemoryBlock& block, VkDeviceSize offset, VkDeviceSize size);
+    VkDeviceSize BlockSizeFor(uint32_t memoryType) const;
+
+    // --- Private Attributes ---
+    VkPhysicalDevice m_physicalDevice = VK_NULL_HANDLE;
+    VkDevice m_device = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties m_memoryProperties{};
+    uint32_t m_maxAllocationCount = 0;          // maxMemoryAllocationCount, how many vkAllocateMemory's we're allowed
+    uint32_t m_deviceAllocationCount = 0;
+    VkDeviceSize m_blockSize = DEFAULT_BLOCK_SIZE;
+    std::vector<MemoryBlock> m_pools[POOL_COUNT];
+    MemoryUsage m_categories[CATEGORY_COUNT];
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR m_getMemoryProperties2 = nullptr;
+};
+//=================================================
+//        END OF DeviceMemoryAllocator
+//=================================================
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
@@ -0,0 +1,87 @@
+#include <cstdio>
+#include <filesystem>
+
+#include "MeshCache.h"
+
+// =================================================
+// Name: GetSourceStamp
+// Desc: Gets the size and last write time of the source file
+// Params: sourcePath, size, writeTime
+// Return: bool - false if the source can't be found
+static bool GetSourceStamp(const std::string& sourcePath, uint64_t& size, int64_t& writeTime)
+{
+    std::error_code error;
+    size = std::filesystem::file_size(sourcePath, error);
+    if (error)
+        return false;
+
+    const std::filesystem::file_time_type time = std::filesystem::last_write_time(sourcePath, error);
+    if (error)
+        return false;
+
+    writeTime = static_cast<int64_t>(time.time_since_epoch().count());
+    return true;
+}
+// =================================================
+// Name: MeshCachePath
+// Desc: The cache sits next to the source with an extra extension
+// Params: sourcePath
+// Return: std::string
+std::string MeshCachePath(const std::string& sourcePath)
+{
+    return sourcePath + ".mesh";
+}
+// =================================================
+// Name: OpenMeshCache
+// Desc: Opens the cache file and validates the header against the source file
+// Params: sourcePath, vertexStride, file, header
+// Return: bool
+bool OpenMeshCache(const std::string& sourcePath, uint32_t vertexStride, std::ifstream& file, MeshCacheHeader& header)
+{
+    uint64_t sourceSize = 0;
+    int64_t sourceWriteTime = 0;
+    if (!GetSourceStamp(sourcePath, sourceSize, sourceWriteTime))
+        return false;
+
+    file.open(MeshCachePath(sourcePath), std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file)
+        return false;
+
+    // Anything different means the cache is stale (or from an older build) so rebuild it
+    if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION || header.vertexStride != vertexStride ||
+        header.sourceSize != sourceSize || header.sourceWriteTime != sourceWriteTime) {
+        printf("%s", "Mesh cache out of date, rebuilding from source\n");
+        return false;
+    }
+
+    return true;
+}
+// =================================================
+// Name: WriteMeshCache
+// Desc: Writes the header followed by the tightly packed vertex and index blobs
+// Params: sourcePath, vertexStride, vertexData, vertexCount, indexData, indexCount
+// Return: NONE
+void WriteMeshCache(const std::string& sourcePath, uint32_t vertexStride, const void* vertexData, uint32_t vertexCount,
+    const uint32_t* indexData, uint32_t indexCount)
+{
+    MeshCacheHeader header;
+    header.vertexStride = vertexStride;
+    header.vertexCount = vertexCount;
+    header.indexCount = indexCount;
+    if (!GetSourceStamp(sourcePath, header.sourceSize, header.sourceWriteTime))
+        return;
+
+    std::ofstream file(MeshCachePath(sourcePath), std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        printf("%s", "Failed to write mesh cache, the source will be parsed again next run\n");
+        return;
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(static_cast<const char*>(vertexData), static_cast<std::streamsize>(vertexStride) * vertexCount);
+    file.write(reinterpret_cast<const char*>(indexData), static_cast<std::streamsize>(sizeof(uint32_t)) * indexCount);
+}
@@ -0,0 +1,81 @@
+#pragma once
+//---- VS functionality includes ----
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
+//=================================================
+//                Mesh Cache
+//=================================================
+// A binary copy of a loaded (deduplicated and optimised) model, saved next to the source file
+// Layout: MeshCacheHeader | vertex blob (vertexCount * vertexStride) | index blob (indexCount * uint32_t)
+
+// Bump this whenever the loading or optimising steps change what ends up in the blobs
+const uint32_t MESH_CACHE_VERSION = 1;
+const uint32_t MESH_CACHE_MAGIC = 0x534D4B56;   // "VKMS"
+
+struct MeshCacheHeader {
+    uint32_t magic = MESH_CACHE_MAGIC;
+    uint32_t version = MESH_CACHE_VERSION;
+    uint32_t vertexStride = 0;      // sizeof the vertex struct it was written with
+    uint32_t vertexCount = 0;
+    uint32_t indexCount = 0;
+    uint32_t padding = 0;
+    uint64_t sourceSize = 0;        // The source file's size and last write time when the cache was built
+    int64_t sourceWriteTime = 0;    // if either changes the cache is rebuilt
+};
+
+// Where the cache for a source file lives
+std::string MeshCachePath(const std::string& sourcePath);
+
+// Opens the cache and checks it still matches the source, leaving the file at the start of the vertex blob
+bool OpenMeshCache(const std::string& sourcePath, uint32_t vertexStride, std::ifstream& file, MeshCacheHeader& header);
+
+// Writes the header and both blobs, failing quietly (we just parse the source again next time)
+void WriteMeshCache(const std::string& sourcePath, uint32_t vertexStride, const void* vertexData, uint32_t vertexCount,
+                    const uint32_t* indexData, uint32_t indexCount);
+
+// =================================================
+// Name: ReadMeshCache
+// Desc: Reads the cached blobs straight into the vertex and index arrays
+// Params: sourcePath, verts, indices
+// Return: bool - false if there's no valid cache to use
+template<typename VertexType>
+bool ReadMeshCache(const std::string& sourcePath, std::vector<VertexType>& verts, std::vector<uint32_t>& indices)
+{
+    std::ifstream file;
+    MeshCacheHeader header;
+    if (!OpenMeshCache(sourcePath, static_cast<uint32_t>(sizeof(VertexType)), file, header))
+        return false;
+
+    // No parsing, the blobs are already laid out exactly how the GPU wants them
+    verts.resize(header.vertexCount);
+    indices.resize(header.indexCount);
+    file.read(reinterpret_cast<char*>(verts.data()), sizeof(VertexType) * verts.size());
+    file.read(reinterpret_cast<char*>(indices.data()), sizeof(uint32_t) * indices.size());
+
+    // A truncated file is just treated as a miss
+    if (!file) {
+        verts.clear();
+        indices.clear();
+        return false;
+    }
+
+    return true;
+}
+// =================================================
+// Name: WriteMeshCache
+// Desc: Saves the arrays to the cache file for the next run
+// Params: sourcePath, verts, indices
+// Return: NONE
+template<typename VertexType>
+void WriteMeshCache(const std::string& sourcePath, const std::vector<VertexType>& verts, const std::vector<uint32_t>& indices)
+{
+    WriteMeshCache(sourcePath, static_cast<uint32_t>(sizeof(VertexType)), verts.data(), static_cast<uint32_t>(verts.size()),
+        indices.data(), static_cast<uint32_t>(indices.size()));
+}
+//=================================================
+//             END OF Mesh Cache
+//=================================================
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
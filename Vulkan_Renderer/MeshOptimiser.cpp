@@ -0,0 +1,338 @@
+#include <algorithm>
+#include <cmath>
+
+#include "MeshOptimiser.h"
+
+//---- Forsyth scoring constants ----
+// The cache the triangle ordering is modelled on, bigger than the analysed FIFO so it still holds up on newer GPUs
+const uint32_t FORSYTH_CACHE_SIZE = 32;
+const float CACHE_DECAY_POWER = 1.5f;
+const float LAST_TRI_SCORE = 0.75f;
+const float VALENCE_BOOST_SCALE = 2.0f;
+const float VALENCE_BOOST_POWER = 0.5f;
+
+// Clusters smaller than this aren't worth splitting for overdraw, the sort gains nothing on tiny pieces
+const size_t MIN_CLUSTER_TRIANGLES = 32;
+
+// =================================================
+// Name: VertexScore
+// Desc: How much we want the triangles using this vert to be drawn next
+// Params: cachePosition, remainingTris
+// Return: float
+static float VertexScore(int cachePosition, uint32_t remainingTris)
+{
+    // No triangles left means this vert can never be picked again
+    if (remainingTris == 0)
+        return -1.0f;
+
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3) {
+            // The last triangle drawn used this vert, it gets a fixed score so we don't just ping-pong around
+            score = LAST_TRI_SCORE;
+        }
+        else {
+            // Score falls off the further back in the cache it is
+            const float scaler = 1.0f / static_cast<float>(FORSYTH_CACHE_SIZE - 3);
+            score = std::pow(1.0f - static_cast<float>(cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+        }
+    }
+
+    // Boost verts with only a few triangles left so they get finished off instead of left dangling
+    score += VALENCE_BOOST_SCALE * std::pow(static_cast<float>(remainingTris), -VALENCE_BOOST_POWER);
+    return score;
+}
+// =================================================
+// Name: PositionOf
+// Desc: Gets a vert's position from a strided vertex array
+// Params: positions, stride, vertex
+// Return: const float*
+static const float* PositionOf(const float* positions, size_t stride, uint32_t vertex)
+{
+    return reinterpret_cast<const float*>(reinterpret_cast<const char*>(positions) + stride * vertex);
+}
+// =================================================
+// Name: AnalyseVertexCache
+// Desc: Runs the index buffer through a simulated FIFO cache and reports how many verts got transformed
+// Params: indices, vertexCount, cacheSize
+// Return: VertexCacheStats
+VertexCacheStats AnalyseVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize)
+{
+    VertexCacheStats stats;
+    if (indices.empty() || vertexCount == 0)
+        return stats;
+
+    // A vert is still in the FIFO if fewer than cacheSize misses have happened since it was last loaded
+    std::vector<uint32_t> timestamps(vertexCount, 0);
+    uint32_t time = cacheSize + 1;
+    uint32_t misses = 0;
+
+    std::vector<bool> referenced(vertexCount, false);
+    size_t uniqueCount = 0;
+
+    for (uint32_t index : indices) {
+        if (time - timestamps[index] > cacheSize) {
+            timestamps[index] = time++;
+            ++misses;
+        }
+
+        if (!referenced[index]) {
+            referenced[index] = true;
+            ++uniqueCount;
+        }
+    }
+
+    stats.acmr = static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+    stats.atvr = static_cast<float>(misses) / static_cast<float>(uniqueCount);
+    return stats;
+}
+// =================================================
+// Name: OptimiseVertexCache
+// Desc: Greedily emits the best scoring triangle next, only ever looking at triangles around the cache
+// Params: indices, vertexCount
+// Return: NONE
+void OptimiseVertexCache(std::vector<uint32_t>& indices, size_t vertexCount)
+{
+    const size_t triCount = indices.size() / 3;
+    if (triCount == 0 || vertexCount == 0)
+        return;
+
+    // Build the vert -> triangle adjacency, packed into one array with an offset per vert
+    std::vector<uint32_t> remaining(vertexCount, 0);     // Live triangles each vert still has
+    for (uint32_t index : indices)
+        ++remaining[index];
+
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; ++v)
+        offsets[v + 1] = offsets[v] + remaining[v];
+
+    std::vector<uint32_t> adjacency(indices.size());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t t = 0; t < triCount; ++t) {
+        for (size_t k = 0; k < 3; ++k) {
+            const uint32_t v = indices[t * 3 + k];
+            adjacency[fill[v]++] = static_cast<uint32_t>(t);
+        }
+    }
+
+    // Starting scores, no verts are in the cache yet
+    std::vector<int> cachePos(vertexCount, -1);
+    std::vector<float> vertScore(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+        vertScore[v] = VertexScore(-1, remaining[v]);
+
+    std::vector<float> triScore(triCount);
+    std::vector<bool> emitted(triCount, false);
+    for (size_t t = 0; t < triCount; ++t)
+        triScore[t] = vertScore[indices[t * 3 + 0]] + vertScore[indices[t * 3 + 1]] + vertScore[indices[t * 3 + 2]];
+
+    // Start with the best triangle overall
+    size_t bestTri = std::max_element(triScore.begin(), triScore.end()) - triScore.begin();
+    size_t scanCursor = 0;  // For when the cache runs dry and we need a fresh starting triangle
+
+    // The cache has room for three extra entries so the newest triangle can push older verts out
+    uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+    uint32_t newCache[FORSYTH_CACHE_SIZE + 3];
+    uint32_t cacheCount = 0;
+
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+
+    while (output.size() < indices.size()) {
+        emitted[bestTri] = true;
+        const uint32_t tri[3] = { indices[bestTri * 3 + 0], indices[bestTri * 3 + 1], indices[bestTri * 3 + 2] };
+
+        uint32_t newCount = 0;
+        for (uint32_t v : tri) {
+            output.push_back(v);
+
+            // Take the triangle off the vert's live list (swap with the last one)
+            uint32_t* list = &adjacency[offsets[v]];
+            for (uint32_t j = 0; j < remaining[v]; ++j) {
+                if (list[j] == bestTri) {
+                    list[j] = list[remaining[v] - 1];
+                    --remaining[v];
+                    break;
+                }
+            }
+
+            // The triangle's verts go to the front of the cache (once each for degenerate triangles)
+            if (std::find(newCache, newCache + newCount, v) == newCache + newCount)
+                newCache[newCount++] = v;
+        }
+
+        // Followed by everything that was already in there
+        for (uint32_t i = 0; i < cacheCount; ++i) {
+            const uint32_t v = cache[i];
+            if (v != tri[0] && v != tri[1] && v != tri[2])
+                newCache[newCount++] = v;
+        }
+
+        // Re-score everything that moved, anything past the end has been evicted
+        for (uint32_t i = 0; i < newCount; ++i) {
+            const uint32_t v = newCache[i];
+            cachePos[v] = i < FORSYTH_CACHE_SIZE ? static_cast<int>(i) : -1;
+
+            const float score = VertexScore(cachePos[v], remaining[v]);
+            const float delta = score - vertScore[v];
+            vertScore[v] = score;
+
+            for (uint32_t j = 0; j < remaining[v]; ++j)
+                triScore[adjacency[offsets[v] + j]] += delta;
+        }
+
+        cacheCount = std::min(newCount, FORSYTH_CACHE_SIZE);
+        std::copy(newCache, newCache + cacheCount, cache);
+
+        // The next triangle has to use a cached vert, so only those need checking
+        float bestScore = -1.0f;
+        bool found = false;
+        for (uint32_t i = 0; i < cacheCount; ++i) {
+            const uint32_t v = cache[i];
+            for (uint32_t j = 0; j < remaining[v]; ++j) {
+                const uint32_t t = adjacency[offsets[v] + j];
+                if (triScore[t] > bestScore) {
+                    bestScore = triScore[t];
+                    bestTri = t;
+                    found = true;
+                }
+            }
+        }
+
+        // Nothing around the cache, so start again from the next triangle that hasn't been drawn
+        if (!found) {
+            while (scanCursor < triCount && emitted[scanCursor])
+                ++scanCursor;
+
+            if (scanCursor == triCount)
+                break;
+
+            bestTri = scanCursor;
+        }
+    }
+
+    indices.swap(output);
+}
+// =================================================
+// Name: OptimiseOverdraw
+// Desc: Sorts clusters so the ones facing away from the middle are drawn first, letting early-z reject what's behind
+// Params: indices, positions, vertexCount, stride
+// Return: NONE
+void OptimiseOverdraw(std::vector<uint32_t>& indices, const float* positions, size_t vertexCount, size_t stride)
+{
+    const size_t triCount = indices.size() / 3;
+    if (triCount <= MIN_CLUSTER_TRIANGLES || vertexCount == 0)
+        return;
+
+    // Split wherever a triangle misses the cache on all three verts. The cache is cold there anyway,
+    // so moving the clusters around barely changes the ACMR from the cache pass
+    std::vector<size_t> clusterStarts = { 0 };
+    std::vector<uint32_t> timestamps(vertexCount, 0);
+    uint32_t time = VERTEX_CACHE_SIZE + 1;
+
+    for (size_t t = 0; t < triCount; ++t) {
+        uint32_t misses = 0;
+        for (size_t k = 0; k < 3; ++k) {
+            const uint32_t v = indices[t * 3 + k];
+            if (time - timestamps[v] > VERTEX_CACHE_SIZE) {
+                timestamps[v] = time++;
+                ++misses;
+            }
+        }
+
+        if (misses == 3 && t - clusterStarts.back() >= MIN_CLUSTER_TRIANGLES)
+            clusterStarts.push_back(t);
+    }
+    clusterStarts.push_back(triCount);
+
+    const size_t clusterCount = clusterStarts.size() - 1;
+    if (clusterCount <= 1)
+        return;
+
+    // The middle of the mesh
+    float meshCentre[3] = { 0.0f, 0.0f, 0.0f };
+    for (size_t v = 0; v < vertexCount; ++v) {
+        const float* p = PositionOf(positions, stride, static_cast<uint32_t>(v));
+        for (size_t c = 0; c < 3; ++c)
+            meshCentre[c] += p[c];
+    }
+    for (float& c : meshCentre)
+        c /= static_cast<float>(vertexCount);
+
+    // Score each cluster by how far it faces outwards from the middle
+    std::vector<float> sortKeys(clusterCount);
+    for (size_t i = 0; i < clusterCount; ++i) {
+        float centre[3] = { 0.0f, 0.0f, 0.0f };
+        float normal[3] = { 0.0f, 0.0f, 0.0f };
+        float totalArea = 0.0f;
+
+        for (size_t t = clusterStarts[i]; t < clusterStarts[i + 1]; ++t) {
+            const float* a = PositionOf(positions, stride, indices[t * 3 + 0]);
+            const float* b = PositionOf(positions, stride, indices[t * 3 + 1]);
+            const float* c = PositionOf(positions, stride, indices[t * 3 + 2]);
+
+            const float ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+            const float ac[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+            // Cross product length is double the area, so it weights both sums for free
+            const float cross[3] = {
+                ab[1] * ac[2] - ab[2] * ac[1],
+                ab[2] * ac[0] - ab[0] * ac[2],
+                ab[0] * ac[1] - ab[1] * ac[0]
+            };
+            const float area = std::sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]);
+
+            for (size_t k = 0; k < 3; ++k) {
+                centre[k] += (a[k] + b[k] + c[k]) / 3.0f * area;
+                normal[k] += cross[k];
+            }
+            totalArea += area;
+        }
+
+        const float normalLength = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (totalArea <= 0.0f || normalLength <= 0.0f) {
+            sortKeys[i] = 0.0f;
+            continue;
+        }
+
+        float key = 0.0f;
+        for (size_t k = 0; k < 3; ++k)
+            key += (centre[k] / totalArea - meshCentre[k]) * (normal[k] / normalLength);
+        sortKeys[i] = key;
+    }
+
+    // Most outward facing first, stable so matching clusters keep their cache friendly order
+    std::vector<size_t> order(clusterCount);
+    for (size_t i = 0; i < clusterCount; ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&sortKeys](size_t l, size_t r) { return sortKeys[l] > sortKeys[r]; });
+
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+    for (size_t cluster : order)
+        output.insert(output.end(), indices.begin() + clusterStarts[cluster] * 3, indices.begin() + clusterStarts[cluster + 1] * 3);
+
+    indices.swap(output);
+}
+// =================================================
+// Name: BuildVertexFetchRemap
+// Desc: Numbers the verts in the order the index buffer first reaches them
+// Params: indices, vertexCount
+// Return: std::vector<uint32_t>
+std::vector<uint32_t> BuildVertexFetchRemap(const std::vector<uint32_t>& indices, size_t vertexCount)
+{
+    std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+    uint32_t next = 0;
+
+    for (uint32_t index : indices) {
+        if (remap[index] == UINT32_MAX)
+            remap[index] = next++;
+    }
+
+    // Anything left over wasn't used by a triangle, keep it but out of the way
+    for (uint32_t& slot : remap) {
+        if (slot == UINT32_MAX)
+            slot = next++;
+    }
+
+    return remap;
+}
@@ -0,0 +1,61 @@
+#pragma once
+//---- VS functionality includes ----
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
+//=================================================
+//              Mesh Optimiser
+//=================================================
+// Load-time passes run over a deduplicated triangle list before it gets uploaded
+// 1) OptimiseVertexCache  - reorder triangles so recently transformed verts get reused
+// 2) OptimiseOverdraw     - reorder clusters of triangles so the outward facing ones draw first
+// 3) OptimiseVertexFetch  - reorder the verts themselves in the order the indices first touch them
+
+// The size of the post-transform cache the passes and stats assume
+const uint32_t VERTEX_CACHE_SIZE = 16;
+
+struct VertexCacheStats {
+    float acmr = 0.0f;      // Average cache miss ratio - vertex shader runs per triangle (0.5 - 3, lower is better)
+    float atvr = 0.0f;      // Average transform to vertex ratio - vertex shader runs per vertex (1 is perfect)
+};
+
+// Simulates a FIFO post-transform cache over the index buffer
+VertexCacheStats AnalyseVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Tom Forsyth's linear-speed vertex cache optimisation, reorders the triangles in place
+void OptimiseVertexCache(std::vector<uint32_t>& indices, size_t vertexCount);
+
+// Splits the (cache optimised) triangles where the cache restarts anyway, then sorts those clusters outside-in
+// positions points at the first vert's position (3 floats), stride is the size of a whole vert in bytes
+void OptimiseOverdraw(std::vector<uint32_t>& indices, const float* positions, size_t vertexCount, size_t stride);
+
+// Builds a table mapping old vertex indices to their new location, in order of first use
+// Verts that are never referenced are moved to the end
+std::vector<uint32_t> BuildVertexFetchRemap(const std::vector<uint32_t>& indices, size_t vertexCount);
+
+// =================================================
+// Name: OptimiseVertexFetch
+// Desc: Reorders the verts for memory locality and rewrites the indices to match
+// Params: verts, indices
+// Return: NONE
+template<typename VertexType>
+void OptimiseVertexFetch(std::vector<VertexType>& verts, std::vector<uint32_t>& indices)
+{
+    const std::vector<uint32_t> remap = BuildVertexFetchRemap(indices, verts.size());
+
+    // Move every vert to its new slot
+    std::vector<VertexType> reordered(verts.size());
+    for (size_t i = 0; i < verts.size(); ++i)
+        reordered[remap[i]] = verts[i];
+
+    // And point the indices at the new slots
+    for (uint32_t& index : indices)
+        index = remap[index];
+
+    verts.swap(reordered);
+}
+//=================================================
+//           END OF Mesh Optimiser
+//=================================================
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
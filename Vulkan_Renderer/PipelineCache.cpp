@@ -0,0 +1,98 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "PipelineCache.h"
+
+// The header every pipeline cache blob starts with (VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+// headerSize | headerVersion | vendorID | deviceID | pipelineCacheUUID
+static const size_t PIPELINE_CACHE_HEADER_SIZE = 16 + VK_UUID_SIZE;
+
+// =================================================
+// Name: IsCacheCompatible
+// Desc: Checks the blob's header was written by this device and driver, anything else would be rejected or worse
+// Params: data, properties
+// Return: bool
+static bool IsCacheCompatible(const std::vector<char>& data, const VkPhysicalDeviceProperties& properties)
+{
+    if (data.size() < PIPELINE_CACHE_HEADER_SIZE)
+        return false;
+
+    uint32_t header[4];
+    memcpy(header, data.data(), sizeof(header));
+
+    const uint32_t headerSize = header[0];
+    const uint32_t headerVersion = header[1];
+    const uint32_t vendorID = header[2];
+    const uint32_t deviceID = header[3];
+
+    // A different driver version changes the UUID, so this catches driver updates too
+    return headerSize >= PIPELINE_CACHE_HEADER_SIZE &&
+        headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+        vendorID == properties.vendorID &&
+        deviceID == properties.deviceID &&
+        memcmp(data.data() + 16, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+// =================================================
+// Name: LoadPipelineCache
+// Desc: Reads the saved cache and hands it to the driver if it matches this device, otherwise starts empty
+// Params: device, physicalDevice, path, warm
+// Return: VkPipelineCache
+VkPipelineCache LoadPipelineCache(VkDevice device, VkPhysicalDevice physicalDevice, const std::string& path, bool& warm)
+{
+    std::vector<char> data;
+
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (file.is_open()) {
+        data.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(data.data(), data.size());
+        if (!file)
+            data.clear();
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    warm = IsCacheCompatible(data, properties);
+    if (!warm && !data.empty())
+        printf("%s", "Pipeline cache is from a different device or driver, starting a new one\n");
+
+    VkPipelineCacheCreateInfo cacheInfo{};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = warm ? data.size() : 0;
+    cacheInfo.pInitialData = warm ? data.data() : nullptr;
+
+    VkPipelineCache cache;
+    assert(vkCreatePipelineCache(device, &cacheInfo, nullptr, &cache) == VK_SUCCESS);
+
+    printf("Pipeline cache: %s (%zu bytes)\n", warm ? "warm" : "cold", warm ? data.size() : static_cast<size_t>(0));
+    return cache;
+}
+// =================================================
+// Name: SavePipelineCache
+// Desc: Gets the cache's data from the driver and writes it to disk for next time
+// Params: device, cache, path
+// Return: NONE
+void SavePipelineCache(VkDevice device, VkPipelineCache cache, const std::string& path)
+{
+    // Size first, then the data (the usual Vulkan two call pattern)
+    size_t size = 0;
+    if (vkGetPipelineCacheData(device, cache, &size, nullptr) != VK_SUCCESS || size == 0)
+        return;
+
+    std::vector<char> data(size);
+    if (vkGetPipelineCacheData(device, cache, &size, data.data()) != VK_SUCCESS)
+        return;
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        printf("%s", "Failed to write the pipeline cache, shaders will be compiled again next run\n");
+        return;
+    }
+
+    file.write(data.data(), static_cast<std::streamsize>(size));
+}
@@ -0,0 +1,23 @@
+#pragma once
+//---- Include Vulkan ----
+#include <vulkan/vulkan.h>
+
+//---- VS functionality includes ----
+#include <string>
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
+//=================================================
+//               Pipeline Cache
+//=================================================
+// The driver's compiled pipelines saved to disk, so the next run (and every pipeline rebuild) skips shader compilation
+// The blob is only any use to the exact same device and driver, which its header tells us
+
+// Creates the cache, seeded from the file if it was written by this device and driver
+// warm is set when the file was used, otherwise the cache starts empty
+VkPipelineCache LoadPipelineCache(VkDevice device, VkPhysicalDevice physicalDevice, const std::string& path, bool& warm);
+
+// Writes the cache's current contents out, failing quietly (it's just rebuilt next run)
+void SavePipelineCache(VkDevice device, VkPipelineCache cache, const std::string& path);
+//=================================================
+//           END OF Pipeline Cache
+//=================================================
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
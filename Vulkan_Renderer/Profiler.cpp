@@ -0,0 +1,352 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <iomanip>
+
+#include "Profiler.h"
+
+// =================================================
+// Name: Init
+// Desc: Makes the query pool, if the queue can write timestamps at all. Without them only the CPU timings are kept
+// Params: device, physicalDevice, queueFamily, framesInFlight
+// Return: NONE
+void Profiler::Init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t framesInFlight)
+{
+    m_device = device;
+    m_scopeNames.assign(framesInFlight, {});
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+
+    // 0 valid bits means this queue has no timestamps
+    const uint32_t validBits = queueFamily < familyCount ? families[queueFamily].timestampValidBits : 0;
+    if (validBits == 0 || properties.limits.timestampPeriod == 0.0f) {
+        printf("Profiler: no GPU timestamps on this queue, CPU timings only\n");
+        return;
+    }
+    m_timestampPeriod = properties.limits.timestampPeriod;
+    m_timestampMask = validBits >= 64 ? UINT64_MAX : (uint64_t(1) << validBits) - 1;
+
+    VkQueryPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = MAX_SCOPES * 2 * framesInFlight;
+    assert(vkCreateQueryPool(m_device, &poolInfo, nullptr, &m_queryPool) == VK_SUCCESS);
+}
+// =================================================
+// Name: Destroy
+// Desc: Destroys the query pool
+// Params: NONE
+// Return: NONE
+void Profiler::Destroy()
+{
+    if (m_queryPool != VK_NULL_HANDLE)
+        vkDestroyQueryPool(m_device, m_queryPool, nullptr);
+    m_queryPool = VK_NULL_HANDLE;
+}
+// =================================================
+// Name: SetHistorySize
+// Desc: How many samples each timing keeps, only before the first one's been added
+// Params: size
+// Return: NONE
+void Profiler::SetHistorySize(size_t size)
+{
+    m_historySize = std::max<size_t>(size, 1);
+    m_frameTimes.capacity = m_historySize;
+}
+// =================================================
+// Name: BeginFrame
+// Desc: Reads back what this frame's queries held last time round, then resets them for this one
+//       Only call once the frame's fence has been waited on
+// Params: commandBuffer, frame
+// Return: NONE
+void Profiler::BeginFrame(VkCommandBuffer commandBuffer, uint32_t frame)
+{
+    m_frame = frame;
+    if (m_queryPool == VK_NULL_HANDLE)
+        return;
+
+    ReadBack(frame);
+
+    // Has to be outside a render pass, so it's done at the start of the command buffer
+    vkCmdResetQueryPool(commandBuffer, m_queryPool, frame * MAX_SCOPES * 2, MAX_SCOPES * 2);
+}
+// =================================================
+// Name: BeginScope
+// Desc: Writes the scope's first timestamp once everything before it has started
+// Params: commandBuffer, name
+// Return: uint32_t - the scope to end, UINT32_MAX if it isn't being timed
+uint32_t Profiler::BeginScope(VkCommandBuffer commandBuffer, const char* name)
+{
+    std::vector<std::string>& names = m_scopeNames[m_frame];
+    if (m_queryPool == VK_NULL_HANDLE || names.size() == MAX_SCOPES)
+        return UINT32_MAX;
+
+    const uint32_t scope = static_cast<uint32_t>(names.size());
+    names.push_back(name);
+
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_queryPool, (m_frame * MAX_SCOPES + scope) * 2);
+    return scope;
+}
+// =================================================
+// Name: EndScope
+// Desc: Writes the scope's second timestamp once everything before it has finished
+// Params: commandBuffer, scope
+// Return: NONE
+void Profiler::EndScope(VkCommandBuffer commandBuffer, uint32_t scope)
+{
+    if (scope == UINT32_MAX)
+        return;
+
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, (m_frame * MAX_SCOPES + scope) * 2 + 1);
+}
+// =================================================
+// Name: ReadBack
+// Desc: Turns the frame's finished queries into scope times. Doesn't wait, anything not ready is just dropped
+// Params: frame
+// Return: NONE
+void Profiler::ReadBack(uint32_t frame)
+{
+    std::vector<std::string>& names = m_scopeNames[frame];
+    if (names.empty())
+        return;
+
+    std::vector<uint64_t> timestamps(names.size() * 2);
+    const VkResult result = vkGetQueryPoolResults(m_device, m_queryPool, frame * MAX_SCOPES * 2, static_cast<uint32_t>(timestamps.size()),
+        timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+    if (result == VK_SUCCESS) {
+        for (size_t i = 0; i < names.size(); ++i) {
+            const uint64_t ticks = ((timestamps[i * 2 + 1] & m_timestampMask) - (timestamps[i * 2] & m_timestampMask)) & m_timestampMask;
+            GetTiming(m_gpuTimings, names[i].c_str()).Add(static_cast<float>(ticks * m_timestampPeriod / 1000000.0));
+        }
+    }
+    names.clear();
+}
+// =================================================
+// Name: Flush
+// Desc: Reads back every frame's queries. The last few frames are never come round to again, so without this they'd
+//       be missing from the final numbers. Only once the device is idle
+// Params: NONE
+// Return: NONE
+void Profiler::Flush()
+{
+    if (m_queryPool == VK_NULL_HANDLE)
+        return;
+
+    for (uint32_t frame = 0; frame < m_scopeNames.size(); ++frame)
+        ReadBack(frame);
+}
+// =================================================
+// Name: AddCpuTime
+// Desc: Adds a sample to a named CPU timing, made the first time it's seen
+// Params: name, time
+// Return: NONE
+void Profiler::AddCpuTime(const char* name, float time)
+{
+    GetTiming(m_cpuTimings, name).Add(time);
+}
+// =================================================
+// Name: AddFrameTime
+// Desc: Adds the time since the last frame, what the histogram is made from
+// Params: time
+// Return: NONE
+void Profiler::AddFrameTime(float time)
+{
+    m_frameTimes.Add(time);
+}
+// =================================================
+// Name: GetRecentGpuTime
+// Desc: The average of a GPU scope over its newest samples, they're a few frames behind as they're read back late
+// Params: name, count
+// Return: float
+float Profiler::GetRecentGpuTime(const char* name, size_t count) const
+{
+    for (const Timing& timing : m_gpuTimings) {
+        if (timing.name == name)
+            return timing.Recent(count);
+    }
+    return 0.0f;
+}
+// =================================================
+// Name: GetRecentFrameTime
+// Desc: The average start to start frame time over the newest samples
+// Params: count
+// Return: float
+float Profiler::GetRecentFrameTime(size_t count) const
+{
+    return m_frameTimes.Recent(count);
+}
+// =================================================
+// Name: GetTiming
+// Desc: Finds a timing by name, adding it to the end if it's new so they're dumped in the order they first appeared
+// Params: timings, name
+// Return: Timing&
+Profiler::Timing& Profiler::GetTiming(std::vector<Timing>& timings, const char* name)
+{
+    for (Timing& timing : timings) {
+        if (timing.name == name)
+            return timing;
+    }
+
+    timings.push_back(Timing{});
+    timings.back().name = name;
+    timings.back().capacity = m_historySize;
+    return timings.back();
+}
+// =================================================
+// Name: Dump
+// Desc: Prints every timing's average and p99, then a histogram of the frame times
+// Params: NONE
+// Return: NONE
+void Profiler::Dump() const
+{
+    if (m_frameTimes.samples.empty())
+        return;
+
+    const float averageFrame = m_frameTimes.Average();
+    printf("---- Profiler, last %zu frames ----\n", m_frameTimes.samples.size());
+    printf("  %-16s avg %7.3fms  p99 %7.3fms  (%.1f fps)\n", "frame", averageFrame, m_frameTimes.Percentile(99.0f),
+        averageFrame > 0.0f ? 1000.0f / averageFrame : 0.0f);
+
+    for (const Timing& timing : m_cpuTimings)
+        printf("  cpu %-12s avg %7.3fms  p99 %7.3fms\n", timing.name.c_str(), timing.Average(), timing.Percentile(99.0f));
+    for (const Timing& timing : m_gpuTimings)
+        printf("  gpu %-12s avg %7.3fms  p99 %7.3fms\n", timing.name.c_str(), timing.Average(), timing.Percentile(99.0f));
+
+    // 2ms buckets, the last one catches everything slower than 30fps
+    const size_t BUCKETS = 17;
+    const float BUCKET_SIZE = 2.0f;
+    size_t counts[BUCKETS] = {};
+    size_t mostCounted = 1;
+    for (float time : m_frameTimes.samples) {
+        const size_t bucket = std::min(static_cast<size_t>(time / BUCKET_SIZE), BUCKETS - 1);
+        mostCounted = std::max(mostCounted, ++counts[bucket]);
+    }
+
+    printf("  frame time histogram:\n");
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        if (counts[i] == 0)
+            continue;
+
+        const std::string bar(counts[i] * 40 / mostCounted, '#');
+        if (i == BUCKETS - 1)
+            printf("    %5.1fms+       | %-40s %zu\n", i * BUCKET_SIZE, bar.c_str(), counts[i]);
+        else
+            printf("    %5.1f-%5.1fms  | %-40s %zu\n", i * BUCKET_SIZE, (i + 1) * BUCKET_SIZE, bar.c_str(), counts[i]);
+    }
+}
+// =================================================
+// Name: WriteJson
+// Desc: Writes every timing's stats and the raw frame times (oldest first) as a JSON object, nested one level in
+// Params: out
+// Return: NONE
+void Profiler::WriteJson(std::ostream& out) const
+{
+    const float averageFrame = m_frameTimes.Average();
+    out << std::fixed << std::setprecision(4);
+    out << "{\n";
+    out << "        \"frames\": " << m_frameTimes.samples.size() << ",\n";
+    out << "        \"fps\": " << (averageFrame > 0.0f ? 1000.0f / averageFrame : 0.0f) << ",\n";
+    out << "        \"frame_ms\": ";
+    WriteJsonStats(out, m_frameTimes);
+    out << ",\n";
+
+    const std::vector<Timing>* lists[] = { &m_cpuTimings, &m_gpuTimings };
+    const char* listNames[] = { "cpu_ms", "gpu_ms" };
+    for (size_t list = 0; list < 2; ++list) {
+        out << "        \"" << listNames[list] << "\": {";
+        for (size_t i = 0; i < lists[list]->size(); ++i) {
+            const Timing& timing = (*lists[list])[i];
+            out << (i > 0 ? "," : "") << "\n            \"" << timing.name << "\": ";
+            WriteJsonStats(out, timing);
+        }
+        out << (lists[list]->empty() ? "" : "\n        ") << "},\n";
+    }
+
+    // Unwound from the ring so they're in the order they happened
+    out << "        \"frame_times_ms\": [";
+    const size_t count = m_frameTimes.samples.size();
+    for (size_t i = 0; i < count; ++i)
+        out << (i > 0 ? ", " : "") << m_frameTimes.samples[(m_frameTimes.next + i) % count];
+    out << "]\n";
+    out << "    }";
+}
+// =================================================
+// Name: WriteJsonStats
+// Desc: Writes one timing's average, median, p99 and range as a JSON object
+// Params: out, timing
+// Return: NONE
+void Profiler::WriteJsonStats(std::ostream& out, const Timing& timing)
+{
+    out << "{ \"avg\": " << timing.Average() << ", \"p50\": " << timing.Percentile(50.0f) << ", \"p99\": " << timing.Percentile(99.0f)
+        << ", \"min\": " << timing.Percentile(0.0f) << ", \"max\": " << timing.Percentile(100.0f) << " }";
+}
+// =================================================
+// Name: Timing::Add
+// Desc: Adds a sample, replacing the oldest once the history's full
+// Params: time
+// Return: NONE
+void Profiler::Timing::Add(float time)
+{
+    if (samples.size() < capacity) {
+        samples.push_back(time);
+        return;
+    }
+
+    samples[next] = time;
+    next = (next + 1) % capacity;
+}
+// =================================================
+// Name: Timing::Average
+// Desc: The mean of the history
+// Params: NONE
+// Return: float
+float Profiler::Timing::Average() const
+{
+    if (samples.empty())
+        return 0.0f;
+
+    double total = 0.0;
+    for (float time : samples)
+        total += time;
+    return static_cast<float>(total / samples.size());
+}
+// =================================================
+// Name: Timing::Recent
+// Desc: The mean of the newest count samples, walking back from the last one written
+// Params: count
+// Return: float
+float Profiler::Timing::Recent(size_t count) const
+{
+    const size_t size = samples.size();
+    count = std::min(count, size);
+    if (count == 0)
+        return 0.0f;
+
+    // Until the history's full next stays at 0 and the newest is at the back, after that it's just before next
+    double total = 0.0;
+    for (size_t i = 0; i < count; ++i)
+        total += samples[(next + size - 1 - i) % size];
+    return static_cast<float>(total / count);
+}
+// =================================================
+// Name: Timing::Percentile
+// Desc: The sample that the given percent of the history is at or under
+// Params: percent
+// Return: float
+float Profiler::Timing::Percentile(float percent) const
+{
+    if (samples.empty())
+        return 0.0f;
+
+    std::vector<float> sorted = samples;
+    const size_t index = std::min(static_cast<size_t>(percent / 100.0f * sorted.size()), sorted.size() - 1);
+    std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+    return sorted[index];
+}
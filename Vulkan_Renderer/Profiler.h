@@ -0,0 +1,86 @@
+#pragma once
+//---- Include Vulkan ----
+#include <vulkan/vulkan.h>
+
+//---- VS functionality includes ----
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
+//=================================================
+//                   Profiler
+//=================================================
+// GPU timestamps around named scopes in each frame's command buffer, plus any CPU timings handed to it
+// Every frame in flight has its own block of queries, which are read back the next time that frame comes round
+// (its fence has been waited on by then) so nothing ever stalls waiting on a result
+// Each timing keeps its last HISTORY_SIZE samples for the averages, p99s and the frame time histogram Dump prints
+// (a benchmark run raises that to its frame count so the report covers every frame)
+class Profiler {
+public:
+    // --- Public Functions ---
+    void Init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t framesInFlight);
+    void Destroy();
+    void SetHistorySize(size_t size);
+
+    // GPU side, all recorded into the frame's primary command buffer (outside of a render pass for BeginFrame)
+    void BeginFrame(VkCommandBuffer commandBuffer, uint32_t frame);
+    uint32_t BeginScope(VkCommandBuffer commandBuffer, const char* name);
+    void EndScope(VkCommandBuffer commandBuffer, uint32_t scope);
+
+    // CPU side, in milliseconds
+    void AddCpuTime(const char* name, float time);
+    void AddFrameTime(float time);
+
+    // Mean of the newest count samples, 0 if there aren't any yet (what the adaptive quality reacts to)
+    float GetRecentGpuTime(const char* name, size_t count) const;
+    float GetRecentFrameTime(size_t count) const;
+
+    // Once the device is idle, picks up the frames that never came round again
+    void Flush();
+
+    void Dump() const;
+    void WriteJson(std::ostream& out) const;
+
+    // --- Public Attributes ---
+    static constexpr uint32_t MAX_SCOPES = 16;          // Per frame, each one takes two queries
+    static constexpr size_t HISTORY_SIZE = 512;
+
+private:
+    // --- Private Structs ---
+    // The last capacity samples, oldest overwritten first
+    struct Timing {
+        std::string name;
+        std::vector<float> samples;
+        size_t next = 0;
+        size_t capacity = HISTORY_SIZE;
+
+        void Add(float time);
+        float Average() const;
+        float Recent(size_t count) const;
+        float Percentile(float percent) const;
+    };
+
+    // --- Private Functions ---
+    Timing& GetTiming(std::vector<Timing>& timings, const char* name);
+    void ReadBack(uint32_t frame);
+    static void WriteJsonStats(std::ostream& out, const Timing& timing);
+
+    // --- Private Attributes ---
+    VkDevice m_device = VK_NULL_HANDLE;
+    VkQueryPool m_queryPool = VK_NULL_HANDLE;           // MAX_SCOPES * 2 queries for every frame in flight
+    float m_timestampPeriod = 0.0f;                     // Nanoseconds per tick
+    uint64_t m_timestampMask = 0;                       // Only the queue's valid bits count
+
+    uint32_t m_frame = 0;                               // The frame being recorded
+    std::vector<std::vector<std::string>> m_scopeNames; // What was recorded in each frame's queries, waiting to be read back
+
+    std::vector<Timing> m_gpuTimings;
+    std::vector<Timing> m_cpuTimings;
+    Timing m_frameTimes;
+    size_t m_historySize = HISTORY_SIZE;
+};
+//=================================================
+//             END OF Profiler
+//=================================================
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
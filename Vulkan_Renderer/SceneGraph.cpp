@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <cassert>
+
+#include "SceneGraph.h"
+
+// SSE for the matrix multiplies wherever it's there (every x64 build), plain glm otherwise
+#if defined(_M_X64) || defined(__SSE__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define SCENE_GRAPH_SSE
+#include <xmmintrin.h>
+#endif
+
+// =================================================
+// Name: MultiplyMatrices
+// Desc: out = a * b. Column major like glm, so each column of out is a's columns weighted by that column of b
+// Params: a, b, out
+// Return: NONE
+static void MultiplyMatrices(const glm::mat4& a, const glm::mat4& b, glm::mat4& out)
+{
+#ifdef SCENE_GRAPH_SSE
+    const __m128 a0 = _mm_loadu_ps(&a[0][0]);
+    const __m128 a1 = _mm_loadu_ps(&a[1][0]);
+    const __m128 a2 = _mm_loadu_ps(&a[2][0]);
+    const __m128 a3 = _mm_loadu_ps(&a[3][0]);
+
+    for (int column = 0; column < 4; ++column) {
+        __m128 result = _mm_mul_ps(a0, _mm_set1_ps(b[column][0]));
+        result = _mm_add_ps(result, _mm_mul_ps(a1, _mm_set1_ps(b[column][1])));
+        result = _mm_add_ps(result, _mm_mul_ps(a2, _mm_set1_ps(b[column][2])));
+        result = _mm_add_ps(result, _mm_mul_ps(a3, _mm_set1_ps(b[column][3])));
+        _mm_storeu_ps(&out[column][0], result);
+    }
+#else
+    out = a * b;
+#endif
+}
+// =================================================
+// Name: AddNode
+// Desc: Adds a node under the parent (or as a root with NO_PARENT), marked so the next Update works out its world matrix
+// Params: parent, local
+// Return: uint32_t - the node's index
+uint32_t SceneGraph::AddNode(uint32_t parent, const glm::mat4& local)
+{
+    assert(parent == NO_PARENT || parent < m_parents.size());
+
+    const uint32_t node = static_cast<uint32_t>(m_parents.size());
+    const uint32_t depth = parent == NO_PARENT ? 0 : m_depths[parent] + 1;
+
+    m_parents.push_back(parent);
+    m_depths.push_back(depth);
+    m_locals.push_back(local);
+    m_worlds.push_back(local);
+    m_dirty.push_back(1);
+    m_changedVersions.push_back(0);
+
+    if (m_levels.size() <= depth)
+        m_levels.resize(depth + 1);
+    m_levels[depth].push_back(node);
+
+    m_anyDirty = true;
+    return node;
+}
+// =================================================
+// Name: SetLocal
+// Desc: Replaces the node's transform relative to its parent, it and everything under it are recomputed on the next Update
+// Params: node, local
+// Return: NONE
+void SceneGraph::SetLocal(uint32_t node, const glm::mat4& local)
+{
+    m_locals[node] = local;
+    m_dirty[node] = 1;
+    m_anyDirty = true;
+}
+// =================================================
+// Name: Clear
+// Desc: Removes every node, the version carries on from where it was
+// Params: NONE
+// Return: NONE
+void SceneGraph::Clear()
+{
+    m_parents.clear();
+    m_depths.clear();
+    m_locals.clear();
+    m_worlds.clear();
+    m_dirty.clear();
+    m_changedVersions.clear();
+    m_levels.clear();
+    m_anyDirty = false;
+}
+// =================================================
+// Name: Update
+// Desc: Goes down the levels recomputing the marked nodes, a node whose parent was recomputed is marked on the way
+//       Nothing marked and it returns straight away, the version stays as it was
+// Params: threads
+// Return: NONE
+void SceneGraph::Update(WorkerThreads* threads)
+{
+    if (!m_anyDirty)
+        return;
+    ++m_version;
+
+    const uint32_t threadCount = threads != nullptr ? threads->GetCount() : 0;
+    for (const std::vector<uint32_t>& level : m_levels) {
+        if (threadCount == 0 || level.size() < PARALLEL_NODES) {
+            UpdateNodes(level, 0, level.size());
+            continue;
+        }
+
+        // An even slice each, every node in a level only reads the one above
+        threads->Run([&](uint32_t thread) {
+            const size_t begin = level.size() * thread / threadCount;
+            const size_t end = level.size() * (thread + 1) / threadCount;
+            UpdateNodes(level, begin, end);
+        });
+    }
+
+    // Only cleared once every level is done, the children needed to see their parents' marks
+    std::fill(m_dirty.begin(), m_dirty.end(), static_cast<uint8_t>(0));
+    m_anyDirty = false;
+}
+// =================================================
+// Name: UpdateNodes
+// Desc: Recomputes the world matrix of each marked node in part of a level, the level above has to be finished
+// Params: nodes, begin, end
+// Return: NONE
+void SceneGraph::UpdateNodes(const std::vector<uint32_t>& nodes, size_t begin, size_t end)
+{
+    for (size_t i = begin; i < end; ++i) {
+        const uint32_t node = nodes[i];
+        const uint32_t parent = m_parents[node];
+
+        // Passed down from the parent, which is already done as it's a level up
+        if (parent != NO_PARENT && m_dirty[parent])
+            m_dirty[node] = 1;
+        if (!m_dirty[node])
+            continue;
+
+        if (parent == NO_PARENT)
+            m_worlds[node] = m_locals[node];
+        else
+            MultiplyMatrices(m_worlds[parent], m_locals[node], m_worlds[node]);
+        m_changedVersions[node] = m_version;
+    }
+}
+//=================================================
+//              END OF Scene Graph
+//=================================================
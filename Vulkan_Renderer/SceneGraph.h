@@ -0,0 +1,67 @@
+#pragma once
+//---- GLM maths includes ----
+// The same settings as the renderer, glm's functions have to be the same everywhere
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/glm.hpp>
+
+//---- VS functionality includes ----
+#include <cstdint>
+#include <vector>
+
+#include "WorkerThreads.h"
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
+//=================================================
+//                  Scene Graph
+//=================================================
+// Parent/child transforms kept as a structure of arrays: each node is an index, and its parent, local and world
+// matrices and dirty flag sit in their own tightly packed arrays so an update only streams through what it needs
+// Nodes are also listed by depth, every parent is a level above its children, so a level is finished before the next
+// one reads it and the nodes within one are independent (the big ones are split across worker threads)
+// Only what's changed is recomputed: SetLocal marks a node and Update carries the mark down to everything under it
+class SceneGraph {
+public:
+    // --- Public Functions ---
+    // A parent has to be added before its children
+    uint32_t AddNode(uint32_t parent, const glm::mat4& local);
+    void SetLocal(uint32_t node, const glm::mat4& local);
+    void Clear();
+
+    // Recomputes the world matrix of every marked node and its children, what's left untouched keeps its last one
+    // With threads, levels of at least PARALLEL_NODES are split between them (Run blocks, so it's all done on return)
+    void Update(WorkerThreads* threads = nullptr);
+
+    const glm::mat4& GetWorld(uint32_t node) const { return m_worlds[node]; }
+    size_t GetNodeCount() const { return m_parents.size(); }
+
+    // Every Update that recomputes anything bumps the version, and each node it touched is stamped with it
+    // Anything kept in step with the worlds (a mapped buffer) only has to copy the nodes stamped after its last copy
+    uint64_t GetVersion() const { return m_version; }
+    uint64_t GetChangedVersion(uint32_t node) const { return m_changedVersions[node]; }
+
+    // --- Public Attributes ---
+    static constexpr uint32_t NO_PARENT = UINT32_MAX;
+    static constexpr size_t PARALLEL_NODES = 4096;     // Fewer than this in a level isn't worth waking the threads for
+
+private:
+    // --- Private Functions ---
+    void UpdateNodes(const std::vector<uint32_t>& nodes, size_t begin, size_t end);
+
+    // --- Private Attributes ---
+    // One entry per node
+    std::vector<uint32_t> m_parents;
+    std::vector<uint32_t> m_depths;
+    std::vector<glm::mat4> m_locals;
+    std::vector<glm::mat4> m_worlds;
+    std::vector<uint8_t> m_dirty;                       // Bytes rather than bits, so threads never share one
+    std::vector<uint64_t> m_changedVersions;
+
+    std::vector<std::vector<uint32_t>> m_levels;        // The nodes at each depth, in the order they were added
+    bool m_anyDirty = false;
+    uint64_t m_version = 0;                             // Never reset, so a version from before a Clear is still older
+};
+//=================================================
+//              END OF Scene Graph
+//=================================================
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
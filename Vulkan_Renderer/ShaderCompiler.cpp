@@ -0,0 +1,194 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "ShaderCompiler.h"
+
+// =================================================
+// Name: ReadFileBytes
+// Desc: Reads a whole file, text or SPIR-V
+// Params: path, contents
+// Return: bool - false if it couldn't be opened or read
+static bool ReadFileBytes(const std::string& path, std::string& contents)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    std::ostringstream stream;
+    stream << file.rdbuf();
+    contents = stream.str();
+    return !file.bad();
+}
+// =================================================
+// Name: Init
+// Desc: Makes sure the cache directory exists and takes the write times of every variant's source to watch
+// Params: cacheDirectory, variants
+// Return: NONE
+void ShaderCompiler::Init(const std::string& cacheDirectory, const std::vector<ShaderVariant>& variants)
+{
+    m_cacheDirectory = cacheDirectory;
+
+    std::error_code error;
+    std::filesystem::create_directories(m_cacheDirectory, error);
+    if (error)
+        printf("Couldn't make the shader cache directory %s, every shader will be compiled\n", m_cacheDirectory.c_str());
+
+    for (const ShaderVariant& variant : variants) {
+        bool watched = false;
+        for (const WatchedFile& file : m_watchedFiles)
+            watched = watched || file.path == variant.source;
+        if (watched)
+            continue;
+
+        // A missing source keeps a default time, it counts as changed once it turns up
+        WatchedFile file;
+        file.path = variant.source;
+        file.writeTime = std::filesystem::last_write_time(variant.source, error);
+        m_watchedFiles.push_back(file);
+    }
+}
+// =================================================
+// Name: Get
+// Desc: Finds the variant's SPIR-V: the cache entry for this exact source and defines, or a fresh compile that's then
+//       cached. Without the source (a build that only ships the .spv files) the prebuilt file is used as it is
+// Params: variant
+// Return: std::vector<char> - empty if it failed
+std::vector<char> ShaderCompiler::Get(const ShaderVariant& variant) const
+{
+    std::string sourceText;
+    if (!ReadFileBytes(variant.source, sourceText)) {
+        std::string prebuilt;
+        if (!ReadFileBytes(variant.name, prebuilt)) {
+            printf("Shader %s: no source (%s) or prebuilt SPIR-V\n", variant.name.c_str(), variant.source.c_str());
+            return {};
+        }
+        return std::vector<char>(prebuilt.begin(), prebuilt.end());
+    }
+
+    const std::string cachePath = CachePath(variant, sourceText);
+    std::string cached;
+    if (ReadFileBytes(cachePath, cached) && !cached.empty() && cached.size() % sizeof(uint32_t) == 0)
+        return std::vector<char>(cached.begin(), cached.end());
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    std::vector<char> code = Compile(variant, sourceText);
+    if (code.empty())
+        return code;
+    printf("Shader %s compiled in %.2f ms\n", variant.name.c_str(),
+        std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count());
+
+    // Written to the side then moved over, so a reader on another thread never sees half a file
+    const std::string tempPath = cachePath + ".tmp";
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    if (file.is_open()) {
+        file.write(code.data(), code.size());
+        file.close();
+
+        std::error_code error;
+        std::filesystem::rename(tempPath, cachePath, error);
+        if (error)
+            std::filesystem::remove(tempPath, error);
+    }
+
+    return code;
+}
+// =================================================
+// Name: PollChanges
+// Desc: Checks every watched source's write time, anything newer than last time is returned (and remembered)
+//       A file that can't be looked at right now (mid save) is left for the next poll
+// Params: NONE
+// Return: std::vector<std::string> - the changed sources
+std::vector<std::string> ShaderCompiler::PollChanges()
+{
+    std::vector<std::string> changed;
+    for (WatchedFile& file : m_watchedFiles) {
+        std::error_code error;
+        const std::filesystem::file_time_type writeTime = std::filesystem::last_write_time(file.path, error);
+        if (error || writeTime == file.writeTime)
+            continue;
+
+        file.writeTime = writeTime;
+        changed.push_back(file.path);
+    }
+    return changed;
+}
+// =================================================
+// Name: Compile
+// Desc: Runs shaderc on the source text with the variant's defines, optimised for performance and targeting Vulkan 1.0
+// Params: variant, sourceText
+// Return: std::vector<char> - the SPIR-V, empty with the errors printed if it didn't compile
+std::vector<char> ShaderCompiler::Compile(const ShaderVariant& variant, const std::string& sourceText) const
+{
+    shaderc::CompileOptions options;
+    options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_0);
+    options.SetOptimizationLevel(shaderc_optimization_level_performance);
+    for (const std::string& define : variant.defines)
+        options.AddMacroDefinition(define);
+
+    const shaderc::SpvCompilationResult result = m_compiler.CompileGlslToSpv(sourceText.data(), sourceText.size(),
+        GetShaderKind(variant.source), variant.source.c_str(), "main", options);
+
+    if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
+        printf("Shader %s failed to compile:\n%s\n", variant.name.c_str(), result.GetErrorMessage().c_str());
+        return {};
+    }
+
+    const uint32_t* words = result.cbegin();
+    const size_t size = (result.cend() - result.cbegin()) * sizeof(uint32_t);
+    const char* bytes = reinterpret_cast<const char*>(words);
+    return std::vector<char>(bytes, bytes + size);
+}
+// =================================================
+// Name: CachePath
+// Desc: Where the variant's SPIR-V is cached: its name plus a 64 bit FNV-1a hash of everything that went into it
+//       An edited source (or different defines) just hashes to a new file, the old ones are left for a clean to remove
+// Params: variant, sourceText
+// Return: std::string
+std::string ShaderCompiler::CachePath(const ShaderVariant& variant, const std::string& sourceText) const
+{
+    uint64_t hash = 14695981039346656037ull;
+    auto addBytes = [&hash](const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+    };
+
+    const uint32_t version = CACHE_VERSION;
+    const shaderc_shader_kind kind = GetShaderKind(variant.source);
+    addBytes(&version, sizeof(version));
+    addBytes(&kind, sizeof(kind));
+    addBytes(sourceText.data(), sourceText.size());
+    // Each one ended with a 0 so "AB" and "A", "B" can't hash the same
+    for (const std::string& define : variant.defines)
+        addBytes(define.c_str(), define.size() + 1);
+
+    const std::string baseName = variant.name.substr(0, variant.name.find_last_of('.'));
+    char hashText[17];
+    snprintf(hashText, sizeof(hashText), "%016llx", static_cast<unsigned long long>(hash));
+    return m_cacheDirectory + "/" + baseName + "_" + hashText + ".spv";
+}
+// =================================================
+// Name: GetShaderKind
+// Desc: The stage, from the source's extension the same way glslc works it out
+// Params: source
+// Return: shaderc_shader_kind
+shaderc_shader_kind ShaderCompiler::GetShaderKind(const std::string& source)
+{
+    const std::string extension = source.substr(source.find_last_of('.') + 1);
+    if (extension == "vert")
+        return shaderc_vertex_shader;
+    if (extension == "frag")
+        return shaderc_fragment_shader;
+    if (extension == "comp")
+        return shaderc_compute_shader;
+
+    printf("Shader %s: unknown extension, treating it as a vertex shader\n", source.c_str());
+    return shaderc_vertex_shader;
+}
+//=================================================
+//           END OF Shader Compiler
+//=================================================
@@ -0,0 +1,62 @@
+#pragma once
+//---- Include shaderc ----
+#include <shaderc/shaderc.hpp>
+
+//---- VS functionality includes ----
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
+//=================================================
+//               Shader Compiler
+//=================================================
+// GLSL compiled to SPIR-V at runtime with shaderc (from the Vulkan SDK), so editing a shader doesn't need Compile.bat
+// Every result is cached on disk under a hash of the source text, its defines and the stage, so a run that changes
+// nothing only reads files. The sources are watched too, PollChanges lists the ones saved since it last looked
+// Shaders don't #include anything, so the source file is all the hash has to cover
+
+// A SPIR-V file a pipeline can ask for and how to build it. The same source with different defines is a different variant
+struct ShaderVariant {
+    std::string name;                   // What the pipelines ask for, also the prebuilt .spv used if there's no source
+    std::string source;
+    std::vector<std::string> defines;
+};
+
+class ShaderCompiler {
+public:
+    // --- Public Functions ---
+    void Init(const std::string& cacheDirectory, const std::vector<ShaderVariant>& variants);
+
+    // The variant's SPIR-V, from the cache or compiled (and cached). Empty if it didn't compile, with the errors printed
+    // Safe on any thread, nothing is shared between calls but the compiler (which allows that) and the cache directory
+    std::vector<char> Get(const ShaderVariant& variant) const;
+
+    // The sources written since the last call (or Init), main thread only
+    std::vector<std::string> PollChanges();
+
+    // --- Public Attributes ---
+    // Bump whenever the compile options change, it's part of every hash so the old cache entries are never hit again
+    static constexpr uint32_t CACHE_VERSION = 1;
+
+private:
+    // --- Private Structs ---
+    struct WatchedFile {
+        std::string path;
+        std::filesystem::file_time_type writeTime;
+    };
+
+    // --- Private Functions ---
+    std::vector<char> Compile(const ShaderVariant& variant, const std::string& sourceText) const;
+    std::string CachePath(const ShaderVariant& variant, const std::string& sourceText) const;
+    static shaderc_shader_kind GetShaderKind(const std::string& source);
+
+    // --- Private Attributes ---
+    shaderc::Compiler m_compiler;
+    std::string m_cacheDirectory;
+    std::vector<WatchedFile> m_watchedFiles;    // Every source that's in a variant, once each
+};
+//=================================================
+//           END OF Shader Compiler
+//=================================================
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <cassert>
+
+#include "StagingArena.h"
+
+// =================================================
+// Name: Init
+// Desc: Nothing is allocated until the first upload asks for space
+// Params: device, allocator, chunkSize
+// Return: NONE
+void StagingArena::Init(VkDevice device, DeviceMemoryAllocator& allocator, VkDeviceSize chunkSize)
+{
+    m_device = device;
+    m_allocator = &allocator;
+    m_chunkSize = chunkSize;
+}
+// =================================================
+// Name: Destroy
+// Desc: Frees every chunk, the GPU must be done with all of them
+// Params: NONE
+// Return: NONE
+void StagingArena::Destroy()
+{
+    DestroyChunks();
+}
+// =================================================
+// Name: CreateChunk
+// Desc: Adds a new host visible staging buffer on the end, mapped for its whole life by the allocator
+// Params: size
+// Return: NONE
+void StagingArena::CreateChunk(VkDeviceSize size)
+{
+    Chunk chunk;
+    chunk.size = size;
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;    // Only ever copied from
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    assert(vkCreateBuffer(m_device, &bufferInfo, nullptr, &chunk.buffer) == VK_SUCCESS);
+
+    VkMemoryRequirements memoryRequirements;
+    vkGetBufferMemoryRequirements(m_device, chunk.buffer, &memoryRequirements);
+    chunk.memory = m_allocator->Allocate(memoryRequirements,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, true, MemoryCategory::Staging);
+    vkBindBufferMemory(m_device, chunk.buffer, chunk.memory.memory, chunk.memory.offset);
+
+    m_chunks.push_back(chunk);
+}
+// =================================================
+// Name: DestroyChunks
+// Desc: Destroys every chunk's buffer and gives its memory back to the allocator
+// Params: NONE
+// Return: NONE
+void StagingArena::DestroyChunks()
+{
+    for (Chunk& chunk : m_chunks) {
+        vkDestroyBuffer(m_device, chunk.buffer, nullptr);
+        m_allocator->Free(chunk.memory);
+    }
+    m_chunks.clear();
+
+    m_currentChunk = 0;
+    m_head = 0;
+    m_used = 0;
+}
+// =================================================
+// Name: Allocate
+// Desc: Bumps the head of the current chunk, moving on to (or making) another chunk when it doesn't fit
+// Params: size, alignment, mapped
+// Return: StagingSlice
+StagingSlice StagingArena::Allocate(VkDeviceSize size, VkDeviceSize alignment, void*& mapped)
+{
+    // Alignment is always a power of 2 (copy offsets need multiples of the texel or block size)
+    VkDeviceSize alignedHead = (m_head + alignment - 1) & ~(alignment - 1);
+
+    // Skip over any chunks that are too small for this
+    while (m_currentChunk < m_chunks.size() && alignedHead + size > m_chunks[m_currentChunk].size) {
+        ++m_currentChunk;
+        alignedHead = 0;
+    }
+
+    // Out of chunks, grow. Big uploads get a chunk of their own size
+    if (m_currentChunk == m_chunks.size())
+        CreateChunk(std::max(m_chunkSize, size));
+
+    const Chunk& chunk = m_chunks[m_currentChunk];
+    mapped = static_cast<char*>(chunk.memory.mapped) + alignedHead;
+
+    m_head = alignedHead + size;
+    m_used += size;
+
+    StagingSlice slice;
+    slice.buffer = chunk.buffer;
+    slice.offset = alignedHead;
+    return slice;
+}
+// =================================================
+// Name: Reset
+// Desc: Everything allocated since the last reset is free again
+//       If it overflowed into more chunks, they're swapped for one that would have held it all
+// Params: NONE
+// Return: NONE
+void StagingArena::Reset()
+{
+    if (m_chunks.size() > 1) {
+        VkDeviceSize total = 0;
+        for (const Chunk& chunk : m_chunks)
+            total += chunk.size;
+
+        DestroyChunks();
+        CreateChunk(total);
+    }
+
+    m_currentChunk = 0;
+    m_head = 0;
+    m_used = 0;
+}
@@ -0,0 +1,63 @@
+#pragma once
+//---- Include Vulkan ----
+#include <vulkan/vulkan.h>
+
+//---- VS functionality includes ----
+#include <cstdint>
+#include <vector>
+
+#include "MemoryAllocator.h"
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
+//=================================================
+//             StagingArena Structs
+//=================================================
+// Where some staged data ended up, valid until the arena is next reset
+struct StagingSlice {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+};
+//=================================================
+//                 StagingArena
+//=================================================
+// A linear allocator over a few big persistently mapped staging buffers
+// Allocating is just bumping an offset, Reset hands the whole lot back at once when the GPU is done with it
+// If a batch needed more than one chunk they get merged into one big enough chunk on Reset, so it settles at one buffer
+class StagingArena {
+public:
+    // --- Public Functions ---
+    void Init(VkDevice device, DeviceMemoryAllocator& allocator, VkDeviceSize chunkSize = DEFAULT_CHUNK_SIZE);
+    void Destroy();
+    StagingSlice Allocate(VkDeviceSize size, VkDeviceSize alignment, void*& mapped);
+    void Reset();
+    VkDeviceSize GetUsed() const { return m_used; }
+    uint32_t GetChunkCount() const { return static_cast<uint32_t>(m_chunks.size()); }
+
+    // --- Public Attributes ---
+    static constexpr VkDeviceSize DEFAULT_CHUNK_SIZE = 16ull * 1024 * 1024;
+
+private:
+    // --- Private Structs ---
+    struct Chunk {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        MemoryAllocation memory;
+        VkDeviceSize size = 0;
+    };
+
+    // --- Private Functions ---
+    void CreateChunk(VkDeviceSize size);
+    void DestroyChunks();
+
+    // --- Private Attributes ---
+    VkDevice m_device = VK_NULL_HANDLE;
+    DeviceMemoryAllocator* m_allocator = nullptr;
+    VkDeviceSize m_chunkSize = DEFAULT_CHUNK_SIZE;
+
+    std::vector<Chunk> m_chunks;
+    size_t m_currentChunk = 0;      // Which chunk is being bumped through
+    VkDeviceSize m_head = 0;        // Next free byte in it
+    VkDeviceSize m_used = 0;        // Across every chunk since the last Reset
+};
+//=================================================
+//            END OF StagingArena
+//=================================================
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
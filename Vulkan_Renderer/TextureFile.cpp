@@ -0,0 +1,404 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#include "TextureFile.h"
+
+// KTX2's identifier, the first 12 bytes of every file
+static const uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+// The fixed part of a KTX2 header, straight after the identifier
+struct KTX2Header {
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint32_t sgdByteOffset[2];      // Both 64 bit, split so the struct isn't padded out past the 68 bytes in the file
+    uint32_t sgdByteLength[2];
+};
+// Followed by one of these per level, level 0 first (though the data itself is stored smallest first)
+struct KTX2Level {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+// DDS_PIXELFORMAT and DDS_HEADER from the DirectX docs, after the "DDS " magic
+struct DDSPixelFormat {
+    uint32_t size;
+    uint32_t flags;
+    uint32_t fourCC;
+    uint32_t rgbBitCount;
+    uint32_t masks[4];
+};
+struct DDSHeader {
+    uint32_t size;
+    uint32_t flags;
+    uint32_t height;
+    uint32_t width;
+    uint32_t pitchOrLinearSize;
+    uint32_t depth;
+    uint32_t mipMapCount;
+    uint32_t reserved1[11];
+    DDSPixelFormat pixelFormat;
+    uint32_t caps[4];
+    uint32_t reserved2;
+};
+// Only there when the four CC is "DX10", BC7 can only be described this way
+struct DDSHeaderDX10 {
+    uint32_t dxgiFormat;
+    uint32_t resourceDimension;
+    uint32_t miscFlag;
+    uint32_t arraySize;
+    uint32_t miscFlags2;
+};
+
+static constexpr uint32_t FourCC(char a, char b, char c, char d)
+{
+    return static_cast<uint32_t>(a) | (static_cast<uint32_t>(b) << 8) | (static_cast<uint32_t>(c) << 16) | (static_cast<uint32_t>(d) << 24);
+}
+
+// =================================================
+// Name: GetMaxMipCount
+// Desc: How many levels a full chain down to 1x1 has, floor(log2(max(width, height))) + 1
+// Params: width, height
+// Return: uint32_t
+static uint32_t GetMaxMipCount(uint32_t width, uint32_t height)
+{
+    uint32_t count = 1;
+    for (uint32_t size = std::max(width, height); size > 1; size >>= 1)
+        ++count;
+    return count;
+}
+// =================================================
+// Name: GetFormatBlock
+// Desc: How many bytes one block of the format takes and how many texels across and down it covers (1x1 uncompressed)
+//       Only the formats a texture file here is expected to hold, anything else is false
+// Params: format, blockBytes, blockWidth, blockHeight
+// Return: bool
+static bool GetFormatBlock(VkFormat format, VkDeviceSize& blockBytes, uint32_t& blockWidth, uint32_t& blockHeight)
+{
+    // The ASTC formats are UNORM/SRGB pairs in this order, every block is 16 bytes whatever its footprint
+    static const uint32_t ASTC_FOOTPRINTS[14][2] = {
+        { 4, 4 }, { 5, 4 }, { 5, 5 }, { 6, 5 }, { 6, 6 }, { 8, 5 }, { 8, 6 },
+        { 8, 8 }, { 10, 5 }, { 10, 6 }, { 10, 8 }, { 10, 10 }, { 12, 10 }, { 12, 12 }
+    };
+    if (format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK && format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK) {
+        const uint32_t footprint = (format - VK_FORMAT_ASTC_4x4_UNORM_BLOCK) / 2;
+        blockBytes = 16;
+        blockWidth = ASTC_FOOTPRINTS[footprint][0];
+        blockHeight = ASTC_FOOTPRINTS[footprint][1];
+        return true;
+    }
+
+    blockWidth = 4;
+    blockHeight = 4;
+    switch (format) {
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+        blockBytes = 4;
+        blockWidth = 1;
+        blockHeight = 1;
+        return true;
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+    case VK_FORMAT_BC4_SNORM_BLOCK:
+        blockBytes = 8;
+        return true;
+    case VK_FORMAT_BC2_UNORM_BLOCK:
+    case VK_FORMAT_BC2_SRGB_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+    case VK_FORMAT_BC5_SNORM_BLOCK:
+    case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+    case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+        blockBytes = 16;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// =================================================
+// Name: ReadWholeFile
+// Desc: Reads a file into memory
+// Params: path, data
+// Return: bool - false if it couldn't be opened or read
+static bool ReadWholeFile(const std::string& path, std::vector<char>& data)
+{
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    data.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(data.data(), data.size());
+    return static_cast<bool>(file);
+}
+// =================================================
+// Name: LoadTextureFile
+// Desc: Sends the file to the right loader for its extension
+// Params: path, texture
+// Return: bool
+bool LoadTextureFile(const std::string& path, TextureFile& texture)
+{
+    const size_t dot = path.find_last_of('.');
+    const std::string extension = dot == std::string::npos ? "" : path.substr(dot);
+
+    if (extension == ".ktx2")
+        return LoadKTX2(path, texture);
+    if (extension == ".dds")
+        return LoadDDS(path, texture);
+
+    return false;
+}
+// =================================================
+// Name: LoadKTX2
+// Desc: Reads a KTX2 file, the header gives the Vulkan format and where each level is directly
+// Params: path, texture
+// Return: bool
+bool LoadKTX2(const std::string& path, TextureFile& texture)
+{
+    std::vector<char> file;
+    if (!ReadWholeFile(path, file))
+        return false;
+
+    if (file.size() < sizeof(KTX2_IDENTIFIER) + sizeof(KTX2Header) || memcmp(file.data(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+        return false;
+
+    KTX2Header header;
+    memcpy(&header, file.data() + sizeof(KTX2_IDENTIFIER), sizeof(header));
+
+    // Supercompressed (Basis, zstd) data would need transcoding first, and 0 levels means "make your own mips"
+    // More levels than it takes to get down to 1x1 is a broken file, and would shift the sizes below by 32 or more
+    const bool plain2D = header.pixelDepth <= 1 && header.layerCount <= 1 && header.faceCount == 1;
+    const uint32_t height = std::max(header.pixelHeight, 1u);
+    if (header.vkFormat == VK_FORMAT_UNDEFINED || header.supercompressionScheme != 0 || !plain2D || header.pixelWidth == 0 ||
+        header.levelCount == 0 || header.levelCount > GetMaxMipCount(header.pixelWidth, height))
+        return false;
+
+    VkDeviceSize blockBytes = 0;
+    uint32_t blockWidth = 0;
+    uint32_t blockHeight = 0;
+    if (!GetFormatBlock(static_cast<VkFormat>(header.vkFormat), blockBytes, blockWidth, blockHeight))
+        return false;
+
+    const size_t levelIndex = sizeof(KTX2_IDENTIFIER) + sizeof(KTX2Header);
+    if (file.size() < levelIndex + sizeof(KTX2Level) * header.levelCount)
+        return false;
+
+    std::vector<KTX2Level> levels(header.levelCount);
+    memcpy(levels.data(), file.data() + levelIndex, sizeof(KTX2Level) * levels.size());
+
+    // Only keep the span covering every level, offsets are made relative to its start
+    // Each level has to be inside the file and be exactly the blocks its size takes, it's copied as it is
+    uint64_t dataStart = UINT64_MAX;
+    uint64_t dataEnd = 0;
+    for (uint32_t i = 0; i < levels.size(); ++i) {
+        const KTX2Level& level = levels[i];
+        if (level.byteOffset > file.size() || level.byteLength > file.size() - level.byteOffset)
+            return false;
+
+        const uint32_t levelWidth = std::max(header.pixelWidth >> i, 1u);
+        const uint32_t levelHeight = std::max(height >> i, 1u);
+        const VkDeviceSize expected = VkDeviceSize((levelWidth + blockWidth - 1) / blockWidth) *
+            ((levelHeight + blockHeight - 1) / blockHeight) * blockBytes;
+        if (level.byteLength != expected)
+            return false;
+
+        dataStart = std::min(dataStart, level.byteOffset);
+        dataEnd = std::max(dataEnd, level.byteOffset + level.byteLength);
+    }
+
+    texture.format = static_cast<VkFormat>(header.vkFormat);
+    texture.width = header.pixelWidth;
+    texture.height = height;
+    texture.mips.resize(levels.size());
+    for (uint32_t i = 0; i < levels.size(); ++i) {
+        texture.mips[i].offset = levels[i].byteOffset - dataStart;
+        texture.mips[i].size = levels[i].byteLength;
+        texture.mips[i].width = std::max(texture.width >> i, 1u);
+        texture.mips[i].height = std::max(texture.height >> i, 1u);
+    }
+    texture.data.assign(file.begin() + dataStart, file.begin() + dataEnd);
+
+    return true;
+}
+// =================================================
+// Name: LoadDDS
+// Desc: Reads a DDS file holding BC1, BC3 or BC7 blocks, the levels follow the headers tightly packed
+// Params: path, texture
+// Return: bool
+bool LoadDDS(const std::string& path, TextureFile& texture)
+{
+    std::vector<char> file;
+    if (!ReadWholeFile(path, file))
+        return false;
+
+    const uint32_t DDS_MAGIC = FourCC('D', 'D', 'S', ' ');
+    if (file.size() < sizeof(uint32_t) + sizeof(DDSHeader))
+        return false;
+
+    uint32_t magic;
+    DDSHeader header;
+    memcpy(&magic, file.data(), sizeof(magic));
+    memcpy(&header, file.data() + sizeof(magic), sizeof(header));
+    if (magic != DDS_MAGIC || header.size != sizeof(DDSHeader))
+        return false;
+
+    size_t dataStart = sizeof(magic) + sizeof(header);
+
+    // Legacy four CCs don't say whether they're sRGB, colour textures nearly always are
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    if (header.pixelFormat.fourCC == FourCC('D', 'X', 'T', '1'))
+        format = VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+    else if (header.pixelFormat.fourCC == FourCC('D', 'X', 'T', '5'))
+        format = VK_FORMAT_BC3_SRGB_BLOCK;
+    else if (header.pixelFormat.fourCC == FourCC('D', 'X', '1', '0')) {
+        if (file.size() < dataStart + sizeof(DDSHeaderDX10))
+            return false;
+
+        DDSHeaderDX10 dx10;
+        memcpy(&dx10, file.data() + dataStart, sizeof(dx10));
+        dataStart += sizeof(dx10);
+
+        // DXGI_FORMAT values
+        switch (dx10.dxgiFormat) {
+        case 71: format = VK_FORMAT_BC1_RGBA_UNORM_BLOCK; break;
+        case 72: format = VK_FORMAT_BC1_RGBA_SRGB_BLOCK; break;
+        case 77: format = VK_FORMAT_BC3_UNORM_BLOCK; break;
+        case 78: format = VK_FORMAT_BC3_SRGB_BLOCK; break;
+        case 98: format = VK_FORMAT_BC7_UNORM_BLOCK; break;
+        case 99: format = VK_FORMAT_BC7_SRGB_BLOCK; break;
+        default: break;
+        }
+
+        // Texture2D with a single element only
+        if (dx10.resourceDimension != 3 || dx10.arraySize > 1)
+            return false;
+    }
+    if (format == VK_FORMAT_UNDEFINED)
+        return false;
+
+    // The same as KTX2, no longer a chain than the size allows
+    if (header.width == 0 || header.height == 0 || header.mipMapCount > GetMaxMipCount(header.width, header.height))
+        return false;
+
+    // BC1 packs a 4x4 block into 8 bytes, the rest into 16
+    const bool bc1 = format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK || format == VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+    const VkDeviceSize blockBytes = bc1 ? 8 : 16;
+
+    texture.format = format;
+    texture.width = header.width;
+    texture.height = header.height;
+    texture.mips.resize(std::max(header.mipMapCount, 1u));
+
+    VkDeviceSize offset = 0;
+    for (uint32_t i = 0; i < texture.mips.size(); ++i) {
+        TextureMip& mip = texture.mips[i];
+        mip.width = std::max(texture.width >> i, 1u);
+        mip.height = std::max(texture.height >> i, 1u);
+        mip.offset = offset;
+        mip.size = ((mip.width + 3) / 4) * ((mip.height + 3) / 4) * blockBytes;
+        offset += mip.size;
+    }
+
+    if (file.size() < dataStart + offset)
+        return false;
+
+    texture.data.assign(file.begin() + dataStart, file.begin() + dataStart + offset);
+    return true;
+}
+// =================================================
+// Name: BuildMipChain
+// Desc: Box filters each level down from the one above until it's 1x1, appending them to the data
+//       Odd sizes round down and the last row or column is reused on the edge, the same as the blits did
+// Params: texture
+// Return: NONE
+void BuildMipChain(TextureFile& texture)
+{
+    const bool srgb = texture.format == VK_FORMAT_R8G8B8A8_SRGB;
+
+    // Every 8 bit value's linear intensity, made once
+    static const std::vector<float> toLinear = [] {
+        std::vector<float> table(256);
+        for (int i = 0; i < 256; ++i) {
+            const float c = i / 255.0f;
+            table[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return table;
+    }();
+    auto toSRGB = [](float c) {
+        c = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+        return static_cast<uint8_t>(std::clamp(c * 255.0f + 0.5f, 0.0f, 255.0f));
+    };
+
+    // Just the first level to start from, sized up front so the data doesn't move while we're reading it
+    texture.mips.resize(1);
+    texture.mips[0] = { 0, VkDeviceSize(texture.width) * texture.height * 4, texture.width, texture.height };
+
+    VkDeviceSize total = texture.mips[0].size;
+    for (uint32_t w = texture.width, h = texture.height; w > 1 || h > 1;) {
+        w = std::max(w / 2, 1u);
+        h = std::max(h / 2, 1u);
+        texture.mips.push_back({ total, VkDeviceSize(w) * h * 4, w, h });
+        total += texture.mips.back().size;
+    }
+    texture.data.resize(static_cast<size_t>(total));
+
+    for (size_t level = 1; level < texture.mips.size(); ++level) {
+        const TextureMip& src = texture.mips[level - 1];
+        const TextureMip& dst = texture.mips[level];
+        const uint8_t* in = reinterpret_cast<const uint8_t*>(texture.data.data() + src.offset);
+        uint8_t* out = reinterpret_cast<uint8_t*>(texture.data.data() + dst.offset);
+
+        for (uint32_t y = 0; y < dst.height; ++y) {
+            const uint32_t y0 = std::min(y * 2, src.height - 1);
+            const uint32_t y1 = std::min(y * 2 + 1, src.height - 1);
+
+            for (uint32_t x = 0; x < dst.width; ++x) {
+                const uint32_t x0 = std::min(x * 2, src.width - 1);
+                const uint32_t x1 = std::min(x * 2 + 1, src.width - 1);
+                const uint8_t* texels[4] = {
+                    in + (size_t(y0) * src.width + x0) * 4, in + (size_t(y0) * src.width + x1) * 4,
+                    in + (size_t(y1) * src.width + x0) * 4, in + (size_t(y1) * src.width + x1) * 4
+                };
+
+                uint8_t* texel = out + (size_t(y) * dst.width + x) * 4;
+                for (int channel = 0; channel < 4; ++channel) {
+                    // Alpha is always linear
+                    if (srgb && channel < 3) {
+                        float sum = 0.0f;
+                        for (const uint8_t* t : texels)
+                            sum += toLinear[t[channel]];
+                        texel[channel] = toSRGB(sum * 0.25f);
+                    }
+                    else {
+                        uint32_t sum = 2;   // Rounds to nearest
+                        for (const uint8_t* t : texels)
+                            sum += t[channel];
+                        texel[channel] = static_cast<uint8_t>(sum / 4);
+                    }
+                }
+            }
+        }
+    }
+}
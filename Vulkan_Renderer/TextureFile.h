@@ -0,0 +1,46 @@
+#pragma once
+//---- Include Vulkan ----
+#include <vulkan/vulkan.h>
+
+//---- VS functionality includes ----
+#include <cstdint>
+#include <string>
+#include <vector>
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
+//=================================================
+//               Texture File
+//=================================================
+// Loads pre-compressed textures (BC1/BC3/BC7 in DDS, anything Vulkan has a format for in KTX2)
+// The blocks and every mip level are stored ready to copy, so nothing is decoded or generated at load time
+// Decoded images can be put in the same form with BuildMipChain, for anything that wants all the levels on the CPU
+// Only plain 2D textures are handled: no arrays, cube maps, volumes or KTX2 supercompression
+
+// Where one mip level sits in TextureFile::data
+struct TextureMip {
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+};
+
+struct TextureFile {
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<TextureMip> mips;   // Largest first
+    std::vector<char> data;         // Just the levels, the file's headers are dropped
+};
+
+// Picks the loader from the extension (.ktx2 or .dds), false if it's missing, not one we can read, or damaged
+bool LoadTextureFile(const std::string& path, TextureFile& texture);
+
+bool LoadKTX2(const std::string& path, TextureFile& texture);
+bool LoadDDS(const std::string& path, TextureFile& texture);
+
+// Builds every level below the first for an uncompressed RGBA8 texture (a decoded PNG) with a 2x2 box filter
+// sRGB textures are averaged in linear space like a blit would, so the smaller levels don't darken
+void BuildMipChain(TextureFile& texture);
+//=================================================
+//           END OF Texture File
+//=================================================
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
@@ -0,0 +1,395 @@
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#include "UploadContext.h"
+
+// =================================================
+// Name: CreateTransientPool
+// Desc: Transient tells the driver the buffers are short lived, reset lets finished batches be recorded again
+// Params: device, queueFamily
+// Return: VkCommandPool
+static VkCommandPool CreateTransientPool(VkDevice device, uint32_t queueFamily)
+{
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = queueFamily;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+    VkCommandPool pool;
+    assert(vkCreateCommandPool(device, &poolInfo, nullptr, &pool) == VK_SUCCESS);
+    return pool;
+}
+// =================================================
+// Name: AllocateCommandBuffer
+// Desc: One primary command buffer from the pool
+// Params: device, pool
+// Return: VkCommandBuffer
+static VkCommandBuffer AllocateCommandBuffer(VkDevice device, VkCommandPool pool)
+{
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = pool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    assert(vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) == VK_SUCCESS);
+    return commandBuffer;
+}
+// =================================================
+// Name: Init
+// Desc: Makes the transient command pools the batches are recorded from
+//       Passing the same family for transfer and graphics puts everything in one command buffer on that queue
+// Params: device, transferFamily, transferQueue, graphicsFamily, graphicsQueue, allocator
+// Return: NONE
+void UploadContext::Init(VkDevice device, uint32_t transferFamily, VkQueue transferQueue, uint32_t graphicsFamily, VkQueue graphicsQueue,
+    DeviceMemoryAllocator& allocator)
+{
+    m_device = device;
+    m_allocator = &allocator;
+
+    m_transferFamily = transferFamily;
+    m_transferQueue = transferQueue;
+    m_graphicsFamily = graphicsFamily;
+    m_graphicsQueue = graphicsQueue;
+    m_dedicatedTransfer = transferFamily != graphicsFamily;
+
+    m_commandPool = CreateTransientPool(m_device, m_transferFamily);
+    if (m_dedicatedTransfer)
+        m_graphicsPool = CreateTransientPool(m_device, m_graphicsFamily);
+
+    printf("Uploads running on %s (queue family %u)\n", m_dedicatedTransfer ? "a dedicated transfer queue" : "the graphics queue",
+        m_transferFamily);
+}
+// =================================================
+// Name: Destroy
+// Desc: Flushes anything still recording, waits for every batch and then destroys the lot
+// Params: NONE
+// Return: NONE
+void UploadContext::Destroy()
+{
+    Submit();
+    WaitIdle();
+
+    for (Batch& batch : m_freeBatches) {
+        batch.staging.Destroy();
+        vkDestroyFence(m_device, batch.fence, nullptr);
+        if (batch.transferDone != VK_NULL_HANDLE)
+            vkDestroySemaphore(m_device, batch.transferDone, nullptr);
+    }
+    m_freeBatches.clear();
+
+    // Frees the command buffers with them
+    vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+    m_commandPool = VK_NULL_HANDLE;
+    if (m_graphicsPool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(m_device, m_graphicsPool, nullptr);
+        m_graphicsPool = VK_NULL_HANDLE;
+    }
+}
+// =================================================
+// Name: Recording
+// Desc: The batch currently being recorded, starting one (reusing a finished batch if there is one) when needed
+// Params: NONE
+// Return: Batch&
+UploadContext::Batch& UploadContext::Recording()
+{
+    if (m_isRecording)
+        return m_recording;
+
+    if (!m_freeBatches.empty()) {
+        m_recording = std::move(m_freeBatches.back());
+        m_freeBatches.pop_back();
+    }
+    else {
+        m_recording = Batch{};
+        m_recording.staging.Init(m_device, *m_allocator);
+        m_recording.commandBuffer = AllocateCommandBuffer(m_device, m_commandPool);
+
+        // Starts unsignalled, the submit signals it
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        assert(vkCreateFence(m_device, &fenceInfo, nullptr, &m_recording.fence) == VK_SUCCESS);
+
+        if (m_dedicatedTransfer) {
+            m_recording.graphicsCommands = AllocateCommandBuffer(m_device, m_graphicsPool);
+
+            VkSemaphoreCreateInfo semaphoreInfo{};
+            semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            assert(vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_recording.transferDone) == VK_SUCCESS);
+        }
+    }
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT; // Tells the driver we just want to do this once
+
+    vkBeginCommandBuffer(m_recording.commandBuffer, &beginInfo);
+    if (m_dedicatedTransfer)
+        vkBeginCommandBuffer(m_recording.graphicsCommands, &beginInfo);
+    m_isRecording = true;
+
+    return m_recording;
+}
+// =================================================
+// Name: GetCommandBuffer
+// Desc: The command buffer to record transfers into, everything recorded goes out with the next Submit
+// Params: NONE
+// Return: VkCommandBuffer
+VkCommandBuffer UploadContext::GetCommandBuffer()
+{
+    return Recording().commandBuffer;
+}
+// =================================================
+// Name: GetGraphicsCommandBuffer
+// Desc: For work the transfer queue can't do, runs after everything in GetCommandBuffer has finished
+//       Resources have to be handed over with the ownership functions first. Without a dedicated queue this is the same buffer
+// Params: NONE
+// Return: VkCommandBuffer
+VkCommandBuffer UploadContext::GetGraphicsCommandBuffer()
+{
+    Batch& batch = Recording();
+    return m_dedicatedTransfer ? batch.graphicsCommands : batch.commandBuffer;
+}
+// =================================================
+// Name: Stage
+// Desc: Copies the data into the batch's staging arena, where it stays until the batch is finished with it
+// Params: data, size, alignment
+// Return: StagingSlice
+StagingSlice UploadContext::Stage(const void* data, VkDeviceSize size, VkDeviceSize alignment)
+{
+    void* mapped = nullptr;
+    const StagingSlice slice = Reserve(size, mapped, alignment);
+
+    // Already mapped, and coherent so there's nothing to flush
+    memcpy(mapped, data, static_cast<size_t>(size));
+
+    return slice;
+}
+// =================================================
+// Name: Reserve
+// Desc: Takes space in the batch's staging arena without filling it, for data that's written straight into the mapping
+//       The reserving has to happen on the recording thread, but the mapped pointer can be written from anywhere
+//       as long as it's finished before the batch is submitted
+// Params: size, mapped, alignment
+// Return: StagingSlice
+StagingSlice UploadContext::Reserve(VkDeviceSize size, void*& mapped, VkDeviceSize alignment)
+{
+    Batch& batch = Recording();
+
+    const StagingSlice slice = batch.staging.Allocate(size, alignment, mapped);
+
+    return slice;
+}
+// =================================================
+// Name: TransferBufferOwnership
+// Desc: Hands an uploaded buffer over to the graphics queue family, a release on the transfer side and a matching acquire
+//       on the graphics side. With one queue family the end of batch barrier already covers it
+// Params: buffer, dstAccess, dstStage
+// Return: NONE
+void UploadContext::TransferBufferOwnership(VkBuffer buffer, VkAccessFlags dstAccess, VkPipelineStageFlags dstStage)
+{
+    Batch& batch = Recording();
+    if (!m_dedicatedTransfer)
+        return;
+
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = m_transferFamily;
+    barrier.dstQueueFamilyIndex = m_graphicsFamily;
+    barrier.buffer = buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+
+    // Release: the copy's writes are made available, the dst access is ignored on this side
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+        0, nullptr, 1, &barrier, 0, nullptr);
+
+    // Acquire: the same barrier again on the graphics side, now the src access is ignored
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = dstAccess;
+    vkCmdPipelineBarrier(batch.graphicsCommands, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage, 0,
+        0, nullptr, 1, &barrier, 0, nullptr);
+
+    batch.acquireStages |= dstStage;
+}
+// =================================================
+// Name: TransferImageOwnership
+// Desc: Same as TransferBufferOwnership for an image, the layout change (if any) happens as part of the transfer
+//       With one queue family it's just a normal layout transition
+// Params: image, oldLayout, newLayout, range, dstAccess, dstStage
+// Return: NONE
+void UploadContext::TransferImageOwnership(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, const VkImageSubresourceRange& range,
+    VkAccessFlags dstAccess, VkPipelineStageFlags dstStage)
+{
+    Batch& batch = Recording();
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.image = image;
+    barrier.subresourceRange = range;
+
+    if (!m_dedicatedTransfer) {
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = dstAccess;
+        vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0,
+            0, nullptr, 0, nullptr, 1, &barrier);
+        return;
+    }
+
+    barrier.srcQueueFamilyIndex = m_transferFamily;
+    barrier.dstQueueFamilyIndex = m_graphicsFamily;
+
+    // Release, both sides have to give the same layouts
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+        0, nullptr, 0, nullptr, 1, &barrier);
+
+    // Acquire
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = dstAccess;
+    vkCmdPipelineBarrier(batch.graphicsCommands, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage, 0,
+        0, nullptr, 0, nullptr, 1, &barrier);
+
+    batch.acquireStages |= dstStage;
+}
+// =================================================
+// Name: Submit
+// Desc: Ends the current batch and submits it with its fence, without waiting for it
+// Params: NONE
+// Return: uint64_t - the batch's serial for IsFinished, 0 if there was nothing to submit
+uint64_t UploadContext::Submit()
+{
+    if (!m_isRecording)
+        return 0;
+
+    // One barrier for the whole batch so anything that reads the uploads later in the queue sees the writes,
+    // the cull pass's compute reads of the mesh ranges included
+    // Images already get their own layout transitions, this covers the buffers
+    // With a dedicated transfer queue the ownership acquires do this job instead
+    if (!m_dedicatedTransfer) {
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+            VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+        vkCmdPipelineBarrier(m_recording.commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+            1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    vkEndCommandBuffer(m_recording.commandBuffer);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &m_recording.commandBuffer;
+
+    if (!m_dedicatedTransfer) {
+        // The fence is all we need, draws later on the same queue are ordered after this by that barrier
+        assert(vkQueueSubmit(m_transferQueue, 1, &submitInfo, m_recording.fence) == VK_SUCCESS);
+    }
+    else {
+        // The copies go to the transfer queue and signal the semaphore...
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &m_recording.transferDone;
+        assert(vkQueueSubmit(m_transferQueue, 1, &submitInfo, VK_NULL_HANDLE) == VK_SUCCESS);
+
+        // ...which the graphics half waits on, only at the stages that actually use the data
+        // Its fence going off means both halves are done, so it's the only one we need
+        vkEndCommandBuffer(m_recording.graphicsCommands);
+
+        VkPipelineStageFlags waitStage = m_recording.acquireStages;
+        if (waitStage == 0)
+            waitStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;     // Nothing was handed over, just keep the order
+        VkSubmitInfo graphicsSubmit{};
+        graphicsSubmit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        graphicsSubmit.waitSemaphoreCount = 1;
+        graphicsSubmit.pWaitSemaphores = &m_recording.transferDone;
+        graphicsSubmit.pWaitDstStageMask = &waitStage;
+        graphicsSubmit.commandBufferCount = 1;
+        graphicsSubmit.pCommandBuffers = &m_recording.graphicsCommands;
+        assert(vkQueueSubmit(m_graphicsQueue, 1, &graphicsSubmit, m_recording.fence) == VK_SUCCESS);
+    }
+
+    m_recording.serial = ++m_submitCount;
+    const uint64_t serial = m_recording.serial;
+
+    m_inFlight.push_back(std::move(m_recording));
+    m_recording = Batch{};
+    m_isRecording = false;
+
+    return serial;
+}
+// =================================================
+// Name: IsFinished
+// Desc: Whether a submitted batch has been collected, so everything it uploaded is ready to use
+//       Only as up to date as the last Collect
+// Params: batch
+// Return: bool
+bool UploadContext::IsFinished(uint64_t batch) const
+{
+    for (const Batch& inFlight : m_inFlight) {
+        if (inFlight.serial == batch)
+            return false;
+    }
+    return batch <= m_submitCount;
+}
+// =================================================
+// Name: Release
+// Desc: Resets a finished batch's staging arena and gets it ready to be reused
+// Params: batch
+// Return: NONE
+void UploadContext::Release(Batch& batch)
+{
+    // The whole arena is free again, no buffers are destroyed
+    batch.staging.Reset();
+
+    vkResetCommandBuffer(batch.commandBuffer, 0);
+    if (batch.graphicsCommands != VK_NULL_HANDLE)
+        vkResetCommandBuffer(batch.graphicsCommands, 0);
+    batch.acquireStages = 0;
+    vkResetFences(m_device, 1, &batch.fence);
+}
+// =================================================
+// Name: Collect
+// Desc: Checks the submitted batches' fences (without blocking) and releases the finished ones
+// Params: NONE
+// Return: NONE
+void UploadContext::Collect()
+{
+    for (size_t i = 0; i < m_inFlight.size();) {
+        if (vkGetFenceStatus(m_device, m_inFlight[i].fence) != VK_SUCCESS) {
+            ++i;
+            continue;
+        }
+
+        Release(m_inFlight[i]);
+        m_freeBatches.push_back(std::move(m_inFlight[i]));
+        m_inFlight.erase(m_inFlight.begin() + i);
+    }
+}
+// =================================================
+// Name: WaitIdle
+// Desc: Blocks until every submitted batch is done, then releases them
+// Params: NONE
+// Return: NONE
+void UploadContext::WaitIdle()
+{
+    for (Batch& batch : m_inFlight)
+        vkWaitForFences(m_device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+
+    Collect();
+}
@@ -0,0 +1,80 @@
+#pragma once
+//---- Include Vulkan ----
+#include <vulkan/vulkan.h>
+
+//---- VS functionality includes ----
+#include <cstdint>
+#include <vector>
+
+#include "MemoryAllocator.h"
+#include "StagingArena.h"
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
+//=================================================
+//                 UploadContext
+//=================================================
+// Records the transfers from lots of calls into one command buffer and submits them together with a fence
+// Nothing waits on the queue, the staging memory is released once the batch's fence has signalled
+// If the device has a transfer only queue family the copies run there, so they don't compete with rendering
+// Anything needing graphics (blits) goes in a second command buffer run on the graphics queue after the copies
+class UploadContext {
+public:
+    // --- Public Functions ---
+    void Init(VkDevice device, uint32_t transferFamily, VkQueue transferQueue, uint32_t graphicsFamily, VkQueue graphicsQueue,
+        DeviceMemoryAllocator& allocator);
+    void Destroy();
+    VkCommandBuffer GetCommandBuffer();
+    VkCommandBuffer GetGraphicsCommandBuffer();
+    StagingSlice Stage(const void* data, VkDeviceSize size, VkDeviceSize alignment = STAGING_ALIGNMENT);
+    StagingSlice Reserve(VkDeviceSize size, void*& mapped, VkDeviceSize alignment = STAGING_ALIGNMENT);
+    void TransferBufferOwnership(VkBuffer buffer, VkAccessFlags dstAccess, VkPipelineStageFlags dstStage);
+    void TransferImageOwnership(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, const VkImageSubresourceRange& range,
+        VkAccessFlags dstAccess, VkPipelineStageFlags dstStage);
+    bool HasDedicatedTransfer() const { return m_dedicatedTransfer; }
+    uint64_t Submit();
+    bool IsFinished(uint64_t batch) const;
+    void Collect();
+    void WaitIdle();
+
+    // --- Public Attributes ---
+    // Covers buffer copies and every texel/block size we copy to images
+    static constexpr VkDeviceSize STAGING_ALIGNMENT = 16;
+
+private:
+    // --- Private Structs ---
+    struct Batch {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;     // Copies, on the transfer queue
+        VkCommandBuffer graphicsCommands = VK_NULL_HANDLE;  // Ownership acquires and blits, only with a dedicated transfer queue
+        VkSemaphore transferDone = VK_NULL_HANDLE;          // Holds the graphics half back until the copies are done
+        VkPipelineStageFlags acquireStages = 0;             // Where the graphics half first needs the copied data
+        VkFence fence = VK_NULL_HANDLE;         // Signalled when the GPU is done with everything in the batch
+        StagingArena staging;                   // Reset once the fence has signalled, its buffers are reused by the next batch
+        uint64_t serial = 0;                    // Handed out by Submit so callers can tell when it's done
+    };
+
+    // --- Private Functions ---
+    Batch& Recording();
+    void Release(Batch& batch);
+
+    // --- Private Attributes ---
+    VkDevice m_device = VK_NULL_HANDLE;
+    DeviceMemoryAllocator* m_allocator = nullptr;
+
+    uint32_t m_transferFamily = 0;
+    VkQueue m_transferQueue = VK_NULL_HANDLE;
+    VkCommandPool m_commandPool = VK_NULL_HANDLE;   // Transient, the buffers only ever get recorded once per batch
+
+    uint32_t m_graphicsFamily = 0;
+    VkQueue m_graphicsQueue = VK_NULL_HANDLE;
+    VkCommandPool m_graphicsPool = VK_NULL_HANDLE;  // Only made when the transfer family is a different one
+    bool m_dedicatedTransfer = false;
+
+    Batch m_recording;
+    bool m_isRecording = false;
+    std::vector<Batch> m_inFlight;                  // Submitted and waiting on their fence
+    std::vector<Batch> m_freeBatches;               // Finished, their command buffer and fence get reused
+    uint64_t m_submitCount = 0;
+};
+//=================================================
+//            END OF UploadContext
+//=================================================
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
@@ -3,15 +3,30 @@
 
 #extension GL_KHR_vulkan_glsl : enable
 
+// Per frame data
 layout(binding = 0) uniform UniformBufferObject {
-    mat4 model;
     mat4 view;
     mat4 proj;
+    mat4 viewProj;
 } ubo;
 
+// Per object data, one entry for every object drawn this frame (matching ObjectData on the CPU)
+struct ObjectData {
+    mat4 model;
+    uint mesh;
+    uint texture;   // Its slot in the texture table
+};
+layout(std430, binding = 2) readonly buffer ObjectBuffer {
+    ObjectData objects[];
+};
+
 // Vertex positions and colour
+// Built with COMPACT_VERTEX defined for the compact layout, its positions arrive as 0 to 1 (the model matrix
+// undoes that) and there's no colour
 layout(location = 0) in vec3 inPosition;
+#ifndef COMPACT_VERTEX
 layout(location = 1) in vec3 inColour;
+#endif
 layout(location = 2) in vec2 inTexCoord;
 
 // Note - 64bit numbers take two slots
@@ -20,17 +35,24 @@ layout(location = 2) in vec2 inTexCoord;
 // The color is written to this outColor variable
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragTexture;
 
 
 // The main function is invoked for every vertex
 void main() 
 {
     // Set the output position to the x y z position from the input
-    gl_Position = ubo.proj * ubo.view* ubo.model * vec4(inPosition, 1.0);    // The w value is filled in
+    // Each draw's firstInstance is its object's index, so the instance index finds its data
+    gl_Position = ubo.viewProj * objects[gl_InstanceIndex].model * vec4(inPosition, 1.0);    // The w value is filled in
 
     // And set the output colour the same way
+#ifdef COMPACT_VERTEX
+    fragColor = vec3(1.0);
+#else
     fragColor = inColour;
+#endif
 
     // UVs are the same too
     fragTexCoord = inTexCoord;
+    fragTexture = objects[gl_InstanceIndex].texture;
 }
\ No newline at end of file
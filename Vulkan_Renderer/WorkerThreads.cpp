@@ -0,0 +1,78 @@
+#include "WorkerThreads.h"
+
+// =================================================
+// Name: Start
+// Desc: Spins up the threads, they go straight to sleep waiting for a task
+// Params: count
+// Return: NONE
+void WorkerThreads::Start(uint32_t count)
+{
+    m_stopping = false;
+    for (uint32_t i = 0; i < count; ++i)
+        m_threads.emplace_back(&WorkerThreads::WorkerLoop, this, i);
+}
+// =================================================
+// Name: Stop
+// Desc: Wakes every thread up to exit and joins them
+// Params: NONE
+// Return: NONE
+void WorkerThreads::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+
+    for (std::thread& thread : m_threads)
+        thread.join();
+    m_threads.clear();
+}
+// =================================================
+// Name: Run
+// Desc: Runs the task on every thread, passing each its index, and waits for them all to finish
+// Params: task
+// Return: NONE
+void WorkerThreads::Run(const std::function<void(uint32_t)>& task)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_task = &task;
+    m_remaining = static_cast<uint32_t>(m_threads.size());
+    ++m_generation;
+
+    m_wake.notify_all();
+    m_finished.wait(lock, [this] { return m_remaining == 0; });
+
+    m_task = nullptr;
+}
+// =================================================
+// Name: WorkerLoop
+// Desc: What each thread runs, sleep until there's a new task or we're stopping
+// Params: index
+// Return: NONE
+void WorkerThreads::WorkerLoop(uint32_t index)
+{
+    uint64_t lastGeneration = 0;
+
+    for (;;) {
+        const std::function<void(uint32_t)>* task = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_stopping || m_generation != lastGeneration; });
+            if (m_stopping)
+                return;
+
+            lastGeneration = m_generation;
+            task = m_task;
+        }
+
+        // Run it outside the lock, that's the whole point
+        (*task)(index);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_remaining == 0)
+                m_finished.notify_one();
+        }
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+//---- VS functionality includes ----
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>
+//=================================================
+//                 WorkerThreads
+//=================================================
+// A fixed set of threads that sleep until handed a task, then all run it at once (each told its own index)
+// Run blocks until every thread has finished, so whatever the task touches is safe to use straight after
+class WorkerThreads {
+public:
+    // --- Public Functions ---
+    void Start(uint32_t count);
+    void Stop();
+    void Run(const std::function<void(uint32_t)>& task);
+    uint32_t GetCount() const { return static_cast<uint32_t>(m_threads.size()); }
+
+private:
+    // --- Private Functions ---
+    void WorkerLoop(uint32_t index);
+
+    // --- Private Attributes ---
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;                         // Tells the workers there's a new task
+    std::condition_variable m_finished;                     // Tells Run they're all done
+    const std::function<void(uint32_t)>* m_task = nullptr;
+    uint64_t m_generation = 0;                              // Bumped for every task so each worker runs it exactly once
+    uint32_t m_remaining = 0;
+    bool m_stopping = false;
+};
+//=================================================
+//            END OF WorkerThreads
+//=================================================
+// <><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><><>